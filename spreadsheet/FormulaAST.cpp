@@ -1,14 +1,23 @@
 #include "FormulaAST.h"
 
+#ifdef SPREADSHEET_WITH_ANTLR
 #include "FormulaBaseListener.h"
 #include "FormulaLexer.h"
 #include "FormulaParser.h"
+#endif
 
+#include <algorithm>
 #include <cassert>
+#include <charconv>
+#include <climits>
 #include <cmath>
+#include <cstring>
+#include <exception>
+#include <iterator>
 #include <memory>
 #include <optional>
 #include <sstream>
+#include <type_traits>
 
 namespace ASTImpl {
 
@@ -67,17 +76,141 @@ namespace ASTImpl {
         /* EP_ATOM */ {PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
     };
 
+    // Collects the program of a formula in reusable buffers and then copies
+    // it into the formula's arena at its exact size
+    class ProgramBuilder {
+    public:
+        void Emit(OpCode code, std::uint32_t operand = 0) {
+            code_.push_back({code, operand});
+        }
+
+        void EmitNumber(double value) {
+            Emit(OpCode::PushNumber, static_cast<std::uint32_t>(constants_.size()));
+            constants_.push_back(value);
+        }
+
+        void EmitCell(Position pos) {
+            Emit(OpCode::LoadCell, static_cast<std::uint32_t>(cells_.size()));
+            cells_.push_back(pos);
+        }
+
+        // the range arguments of a call have to be added right before it,
+        // after the code of its scalar arguments
+        void AddRange(CellRange range) {
+            ranges_.push_back(range);
+        }
+
+        // a single cell argument of a function is read as a one-cell range,
+        // but it is still listed among the referenced cells
+        void AddCellRange(Position cell) {
+            ranges_.push_back({cell, cell});
+            cells_.push_back(cell);
+        }
+
+        std::uint32_t GetRangeCount() const {
+            return static_cast<std::uint32_t>(ranges_.size());
+        }
+
+        void EmitCall(const Call& call) {
+            Emit(OpCode::Call, static_cast<std::uint32_t>(calls_.size()));
+            calls_.push_back(call);
+        }
+
+        // the arena memory Build takes, together with the sorted copy of
+        // the cells made by FormulaAST. Every array has a size that is a
+        // multiple of 8, so none of them needs padding
+        size_t GetArenaSize() const {
+            return code_.size() * sizeof(Instruction) + constants_.size() * sizeof(double)
+                + 2 * cells_.size() * sizeof(Position) + calls_.size() * sizeof(Call)
+                + ranges_.size() * sizeof(CellRange);
+        }
+
+        Program Build(Arena& arena) const {
+            Program program;
+            program.code = CopyToArena(arena, code_);
+            program.constants = CopyToArena(arena, constants_);
+            program.cells = CopyToArena(arena, cells_);
+            program.calls = CopyToArena(arena, calls_);
+            program.ranges = CopyToArena(arena, ranges_);
+            program.stack_size = GetStackSize();
+            return program;
+        }
+
+        void Clear() {
+            code_.clear();
+            constants_.clear();
+            cells_.clear();
+            calls_.clear();
+            ranges_.clear();
+        }
+
+    private:
+        std::vector<Instruction> code_;
+        std::vector<double> constants_;
+        std::vector<Position> cells_;
+        std::vector<Call> calls_;
+        std::vector<CellRange> ranges_;
+
+        template <typename T>
+        static Span<const T> CopyToArena(Arena& arena, const std::vector<T>& values) {
+            Span<T> result = arena.AllocateArray<T>(values.size());
+            std::copy(values.begin(), values.end(), result.begin());
+            return result;
+        }
+
+        size_t GetStackSize() const {
+            size_t depth = 0;
+            size_t max_depth = 0;
+            for (const Instruction& instruction : code_) {
+                switch (instruction.code) {
+                case OpCode::PushNumber:
+                case OpCode::LoadCell:
+                    max_depth = std::max(max_depth, ++depth);
+                    break;
+                case OpCode::Negate:
+                    break;
+                case OpCode::Call:
+                    depth -= calls_[instruction.operand].scalar_count;
+                    max_depth = std::max(max_depth, ++depth);
+                    break;
+                default:
+                    --depth;
+                }
+            }
+            return max_depth;
+        }
+    };
+
+    // Nodes live in the arena of their formula and are never destroyed one by
+    // one, so they must not own anything
     class Expr {
     public:
-        virtual ~Expr() = default;
         virtual void Print(std::ostream& out) const = 0;
-        virtual void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const = 0;
-        virtual double Evaluate(const SheetInterface& sheet) const = 0;
+        // offset shifts every cell reference
+        virtual void DoPrintFormula(std::ostream& out, Position offset, ExprPrecedence precedence) const = 0;
+        // appends the postfix code of the expression to the program
+        virtual void Compile(ProgramBuilder& program) const = 0;
+        // appends the node records of the expression in postfix order,
+        // see DeserializeFormulaAST
+        virtual void Serialize(std::string& out) const = 0;
+        // copies the expression with all its nodes into the arena
+        virtual const Expr* Clone(Arena& arena) const = 0;
 
         // higher is tighter
         virtual ExprPrecedence GetPrecedence() const = 0;
 
-        void PrintFormula(std::ostream& out, ExprPrecedence parent_precedence,
+        // a range is not a value by itself and may only be an argument
+        // of a function; other nodes return nullptr
+        virtual const CellRange* GetRange() const {
+            return nullptr;
+        }
+
+        // the position of a cell reference; other nodes return nullptr
+        virtual const Position* GetCell() const {
+            return nullptr;
+        }
+
+        void PrintFormula(std::ostream& out, Position offset, ExprPrecedence parent_precedence,
             bool right_child = false) const {
             auto precedence = GetPrecedence();
             auto mask = right_child ? PR_RIGHT : PR_LEFT;
@@ -86,14 +219,40 @@ namespace ASTImpl {
                 out << '(';
             }
 
-            DoPrintFormula(out, precedence);
+            DoPrintFormula(out, offset, precedence);
 
             if (parens_needed) {
                 out << ')';
             }
         }
+
+    protected:
+        ~Expr() = default;
+    };
+
+    // Tags of node records in the serialized form of a tree
+    enum class NodeTag : char {
+        Number = 'N',    // followed by the double
+        Cell = 'C',      // followed by the row and the column
+        Range = 'R',     // followed by the first and the last cell
+        Unary = 'U',     // followed by the operator character
+        Binary = 'B',    // followed by the operator character
+        Function = 'F',  // followed by the function and the number of arguments
     };
 
+    namespace {
+        template <typename T>
+        void AppendRaw(std::string& out, const T& value) {
+            static_assert(std::is_trivially_copyable_v<T>);
+            out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+
+        void AppendPosition(std::string& out, Position pos) {
+            AppendRaw<std::int32_t>(out, pos.row);
+            AppendRaw<std::int32_t>(out, pos.col);
+        }
+    }
+
     namespace {
         class BinaryOpExpr final : public Expr {
         public:
@@ -105,10 +264,10 @@ namespace ASTImpl {
             };
 
         public:
-            explicit BinaryOpExpr(Type type, std::unique_ptr<Expr> lhs, std::unique_ptr<Expr> rhs)
+            explicit BinaryOpExpr(Type type, const Expr* lhs, const Expr* rhs)
                 : type_(type)
-                , lhs_(std::move(lhs))
-                , rhs_(std::move(rhs)) {
+                , lhs_(lhs)
+                , rhs_(rhs) {
             }
 
             void Print(std::ostream& out) const override {
@@ -119,10 +278,10 @@ namespace ASTImpl {
                 out << ')';
             }
 
-            void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const override {
-                lhs_->PrintFormula(out, precedence);
+            void DoPrintFormula(std::ostream& out, Position offset, ExprPrecedence precedence) const override {
+                lhs_->PrintFormula(out, offset, precedence);
                 out << static_cast<char>(type_);
-                rhs_->PrintFormula(out, precedence, /* right_child = */ true);
+                rhs_->PrintFormula(out, offset, precedence, /* right_child = */ true);
             }
 
             ExprPrecedence GetPrecedence() const override {
@@ -142,34 +301,46 @@ namespace ASTImpl {
                 }
             }
 
-            double Evaluate(const SheetInterface& sheet) const override {
-                double result = ACTION.at(type_)(lhs_->Evaluate(sheet), rhs_->Evaluate(sheet));
-                if (!std::isfinite(result))
-                {
-                    throw FormulaError(FormulaError::Category::Arithmetic);
-                }
-                return result;
+            void Compile(ProgramBuilder& program) const override {
+                lhs_->Compile(program);
+                rhs_->Compile(program);
+                program.Emit(GetOpCode());
+            }
+
+            void Serialize(std::string& out) const override {
+                lhs_->Serialize(out);
+                rhs_->Serialize(out);
+                out += static_cast<char>(NodeTag::Binary);
+                out += static_cast<char>(type_);
+            }
+
+            const Expr* Clone(Arena& arena) const override {
+                return arena.Create<BinaryOpExpr>(type_, lhs_->Clone(arena), rhs_->Clone(arena));
             }
 
             std::pair<const Expr*, const Expr*> GetOperands() const
             {
-                return std::pair{ lhs_.get(), rhs_.get() };
+                return std::pair{ lhs_, rhs_ };
             }
 
         private:
             Type type_;
-            std::unique_ptr<Expr> lhs_;
-            std::unique_ptr<Expr> rhs_;
+            const Expr* lhs_;
+            const Expr* rhs_;
 
-            static const std::unordered_map<Type, std::function<double(double, double)>> ACTION;
-        };
-
-        const std::unordered_map<BinaryOpExpr::Type, std::function<double(double, double)>>
-            BinaryOpExpr::ACTION = {
-                        std::pair{ Type::Add,       [](double lhs, double rhs) { return lhs + rhs; } },
-                        std::pair{ Type::Subtract,  [](double lhs, double rhs) { return lhs - rhs; } },
-                        std::pair{ Type::Multiply,  [](double lhs, double rhs) { return lhs * rhs; } },
-                        std::pair{ Type::Divide,    [](double lhs, double rhs) { return lhs / rhs; } }
+            OpCode GetOpCode() const {
+                switch (type_) {
+                case Add:
+                    return OpCode::Add;
+                case Subtract:
+                    return OpCode::Subtract;
+                case Multiply:
+                    return OpCode::Multiply;
+                default:
+                    assert(type_ == Divide);
+                    return OpCode::Divide;
+                }
+            }
         };
 
         class UnaryOpExpr final : public Expr {
@@ -180,9 +351,9 @@ namespace ASTImpl {
             };
 
         public:
-            explicit UnaryOpExpr(Type type, std::unique_ptr<Expr> operand)
+            explicit UnaryOpExpr(Type type, const Expr* operand)
                 : type_(type)
-                , operand_(std::move(operand)) {
+                , operand_(operand) {
             }
 
             void Print(std::ostream& out) const override {
@@ -191,34 +362,40 @@ namespace ASTImpl {
                 out << ')';
             }
 
-            void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const override {
+            void DoPrintFormula(std::ostream& out, Position offset, ExprPrecedence precedence) const override {
                 out << static_cast<char>(type_);
-                operand_->PrintFormula(out, precedence);
+                operand_->PrintFormula(out, offset, precedence);
             }
 
             ExprPrecedence GetPrecedence() const override {
                 return EP_UNARY;
             }
             
-            double Evaluate(const SheetInterface& sheet) const override {
-                return ACTION.at(type_)(operand_->Evaluate(sheet));
+            void Compile(ProgramBuilder& program) const override {
+                operand_->Compile(program);
+                if (type_ == UnaryMinus) {
+                    program.Emit(OpCode::Negate);
+                }
+            }
+
+            void Serialize(std::string& out) const override {
+                operand_->Serialize(out);
+                out += static_cast<char>(NodeTag::Unary);
+                out += static_cast<char>(type_);
+            }
+
+            const Expr* Clone(Arena& arena) const override {
+                return arena.Create<UnaryOpExpr>(type_, operand_->Clone(arena));
             }
 
             const Expr* GetOperand() const
             {
-                return operand_.get();
+                return operand_;
             }
 
         private:
             Type type_;
-            std::unique_ptr<Expr> operand_;
-            static const std::unordered_map<Type, std::function<double(double)>> ACTION;
-        };
-
-        const std::unordered_map<UnaryOpExpr::Type, std::function<double(double)>>
-            UnaryOpExpr::ACTION = {
-                        std::pair{ Type::UnaryPlus, [](double operand) {return operand; } },
-                        std::pair{ Type::UnaryMinus,[](double operand) {return -operand; } }
+            const Expr* operand_;
         };
 
         class NumberExpr final : public Expr {
@@ -231,7 +408,7 @@ namespace ASTImpl {
                 out << value_;
             }
 
-            void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */) const override {
+            void DoPrintFormula(std::ostream& out, Position /* offset */, ExprPrecedence /* precedence */) const override {
                 out << value_;
             }
 
@@ -239,84 +416,832 @@ namespace ASTImpl {
                 return EP_ATOM;
             }
 
-            // Для чисел метод возвращает значение числа.
-            double Evaluate(const SheetInterface& sheet) const override {
-                return value_;
+            void Compile(ProgramBuilder& program) const override {
+                program.EmitNumber(value_);
+            }
+
+            void Serialize(std::string& out) const override {
+                out += static_cast<char>(NodeTag::Number);
+                AppendRaw(out, value_);
+            }
+
+            const Expr* Clone(Arena& arena) const override {
+                return arena.Create<NumberExpr>(value_);
             }
 
         private:
             double value_;
         };
 
+        Position Shift(Position pos, Position offset) {
+            return {pos.row + offset.row, pos.col + offset.col};
+        }
+
+        void PrintCell(std::ostream& out, Position pos) {
+            if (!pos.IsValid()) {
+                out << FormulaError::Category::Ref;
+            }
+            else {
+                char buffer[Position::MAX_STRING_LENGTH];
+                const auto result = pos.ToChars(buffer, buffer + Position::MAX_STRING_LENGTH);
+                out.write(buffer, result.ptr - buffer);
+            }
+        }
+
         class CellExpr final : public Expr {
         public:
-            explicit CellExpr(const Position* cell)
+            explicit CellExpr(Position cell)
                 : cell_(cell) {
             }
 
             void Print(std::ostream& out) const override {
-                if (!cell_->IsValid()) {
-                    out << FormulaError::Category::Ref;
+                PrintCell(out, cell_);
+            }
+
+            void DoPrintFormula(std::ostream& out, Position offset, ExprPrecedence /* precedence */) const override {
+                PrintCell(out, Shift(cell_, offset));
+            }
+
+            ExprPrecedence GetPrecedence() const override {
+                return EP_ATOM;
+            }
+
+            void Compile(ProgramBuilder& program) const override {
+                program.EmitCell(cell_);
+            }
+
+            void Serialize(std::string& out) const override {
+                out += static_cast<char>(NodeTag::Cell);
+                AppendPosition(out, cell_);
+            }
+
+            const Position* GetCell() const override {
+                return &cell_;
+            }
+
+            const Expr* Clone(Arena& arena) const override {
+                return arena.Create<CellExpr>(cell_);
+            }
+
+        private:
+            Position cell_;
+        };
+
+        class RangeExpr final : public Expr {
+        public:
+            explicit RangeExpr(CellRange range)
+                : range_(range) {
+            }
+
+            void Print(std::ostream& out) const override {
+                PrintCell(out, range_.first);
+                out << ':';
+                PrintCell(out, range_.last);
+            }
+
+            void DoPrintFormula(std::ostream& out, Position offset, ExprPrecedence /* precedence */) const override {
+                PrintCell(out, Shift(range_.first, offset));
+                out << ':';
+                PrintCell(out, Shift(range_.last, offset));
+            }
+
+            ExprPrecedence GetPrecedence() const override {
+                return EP_ATOM;
+            }
+
+            void Compile(ProgramBuilder& /* program */) const override {
+                // compiled by the function it is an argument of
+                assert(false);
+            }
+
+            void Serialize(std::string& out) const override {
+                out += static_cast<char>(NodeTag::Range);
+                AppendPosition(out, range_.first);
+                AppendPosition(out, range_.last);
+            }
+
+            const CellRange* GetRange() const override {
+                return &range_;
+            }
+
+            const Expr* Clone(Arena& arena) const override {
+                return arena.Create<RangeExpr>(range_);
+            }
+
+        private:
+            CellRange range_;
+        };
+
+        struct FunctionName {
+            std::string_view name;
+            Function function;
+        };
+
+        constexpr FunctionName FUNCTION_NAMES[] = {
+            {"SUM", Function::Sum},
+            {"AVERAGE", Function::Average},
+            {"MIN", Function::Min},
+            {"MAX", Function::Max},
+            {"COUNT", Function::Count},
+        };
+
+        std::optional<Function> FindFunction(std::string_view name) {
+            for (const FunctionName& entry : FUNCTION_NAMES) {
+                if (entry.name == name) {
+                    return entry.function;
                 }
-                else {
-                    out << cell_->ToString();
+            }
+            return std::nullopt;
+        }
+
+        std::string_view GetFunctionName(Function function) {
+            for (const FunctionName& entry : FUNCTION_NAMES) {
+                if (entry.function == function) {
+                    return entry.name;
                 }
             }
+            assert(false);
+            return {};
+        }
 
-            void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */) const override {
-                Print(out);
+        class FunctionExpr final : public Expr {
+        public:
+            // args must not be empty
+            FunctionExpr(Function function, Span<const Expr* const> args)
+                : function_(function)
+                , args_(args) {
+            }
+
+            void Print(std::ostream& out) const override {
+                out << '(' << GetFunctionName(function_);
+                for (const Expr* arg : args_) {
+                    out << ' ';
+                    arg->Print(out);
+                }
+                out << ')';
+            }
+
+            void DoPrintFormula(std::ostream& out, Position offset, ExprPrecedence /* precedence */) const override {
+                out << GetFunctionName(function_) << '(';
+                bool first = true;
+                for (const Expr* arg : args_) {
+                    if (!first) {
+                        out << ',';
+                    }
+                    first = false;
+                    arg->PrintFormula(out, offset, EP_ATOM);
+                }
+                out << ')';
             }
 
             ExprPrecedence GetPrecedence() const override {
                 return EP_ATOM;
             }
 
-            double Evaluate(const SheetInterface& sheet) const override {
-                if (!cell_->IsValid())
-                {
-                    throw FormulaError(FormulaError::Category::Ref);
+            void Compile(ProgramBuilder& program) const override {
+                // ranges go first, so that ranges of nested calls do not
+                // get in between them. A single cell is compiled as a range
+                // too, so that F(A1) skips empty cells and text like F(A1:A1)
+                Call call{function_, 0, program.GetRangeCount(), 0};
+                for (const Expr* arg : args_) {
+                    if (const CellRange* range = arg->GetRange()) {
+                        program.AddRange(*range);
+                        ++call.range_count;
+                    } else if (const Position* cell = arg->GetCell()) {
+                        program.AddCellRange(*cell);
+                        ++call.range_count;
+                    }
+                }
+                for (const Expr* arg : args_) {
+                    if (!arg->GetRange() && !arg->GetCell()) {
+                        arg->Compile(program);
+                        ++call.scalar_count;
+                    }
+                }
+                program.EmitCall(call);
+            }
+
+            void Serialize(std::string& out) const override {
+                for (const Expr* arg : args_) {
+                    arg->Serialize(out);
+                }
+                out += static_cast<char>(NodeTag::Function);
+                out += static_cast<char>(function_);
+                AppendRaw<std::uint32_t>(out, static_cast<std::uint32_t>(args_.size()));
+            }
+
+            const Expr* Clone(Arena& arena) const override {
+                Span<const Expr*> args = arena.AllocateArray<const Expr*>(args_.size());
+                for (size_t i = 0; i < args_.size(); ++i) {
+                    args[i] = args_[i]->Clone(arena);
+                }
+                return arena.Create<FunctionExpr>(function_, args);
+            }
+
+        private:
+            Function function_;
+            Span<const Expr* const> args_;
+        };
+
+
+        // Errors travel on the stack as error numbers (see ToErrorNumber), so
+        // that a formula over an erroneous cell does not throw. Evaluation
+        // still reports the error it would have met first: an operation
+        // passes on the error of its left operand, then of the right one, and
+        // only then checks its own result
+        double LoadCellValue(const SheetInterface& sheet, Position pos) {
+            if (!pos.IsValid())
+            {
+                return ToErrorNumber(FormulaError::Category::Ref);
+            }
+            return sheet.GetCellNumber(pos);
+        }
+
+        double CheckFinite(double result) {
+            if (!std::isfinite(result))
+            {
+                return ToErrorNumber(FormulaError::Category::Arithmetic);
+            }
+            return result;
+        }
+
+        // A finite result means that neither operand was an error, so the
+        // common case costs one check
+        double CheckFinite(double lhs, double rhs, double result) {
+            if (std::isfinite(result)) {
+                return result;
+            }
+            if (IsErrorNumber(lhs)) {
+                return lhs;
+            }
+            if (IsErrorNumber(rhs)) {
+                return rhs;
+            }
+            return ToErrorNumber(FormulaError::Category::Arithmetic);
+        }
+
+        // Empty cells and text in ranges and in single cell arguments are
+        // skipped, as if they were not there.
+        // MIN and MAX of no numbers are 0, AVERAGE of no numbers is an error
+        double CallFunction(const Call& call, const double* scalars, Span<const CellRange> ranges,
+            const SheetInterface& sheet, Position offset) {
+            RangeSummary summary;
+            for (std::uint32_t i = 0; i < call.scalar_count; ++i) {
+                if (IsErrorNumber(scalars[i])) {
+                    return scalars[i];
                 }
-                const CellInterface* cell = sheet.GetCell(*cell_);
-                if (!cell)
-                {
-                    return 0;
+                summary.Add(scalars[i]);
+            }
+            for (std::uint32_t i = 0; i < call.range_count; ++i) {
+                const CellRange& range = ranges[call.first_range + i];
+                const CellRange shifted{Shift(range.first, offset), Shift(range.last, offset)};
+                if (!shifted.IsValid()) {
+                    return ToErrorNumber(FormulaError::Category::Ref);
                 }
-                const CellInterface::Value result = sheet.GetCell(*cell_)->GetValue();
-                if (std::holds_alternative<FormulaError>(result))
-                {
-                    throw std::get<FormulaError>(result);
+                summary.Merge(sheet.SummarizeRange(shifted));
+                if (summary.error) {
+                    return ToErrorNumber(summary.error->GetCategory());
                 }
-                else if (std::holds_alternative<std::string>(result))
-                {
-                    throw FormulaError(FormulaError::Category::Value);
+            }
+
+            switch (call.function) {
+            case Function::Sum:
+                return CheckFinite(summary.sum);
+            case Function::Average:
+                return CheckFinite(summary.sum / static_cast<double>(summary.count));
+            case Function::Min:
+                return summary.count == 0 ? 0 : summary.min;
+            case Function::Max:
+                return summary.count == 0 ? 0 : summary.max;
+            default:
+                assert(call.function == Function::Count);
+                return static_cast<double>(summary.count);
+            }
+        }
+
+        const ProgramBuilder& Compile(const Expr& root) {
+            thread_local ProgramBuilder builder;
+            builder.Clear();
+            root.Compile(builder);
+            return builder;
+        }
+
+        // Trees are built in a scratch arena of the thread, which keeps its
+        // largest block between formulas, and are then copied into an arena
+        // of their own of the exact size (see FormulaAST::FormulaAST)
+        Arena& GetScratchArena() {
+            thread_local Arena arena(Arena::DEFAULT_BLOCK_SIZE * 16);
+            arena.Reset();
+            return arena;
+        }
+
+        // Converts a NUMBER token the same way the ANTLR listener does.
+        // from_chars handles every well-formed literal; the stream is only
+        // consulted when it refuses (e.g. on overflow), so that the rare
+        // edge cases keep the listener's behaviour.
+        std::optional<double> ParseNumber(std::string_view text) {
+            double value = 0;
+            const auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+            if (ec == std::errc() && ptr == text.data() + text.size()) {
+                return value;
+            }
+            std::istringstream in{std::string(text)};
+            in >> value;
+            if (!in) {
+                return std::nullopt;
+            }
+            return value;
+        }
+
+        enum class TokenType {
+            Number,
+            Cell,
+            Add,
+            Sub,
+            Mul,
+            Div,
+            LeftParen,
+            RightParen,
+            Function,
+            Colon,
+            Comma,
+            End,
+        };
+
+        struct Token {
+            TokenType type = TokenType::End;
+            std::string_view text;
+        };
+
+        // Splits a formula into the tokens of Formula.g4, skipping whitespace
+        class Tokenizer {
+        public:
+            explicit Tokenizer(std::string_view text)
+                : text_(text) {
+            }
+
+            // Returns End at the end of the text; throws ParsingError on
+            // characters that do not form a token
+            Token Next() {
+                while (offset_ < text_.size()
+                    && (text_[offset_] == ' ' || text_[offset_] == '\t' || text_[offset_] == '\n'
+                        || text_[offset_] == '\r')) {
+                    ++offset_;
                 }
-                return std::get<double>(result);
+                if (offset_ == text_.size()) {
+                    return {TokenType::End, {}};
+                }
+
+                const size_t begin = offset_;
+                const char c = text_[begin];
+                size_t end = begin + 1;
+                TokenType type;
+                switch (c) {
+                case '+':
+                    type = TokenType::Add;
+                    break;
+                case '-':
+                    type = TokenType::Sub;
+                    break;
+                case '*':
+                    type = TokenType::Mul;
+                    break;
+                case '/':
+                    type = TokenType::Div;
+                    break;
+                case '(':
+                    type = TokenType::LeftParen;
+                    break;
+                case ')':
+                    type = TokenType::RightParen;
+                    break;
+                case ':':
+                    type = TokenType::Colon;
+                    break;
+                case ',':
+                    type = TokenType::Comma;
+                    break;
+                default:
+                    if (IsLetter(c)) {
+                        // CELL: [A-Z]+[0-9]+, or FUNCTION, which has no digits
+                        while (end < text_.size() && IsLetter(text_[end])) {
+                            ++end;
+                        }
+                        const size_t digits_end = SkipDigits(end);
+                        if (digits_end != end) {
+                            end = digits_end;
+                            type = TokenType::Cell;
+                        }
+                        else if (FindFunction(text_.substr(begin, end - begin))) {
+                            type = TokenType::Function;
+                        }
+                        else {
+                            ThrowLexingError(begin);
+                        }
+                    }
+                    else if (IsDigit(c) || c == '.') {
+                        end = ScanNumber(begin);
+                        if (end == begin) {
+                            ThrowLexingError(begin);
+                        }
+                        type = TokenType::Number;
+                    }
+                    else {
+                        ThrowLexingError(begin);
+                    }
+                }
+                offset_ = end;
+                return {type, text_.substr(begin, end - begin)};
             }
 
         private:
-            const Position* cell_;
+            std::string_view text_;
+            size_t offset_ = 0;
+
+            static bool IsDigit(char c) {
+                return c >= '0' && c <= '9';
+            }
+
+            static bool IsLetter(char c) {
+                return c >= 'A' && c <= 'Z';
+            }
+
+            size_t SkipDigits(size_t pos) const {
+                while (pos < text_.size() && IsDigit(text_[pos])) {
+                    ++pos;
+                }
+                return pos;
+            }
+
+            // NUMBER: UINT EXPONENT? | UINT? '.' UINT EXPONENT?
+            size_t ScanNumber(size_t pos) const {
+                const size_t int_end = SkipDigits(pos);
+                size_t end = int_end;
+                if (end < text_.size() && text_[end] == '.') {
+                    const size_t frac_end = SkipDigits(end + 1);
+                    if (frac_end == end + 1) {
+                        // '.' without digits is not a part of the literal
+                        return int_end;
+                    }
+                    end = frac_end;
+                }
+                if (end < text_.size() && (text_[end] == 'e' || text_[end] == 'E')) {
+                    size_t exp_begin = end + 1;
+                    if (exp_begin < text_.size() && (text_[exp_begin] == '+' || text_[exp_begin] == '-')) {
+                        ++exp_begin;
+                    }
+                    const size_t exp_end = SkipDigits(exp_begin);
+                    if (exp_end != exp_begin) {
+                        end = exp_end;
+                    }
+                }
+                return end;
+            }
+
+            [[noreturn]] void ThrowLexingError(size_t pos) const {
+                throw ParsingError("Error when lexing: token recognition error at: '"
+                    + std::string(1, text_[pos]) + "'");
+            }
+        };
+
+        // Hand-written parser for the grammar in Formula.g4. Builds the AST
+        // directly from the text, without a token stream or a parse tree.
+        //
+        // Errors follow ParseFormulaAST over ANTLR: lexing and syntax errors are
+        // thrown as ParsingError at once, while an invalid number or position
+        // is reported only if the whole formula is syntactically correct (the
+        // listener checks them while walking the finished tree), the leftmost
+        // one first.
+        class FormulaParserImpl {
+        public:
+            explicit FormulaParserImpl(std::string_view text)
+                : tokenizer_(text)
+                , arena_(GetScratchArena()) {
+                NextToken();
+            }
+
+            FormulaAST Parse() {
+                const Expr* root = ParseExpr(PREC_LOWEST);
+                if (token_.type != TokenType::End) {
+                    ThrowUnexpected();
+                }
+                if (deferred_error_) {
+                    std::rethrow_exception(deferred_error_);
+                }
+                return FormulaAST(arena_, root);
+            }
+
+        private:
+            // binding power of binary operators, higher is tighter;
+            // a prefix + or - binds tighter than any of them
+            enum BindingPower {
+                PREC_LOWEST,
+                PREC_ADD,
+                PREC_MUL,
+            };
+
+            Tokenizer tokenizer_;
+            Token token_;
+            Arena& arena_;
+            std::exception_ptr deferred_error_;
+
+            void NextToken() {
+                token_ = tokenizer_.Next();
+            }
+
+            [[noreturn]] void ThrowUnexpected() const {
+                if (token_.type == TokenType::End) {
+                    throw ParsingError("Error when parsing: unexpected end of formula");
+                }
+                throw ParsingError("Error when parsing: " + std::string(token_.text));
+            }
+
+            void Defer(std::exception_ptr error) {
+                if (!deferred_error_) {
+                    deferred_error_ = std::move(error);
+                }
+            }
+
+            static int GetBindingPower(TokenType type) {
+                switch (type) {
+                case TokenType::Add:
+                case TokenType::Sub:
+                    return PREC_ADD;
+                case TokenType::Mul:
+                case TokenType::Div:
+                    return PREC_MUL;
+                default:
+                    return PREC_LOWEST;
+                }
+            }
+
+            static BinaryOpExpr::Type GetBinaryType(TokenType type) {
+                switch (type) {
+                case TokenType::Add:
+                    return BinaryOpExpr::Add;
+                case TokenType::Sub:
+                    return BinaryOpExpr::Subtract;
+                case TokenType::Mul:
+                    return BinaryOpExpr::Multiply;
+                default:
+                    assert(type == TokenType::Div);
+                    return BinaryOpExpr::Divide;
+                }
+            }
+
+            // Parses operators binding tighter than min_power; all of them are
+            // left-associative
+            const Expr* ParseExpr(int min_power) {
+                const Expr* lhs = ParseUnary();
+                while (GetBindingPower(token_.type) > min_power) {
+                    const TokenType op = token_.type;
+                    NextToken();
+                    const Expr* rhs = ParseExpr(GetBindingPower(op));
+                    lhs = arena_.Create<BinaryOpExpr>(GetBinaryType(op), lhs, rhs);
+                }
+                return lhs;
+            }
+
+            const Expr* ParseUnary() {
+                if (token_.type == TokenType::Add || token_.type == TokenType::Sub) {
+                    const auto type = token_.type == TokenType::Sub ? UnaryOpExpr::UnaryMinus
+                                                                    : UnaryOpExpr::UnaryPlus;
+                    NextToken();
+                    return arena_.Create<UnaryOpExpr>(type, ParseUnary());
+                }
+                return ParseAtom();
+            }
+
+            const Expr* ParseAtom() {
+                switch (token_.type) {
+                case TokenType::LeftParen: {
+                    NextToken();
+                    const Expr* expr = ParseExpr(PREC_LOWEST);
+                    if (token_.type != TokenType::RightParen) {
+                        ThrowUnexpected();
+                    }
+                    NextToken();
+                    return expr;
+                }
+                case TokenType::Number: {
+                    const auto value = ParseNumber(token_.text);
+                    if (!value) {
+                        Defer(std::make_exception_ptr(
+                            ParsingError("Invalid number: " + std::string(token_.text))));
+                    }
+                    NextToken();
+                    return arena_.Create<NumberExpr>(value.value_or(0));
+                }
+                case TokenType::Cell:
+                    return arena_.Create<CellExpr>(ParsePosition());
+                case TokenType::Function:
+                    return ParseFunction();
+                default:
+                    ThrowUnexpected();
+                }
+            }
+
+            Position ParsePosition() {
+                assert(token_.type == TokenType::Cell);
+                const auto value = Position::FromString(token_.text);
+                if (!value.IsValid()) {
+                    Defer(std::make_exception_ptr(
+                        FormulaException("Invalid position: " + std::string(token_.text))));
+                }
+                NextToken();
+                return value;
+            }
+
+            // FUNCTION '(' arg (',' arg)* ')'
+            const Expr* ParseFunction() {
+                const Function function = *FindFunction(token_.text);
+                NextToken();
+                if (token_.type != TokenType::LeftParen) {
+                    ThrowUnexpected();
+                }
+                NextToken();
+                thread_local std::vector<const Expr*> args_buffer;
+                // nested calls share the buffer, their arguments go on top
+                const size_t args_begin = args_buffer.size();
+                try {
+                    args_buffer.push_back(ParseArgument());
+                    while (token_.type == TokenType::Comma) {
+                        NextToken();
+                        args_buffer.push_back(ParseArgument());
+                    }
+                }
+                catch (...) {
+                    args_buffer.resize(args_begin);
+                    throw;
+                }
+                Span<const Expr*> args = arena_.AllocateArray<const Expr*>(args_buffer.size() - args_begin);
+                std::copy(args_buffer.begin() + args_begin, args_buffer.end(), args.begin());
+                args_buffer.resize(args_begin);
+                if (token_.type != TokenType::RightParen) {
+                    ThrowUnexpected();
+                }
+                NextToken();
+                return arena_.Create<FunctionExpr>(function, args);
+            }
+
+            // CELL ':' CELL | expr
+            const Expr* ParseArgument() {
+                if (token_.type == TokenType::Cell) {
+                    Tokenizer lookahead = tokenizer_;
+                    if (lookahead.Next().type == TokenType::Colon) {
+                        const Position first = ParsePosition();
+                        NextToken();
+                        if (token_.type != TokenType::Cell) {
+                            ThrowUnexpected();
+                        }
+                        const Position last = ParsePosition();
+                        // corners may be given in any order, B2:A1 is A1:B2
+                        return arena_.Create<RangeExpr>(CellRange{
+                            {std::min(first.row, last.row), std::min(first.col, last.col)},
+                            {std::max(first.row, last.row), std::max(first.col, last.col)}});
+                    }
+                }
+                return ParseExpr(PREC_LOWEST);
+            }
         };
 
+        // Rebuilds a tree from the records written by Expr::Serialize. The
+        // records are in postfix order, so every operator finds its operands
+        // on top of the stack
+        class TreeReader {
+        public:
+            explicit TreeReader(std::string_view data)
+                : data_(data)
+                , arena_(GetScratchArena()) {
+            }
+
+            FormulaAST Read() {
+                std::vector<const Expr*> stack;
+                while (!data_.empty()) {
+                    const auto tag = static_cast<NodeTag>(ReadRaw<char>());
+                    switch (tag) {
+                    case NodeTag::Number:
+                        stack.push_back(arena_.Create<NumberExpr>(ReadRaw<double>()));
+                        break;
+                    case NodeTag::Cell:
+                        stack.push_back(arena_.Create<CellExpr>(ReadPosition()));
+                        break;
+                    case NodeTag::Range: {
+                        const Position first = ReadPosition();
+                        const Position last = ReadPosition();
+                        if (first.row > last.row || first.col > last.col) {
+                            ThrowCorrupted();
+                        }
+                        stack.push_back(arena_.Create<RangeExpr>(CellRange{first, last}));
+                        break;
+                    }
+                    case NodeTag::Unary: {
+                        const auto type = static_cast<UnaryOpExpr::Type>(ReadRaw<char>());
+                        if (type != UnaryOpExpr::UnaryPlus && type != UnaryOpExpr::UnaryMinus) {
+                            ThrowCorrupted();
+                        }
+                        const Expr* operand = PopValue(stack);
+                        stack.push_back(arena_.Create<UnaryOpExpr>(type, operand));
+                        break;
+                    }
+                    case NodeTag::Binary: {
+                        const auto type = static_cast<BinaryOpExpr::Type>(ReadRaw<char>());
+                        if (type != BinaryOpExpr::Add && type != BinaryOpExpr::Subtract
+                            && type != BinaryOpExpr::Multiply && type != BinaryOpExpr::Divide) {
+                            ThrowCorrupted();
+                        }
+                        const Expr* rhs = PopValue(stack);
+                        const Expr* lhs = PopValue(stack);
+                        stack.push_back(arena_.Create<BinaryOpExpr>(type, lhs, rhs));
+                        break;
+                    }
+                    case NodeTag::Function: {
+                        const auto function = static_cast<Function>(ReadRaw<char>());
+                        const auto arg_count = ReadRaw<std::uint32_t>();
+                        if (static_cast<size_t>(function) >= std::size(FUNCTION_NAMES)
+                            || arg_count == 0 || arg_count > stack.size()) {
+                            ThrowCorrupted();
+                        }
+                        Span<const Expr*> args = arena_.AllocateArray<const Expr*>(arg_count);
+                        std::copy(stack.end() - arg_count, stack.end(), args.begin());
+                        stack.resize(stack.size() - arg_count);
+                        stack.push_back(arena_.Create<FunctionExpr>(function, args));
+                        break;
+                    }
+                    default:
+                        ThrowCorrupted();
+                    }
+                }
+                if (stack.size() != 1 || stack.back()->GetRange()) {
+                    ThrowCorrupted();
+                }
+                return FormulaAST(arena_, stack.back());
+            }
+
+        private:
+            std::string_view data_;
+            Arena& arena_;
+
+            [[noreturn]] static void ThrowCorrupted() {
+                throw ParsingError("Corrupted formula data");
+            }
+
+            template <typename T>
+            T ReadRaw() {
+                if (data_.size() < sizeof(T)) {
+                    ThrowCorrupted();
+                }
+                T value;
+                std::memcpy(&value, data_.data(), sizeof(T));
+                data_.remove_prefix(sizeof(T));
+                return value;
+            }
+
+            Position ReadPosition() {
+                const auto row = ReadRaw<std::int32_t>();
+                const auto col = ReadRaw<std::int32_t>();
+                const Position pos{row, col};
+                if (!pos.IsValid()) {
+                    ThrowCorrupted();
+                }
+                return pos;
+            }
 
+            // a range may only be an argument of a function
+            static const Expr* PopValue(std::vector<const Expr*>& stack) {
+                if (stack.empty() || stack.back()->GetRange()) {
+                    ThrowCorrupted();
+                }
+                const Expr* value = stack.back();
+                stack.pop_back();
+                return value;
+            }
+        };
+
+#ifdef SPREADSHEET_WITH_ANTLR
         class ParseASTListener final : public FormulaBaseListener {
         public:
-            std::unique_ptr<Expr> MoveRoot() {
+            ParseASTListener()
+                : arena_(GetScratchArena()) {
+            }
+
+            const Expr* MoveRoot() {
                 assert(args_.size() == 1);
-                auto root = std::move(args_.front());
+                auto root = args_.front();
                 args_.clear();
 
                 return root;
             }
 
-            std::forward_list<Position> MoveCells() {
-                return std::move(cells_);
+            const Arena& GetArena() const {
+                return arena_;
             }
 
         public:
             void exitUnaryOp(FormulaParser::UnaryOpContext* ctx) override {
                 assert(args_.size() >= 1);
 
-                auto operand = std::move(args_.back());
+                auto operand = args_.back();
 
                 UnaryOpExpr::Type type;
                 if (ctx->SUB()) {
@@ -327,8 +1252,7 @@ namespace ASTImpl {
                     type = UnaryOpExpr::UnaryPlus;
                 }
 
-                auto node = std::make_unique<UnaryOpExpr>(type, std::move(operand));
-                args_.back() = std::move(node);
+                args_.back() = arena_.Create<UnaryOpExpr>(type, operand);
             }
 
             void exitLiteral(FormulaParser::LiteralContext* ctx) override {
@@ -340,8 +1264,7 @@ namespace ASTImpl {
                     throw ParsingError("Invalid number: " + valueStr);
                 }
 
-                auto node = std::make_unique<NumberExpr>(value);
-                args_.push_back(std::move(node));
+                args_.push_back(arena_.Create<NumberExpr>(value));
             }
 
             void exitCell(FormulaParser::CellContext* ctx) override {
@@ -351,18 +1274,43 @@ namespace ASTImpl {
                     throw FormulaException("Invalid position: " + value_str);
                 }
 
-                cells_.push_front(value);
-                auto node = std::make_unique<CellExpr>(&cells_.front());
-                args_.push_back(std::move(node));
+                args_.push_back(arena_.Create<CellExpr>(value));
+            }
+
+            void exitRange(FormulaParser::RangeContext* ctx) override {
+                Position corners[2];
+                for (size_t i = 0; i < 2; ++i) {
+                    auto value_str = ctx->CELL(i)->getSymbol()->getText();
+                    corners[i] = Position::FromString(value_str);
+                    if (!corners[i].IsValid()) {
+                        throw FormulaException("Invalid position: " + value_str);
+                    }
+                }
+                args_.push_back(arena_.Create<RangeExpr>(CellRange{
+                    {std::min(corners[0].row, corners[1].row), std::min(corners[0].col, corners[1].col)},
+                    {std::max(corners[0].row, corners[1].row), std::max(corners[0].col, corners[1].col)}}));
+            }
+
+            void exitFunction(FormulaParser::FunctionContext* ctx) override {
+                const size_t arg_count = ctx->arg().size();
+                assert(args_.size() >= arg_count);
+
+                Span<const Expr*> args = arena_.AllocateArray<const Expr*>(arg_count);
+                std::copy(args_.end() - arg_count, args_.end(), args.begin());
+                args_.resize(args_.size() - arg_count);
+
+                const auto function = FindFunction(ctx->FUNCTION()->getSymbol()->getText());
+                assert(function);
+                args_.push_back(arena_.Create<FunctionExpr>(*function, args));
             }
 
             void exitBinaryOp(FormulaParser::BinaryOpContext* ctx) override {
                 assert(args_.size() >= 2);
 
-                auto rhs = std::move(args_.back());
+                auto rhs = args_.back();
                 args_.pop_back();
 
-                auto lhs = std::move(args_.back());
+                auto lhs = args_.back();
 
                 BinaryOpExpr::Type type;
                 if (ctx->ADD()) {
@@ -379,8 +1327,7 @@ namespace ASTImpl {
                     type = BinaryOpExpr::Divide;
                 }
 
-                auto node = std::make_unique<BinaryOpExpr>(type, std::move(lhs), std::move(rhs));
-                args_.back() = std::move(node);
+                args_.back() = arena_.Create<BinaryOpExpr>(type, lhs, rhs);
             }
 
             void visitErrorNode(antlr4::tree::ErrorNode* node) override {
@@ -388,8 +1335,8 @@ namespace ASTImpl {
             }
 
         private:
-            std::vector<std::unique_ptr<Expr>> args_;
-            std::forward_list<Position> cells_;
+            Arena& arena_;
+            std::vector<const Expr*> args_;
         };
 
         class BailErrorListener : public antlr4::BaseErrorListener {
@@ -401,11 +1348,62 @@ namespace ASTImpl {
                 throw ParsingError("Error when lexing: " + msg);
             }
         };
+#endif
 
     }  // namespace
 }  // namespace ASTImpl
 
+FormulaAST ParseFormulaAST(std::string_view in_str) {
+    return ASTImpl::FormulaParserImpl(in_str).Parse();
+}
+
 FormulaAST ParseFormulaAST(std::istream& in) {
+    const std::string in_str{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+    return ParseFormulaAST(std::string_view(in_str));
+}
+
+FormulaAST DeserializeFormulaAST(std::string_view data) {
+    return ASTImpl::TreeReader(data).Read();
+}
+
+std::optional<std::string> GetRelativeFormulaKey(std::string_view text, Position origin) {
+    using ASTImpl::TokenType;
+
+    std::string key;
+    key.reserve(text.size() + 16);
+    try {
+        ASTImpl::Tokenizer tokenizer(text);
+        for (ASTImpl::Token token = tokenizer.Next(); token.type != TokenType::End; token = tokenizer.Next()) {
+            if (!key.empty()) {
+                key += ' ';
+            }
+            if (token.type != TokenType::Cell) {
+                key += token.text;
+                continue;
+            }
+            const Position pos = Position::FromString(token.text);
+            if (!pos.IsValid()) {
+                return std::nullopt;
+            }
+            // R<rows>C<cols>, the offset from the origin
+            const auto append_number = [&key](int number) {
+                char buffer[16];
+                key.append(buffer, std::to_chars(buffer, std::end(buffer), number).ptr);
+            };
+            key += 'R';
+            append_number(pos.row - origin.row);
+            key += 'C';
+            append_number(pos.col - origin.col);
+        }
+    }
+    catch (const ParsingError&) {
+        return std::nullopt;
+    }
+    return key;
+}
+
+#ifdef SPREADSHEET_WITH_ANTLR
+FormulaAST ParseFormulaASTWithAntlr(std::istream& in) {
     using namespace antlr4;
 
     ANTLRInputStream input(in);
@@ -426,13 +1424,10 @@ FormulaAST ParseFormulaAST(std::istream& in) {
     ASTImpl::ParseASTListener listener;
     tree::ParseTreeWalker::DEFAULT.walk(&listener, tree);
 
-    return FormulaAST(listener.MoveRoot(), listener.MoveCells());
-}
-
-FormulaAST ParseFormulaAST(const std::string& in_str) {
-    std::istringstream in(in_str);
-    return ParseFormulaAST(in);
+    const ASTImpl::Expr* root = listener.MoveRoot();
+    return FormulaAST(listener.GetArena(), root);
 }
+#endif
 
 void FormulaAST::PrintCells(std::ostream& out) const {
     for (auto cell : cells_) {
@@ -444,18 +1439,81 @@ void FormulaAST::Print(std::ostream& out) const {
     root_expr_->Print(out);
 }
 
-void FormulaAST::PrintFormula(std::ostream& out) const {
-    root_expr_->PrintFormula(out, ASTImpl::EP_ATOM);
+void FormulaAST::PrintFormula(std::ostream& out, Position offset) const {
+    root_expr_->PrintFormula(out, offset, ASTImpl::EP_ATOM);
 }
 
-double FormulaAST::Execute(const SheetInterface& sheet) const {
-    return root_expr_->Evaluate(sheet);
+void FormulaAST::Serialize(std::string& out) const {
+    root_expr_->Serialize(out);
+}
+
+// Operands are evaluated left to right, so the first error met in that
+// order is the one reported
+double FormulaAST::Execute(const SheetInterface& sheet, Position offset) const {
+    using ASTImpl::OpCode;
+
+    constexpr size_t LOCAL_STACK_SIZE = 32;
+    double local_stack[LOCAL_STACK_SIZE] = {};
+    std::vector<double> heap_stack;
+    double* stack = local_stack;
+    if (program_.stack_size > LOCAL_STACK_SIZE) {
+        heap_stack.resize(program_.stack_size);
+        stack = heap_stack.data();
+    }
+
+    // top points past the last value on the stack
+    double* top = stack;
+    for (const ASTImpl::Instruction& instruction : program_.code) {
+        switch (instruction.code) {
+        case OpCode::PushNumber:
+            *top++ = program_.constants[instruction.operand];
+            break;
+        case OpCode::LoadCell:
+            *top++ = ASTImpl::LoadCellValue(sheet, ASTImpl::Shift(program_.cells[instruction.operand], offset));
+            break;
+        case OpCode::Add:
+            --top;
+            top[-1] = ASTImpl::CheckFinite(top[-1], *top, top[-1] + *top);
+            break;
+        case OpCode::Subtract:
+            --top;
+            top[-1] = ASTImpl::CheckFinite(top[-1], *top, top[-1] - *top);
+            break;
+        case OpCode::Multiply:
+            --top;
+            top[-1] = ASTImpl::CheckFinite(top[-1], *top, top[-1] * *top);
+            break;
+        case OpCode::Divide:
+            --top;
+            top[-1] = ASTImpl::CheckFinite(top[-1], *top, top[-1] / *top);
+            break;
+        case OpCode::Negate:
+            top[-1] = -top[-1];
+            break;
+        case OpCode::Call: {
+            const ASTImpl::Call& call = program_.calls[instruction.operand];
+            top -= call.scalar_count;
+            *top = ASTImpl::CallFunction(call, top, program_.ranges, sheet, offset);
+            ++top;
+            break;
+        }
+        }
+    }
+    assert(top == stack + 1);
+    return *stack;
 }
 
-FormulaAST::FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr, std::forward_list<Position> cells)
-    : root_expr_(std::move(root_expr))
-    , cells_(std::move(cells)) {
-    cells_.sort();  // to avoid sorting in GetReferencedCells
+FormulaAST::FormulaAST(const Arena& scratch, const ASTImpl::Expr* root_expr) {
+    const ASTImpl::ProgramBuilder& builder = ASTImpl::Compile(*root_expr);
+    // the nodes take as much as in the scratch arena: all of them are
+    // multiples of 8 in size and need no padding
+    arena_ = Arena(Arena::GetBlockSize(scratch.GetUsedSize() + builder.GetArenaSize()));
+    root_expr_ = root_expr->Clone(arena_);
+    program_ = builder.Build(arena_);
+    Span<Position> cells = arena_.AllocateArray<Position>(program_.cells.size());
+    std::copy(program_.cells.begin(), program_.cells.end(), cells.begin());
+    std::sort(cells.begin(), cells.end());  // to avoid sorting in GetReferencedCells
+    cells_ = cells;
 }
 
 FormulaAST::~FormulaAST() = default;
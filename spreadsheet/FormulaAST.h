@@ -1,14 +1,65 @@
 #pragma once
 
-#include "FormulaLexer.h"
+#include "arena.h"
 #include "common.h"
 
-#include <forward_list>
+#include <cstdint>
 #include <functional>
+#include <optional>
 #include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
 
 namespace ASTImpl {
     class Expr;
+
+    // Instructions of the postfix program a formula is compiled into.
+    // Operands and intermediate results live on a stack of doubles.
+    enum class OpCode : std::uint8_t {
+        PushNumber,  // pushes constants[operand]
+        LoadCell,    // pushes the value of the cell at cells[operand]
+        Add,
+        Subtract,
+        Multiply,
+        Divide,
+        Negate,
+        Call,        // replaces its scalar arguments with the result of calls[operand]
+    };
+
+    struct Instruction {
+        OpCode code;
+        std::uint32_t operand;
+    };
+
+    // Functions over ranges and numbers
+    enum class Function : std::uint8_t {
+        Sum,
+        Average,
+        Min,
+        Max,
+        Count,
+    };
+
+    struct Call {
+        Function function;
+        // the values of scalar arguments are the topmost ones on the stack
+        std::uint32_t scalar_count;
+        // range arguments are ranges[first_range, first_range + range_count)
+        std::uint32_t first_range;
+        std::uint32_t range_count;
+    };
+
+    struct Program {
+        Span<const Instruction> code;
+        Span<const double> constants;
+        // one entry per reference in the formula, in the order of evaluation
+        Span<const Position> cells;
+        Span<const Call> calls;
+        Span<const CellRange> ranges;
+        // the largest number of values on the stack during evaluation
+        size_t stack_size = 0;
+    };
 }
 
 class ParsingError : public std::runtime_error {
@@ -17,33 +68,75 @@ class ParsingError : public std::runtime_error {
 
 class FormulaAST {
 public:
-    explicit FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr,
-        std::forward_list<Position> cells);
+    // root_expr and all its nodes must be allocated in the scratch arena and
+    // take all of it; they are copied into the formula's own arena of the
+    // exact size, and the scratch arena may be reused afterwards
+    FormulaAST(const Arena& scratch, const ASTImpl::Expr* root_expr);
     FormulaAST(FormulaAST&&) = default;
     FormulaAST& operator=(FormulaAST&&) = default;
     ~FormulaAST();
 
-    double Execute(const SheetInterface& sheet) const;
+    // offset shifts every cell reference of the formula, so that one AST can
+    // serve all the cells a formula was filled into. An error is returned as
+    // an error number (see ToErrorNumber), nothing is thrown
+    double Execute(const SheetInterface& sheet, Position offset = {0, 0}) const;
     void PrintCells(std::ostream& out) const;
     void Print(std::ostream& out) const;
-    void PrintFormula(std::ostream& out) const;
+    void PrintFormula(std::ostream& out, Position offset = {0, 0}) const;
+
+    // Appends the tree in a compact binary form: the nodes in postfix order,
+    // with everything printing needs that the program drops (unary plus,
+    // the order of function arguments). The data is in the byte order of
+    // the machine
+    void Serialize(std::string& out) const;
 
-    std::forward_list<Position>& GetCells() {
+    // sorted, a cell referenced several times is repeated;
+    // cells of ranges are not listed here
+    Span<const Position> GetCells() const {
         return cells_;
     }
 
-    const std::forward_list<Position>& GetCells() const {
-        return cells_;
+    // range arguments of functions, not sorted
+    Span<const CellRange> GetRanges() const {
+        return program_.ranges;
+    }
+
+    const Arena& GetArena() const {
+        return arena_;
     }
 
 private:
-    std::unique_ptr<ASTImpl::Expr> root_expr_;
+    // owns the tree, the program and the list of cells, so that a formula
+    // takes one allocation and is freed at once
+    Arena arena_;
+    const ASTImpl::Expr* root_expr_;
+
+    // the tree is kept for printing, evaluation runs the compiled program
+    ASTImpl::Program program_;
 
     // physically stores cells so that they can be
     // efficiently traversed without going through
     // the whole AST
-    std::forward_list<Position> cells_;
+    Span<const Position> cells_;
 };
 
+// Parses with the hand-written parser, which follows Formula.g4 and
+// builds the same AST as the ANTLR-generated one
+FormulaAST ParseFormulaAST(std::string_view in_str);
 FormulaAST ParseFormulaAST(std::istream& in);
-FormulaAST ParseFormulaAST(const std::string& in_str);
+
+// Rebuilds a formula from the data written by FormulaAST::Serialize without
+// parsing any text. Throws ParsingError if the data is malformed
+FormulaAST DeserializeFormulaAST(std::string_view data);
+
+// Key of the formula with cell references written as offsets from origin,
+// the cell the formula belongs to (like in R1C1 notation). Formulas with
+// equal keys have the same AST up to a shift of all references.
+// Returns nullopt if the text has characters that do not form tokens or
+// references invalid positions, i.e. when parsing it would fail anyway
+std::optional<std::string> GetRelativeFormulaKey(std::string_view text, Position origin);
+
+#ifdef SPREADSHEET_WITH_ANTLR
+// The ANTLR-generated parser, kept to cross-check the hand-written one
+FormulaAST ParseFormulaASTWithAntlr(std::istream& in);
+#endif
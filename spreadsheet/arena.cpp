@@ -0,0 +1,112 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <cstdint>
+
+Arena::Arena(size_t first_block_size)
+    : next_block_size_(std::max<size_t>(first_block_size, sizeof(Block))) {}
+
+Arena::Arena(Arena&& other) noexcept
+    : blocks_(std::exchange(other.blocks_, nullptr))
+    , current_(std::exchange(other.current_, nullptr))
+    , end_(std::exchange(other.end_, nullptr))
+    , next_block_size_(other.next_block_size_)
+    , block_count_(std::exchange(other.block_count_, 0))
+    , used_size_(std::exchange(other.used_size_, 0)) {}
+
+Arena& Arena::operator=(Arena&& other) noexcept
+{
+    if (this != &other)
+    {
+        Release();
+        blocks_ = std::exchange(other.blocks_, nullptr);
+        current_ = std::exchange(other.current_, nullptr);
+        end_ = std::exchange(other.end_, nullptr);
+        next_block_size_ = other.next_block_size_;
+        block_count_ = std::exchange(other.block_count_, 0);
+        used_size_ = std::exchange(other.used_size_, 0);
+    }
+    return *this;
+}
+
+Arena::~Arena()
+{
+    Release();
+}
+
+void* Arena::Allocate(size_t size, size_t alignment)
+{
+    const auto get_padding = [alignment](const char* ptr) {
+        const auto address = reinterpret_cast<std::uintptr_t>(ptr);
+        return (alignment - address % alignment) % alignment;
+    };
+    size_t padding = get_padding(current_);
+    if (!current_ || padding + size > static_cast<size_t>(end_ - current_))
+    {
+        AddBlock(size + alignment);
+        padding = get_padding(current_);
+    }
+    char* result = current_ + padding;
+    current_ = result + size;
+    used_size_ += padding + size;
+    return result;
+}
+
+size_t Arena::GetBlockCount() const
+{
+    return block_count_;
+}
+
+size_t Arena::GetUsedSize() const
+{
+    return used_size_;
+}
+
+void Arena::Reset()
+{
+    if (!blocks_)
+    {
+        return;
+    }
+    while (Block* next = blocks_->next)
+    {
+        blocks_->next = next->next;
+        ::operator delete(next);
+        --block_count_;
+    }
+    current_ = reinterpret_cast<char*>(blocks_) + sizeof(Block);
+    used_size_ = 0;
+}
+
+size_t Arena::GetBlockSize(size_t capacity)
+{
+    return capacity + sizeof(Block);
+}
+
+// Каждый следующий блок вдвое больше предыдущего, чтобы число блоков
+// росло логарифмически от объёма данных
+void Arena::AddBlock(size_t min_size)
+{
+    const size_t size = std::max(next_block_size_, min_size + sizeof(Block));
+    char* memory = static_cast<char*>(::operator new(size));
+    Block* block = new (memory) Block{ blocks_ };
+    blocks_ = block;
+    current_ = memory + sizeof(Block);
+    end_ = memory + size;
+    next_block_size_ = size * 2;
+    ++block_count_;
+}
+
+void Arena::Release()
+{
+    while (blocks_)
+    {
+        Block* next = blocks_->next;
+        ::operator delete(blocks_);
+        blocks_ = next;
+    }
+    current_ = nullptr;
+    end_ = nullptr;
+    block_count_ = 0;
+    used_size_ = 0;
+}
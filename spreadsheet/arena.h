@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Непрерывный участок памяти из элементов типа T, которым владеет кто-то другой
+// (например, арена)
+template <typename T>
+class Span
+{
+public:
+    Span() = default;
+    Span(T* data, size_t size)
+        : data_(data), size_(size) {}
+
+    // Span<T> приводится к Span<const T>
+    template <typename U, typename = std::enable_if_t<std::is_same_v<const U, T>>>
+    Span(const Span<U>& other)
+        : data_(other.data()), size_(other.size()) {}
+
+    T* begin() const
+    {
+        return data_;
+    }
+
+    T* end() const
+    {
+        return data_ + size_;
+    }
+
+    T* data() const
+    {
+        return data_;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    T& operator[](size_t index) const
+    {
+        return data_[index];
+    }
+
+private:
+    T* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Линейный распределитель памяти. Память выделяется блоками, объекты
+// размещаются в блоке подряд, а освобождаются все разом вместе с ареной.
+// Деструкторы объектов не вызываются, поэтому в арене можно создавать только
+// тривиально разрушаемые объекты, не владеющие другими ресурсами.
+// Если размер первого блока задан с запасом, всё содержимое арены укладывается
+// в одно выделение памяти.
+class Arena
+{
+public:
+    static const size_t DEFAULT_BLOCK_SIZE = 256;
+
+    explicit Arena(size_t first_block_size = DEFAULT_BLOCK_SIZE);
+    Arena(Arena&& other) noexcept;
+    Arena& operator=(Arena&& other) noexcept;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    ~Arena();
+
+    void* Allocate(size_t size, size_t alignment);
+
+    template <typename T, typename... Args>
+    T* Create(Args&&... args);
+
+    // Выделяет массив из count элементов, инициализированных по умолчанию
+    template <typename T>
+    Span<T> AllocateArray(size_t count);
+
+    // Число блоков, выделенных у системы
+    size_t GetBlockCount() const;
+    // Число байт, выданных из блоков, вместе с выравниванием
+    size_t GetUsedSize() const;
+
+    // Освобождает все блоки, кроме последнего - самого большого, и начинает
+    // размещать объекты с его начала. Созданные раньше объекты теряются
+    void Reset();
+
+    // Размер первого блока, в который поместятся capacity байт объектов,
+    // если они не требуют выравнивания
+    static size_t GetBlockSize(size_t capacity);
+
+private:
+    struct Block
+    {
+        Block* next;
+    };
+
+    Block* blocks_ = nullptr;
+    char* current_ = nullptr;
+    char* end_ = nullptr;
+    size_t next_block_size_;
+    size_t block_count_ = 0;
+    size_t used_size_ = 0;
+
+    void AddBlock(size_t min_size);
+    void Release();
+};
+
+template <typename T, typename... Args>
+T* Arena::Create(Args&&... args)
+{
+    static_assert(std::is_trivially_destructible_v<T>, "arena never calls destructors");
+    return new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+}
+
+template <typename T>
+Span<T> Arena::AllocateArray(size_t count)
+{
+    static_assert(std::is_trivially_destructible_v<T>, "arena never calls destructors");
+    if (count == 0)
+    {
+        return {};
+    }
+    T* data = static_cast<T*>(Allocate(sizeof(T) * count, alignof(T)));
+    std::uninitialized_default_construct_n(data, count);
+    return { data, count };
+}
@@ -1,111 +1,192 @@
 #include "cell.h"
 
+#include <cassert>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
 #include <unordered_set>
-#include <list>
 
 
 class Cell::Impl
 {
 public:
-    virtual Value GetValue() const = 0;
+    //     slot,     
+    virtual Value GetValue(ValueSlot slot) const = 0;
+    virtual std::string GetText() const = 0;
     virtual std::vector<Position> GetReferencedCells() const;
+    virtual std::vector<CellRange> GetReferencedRanges() const;
+    virtual const FormulaInterface* GetFormula() const;
     virtual ~Impl() = default;
-    void SetDependence(const Impl* cell);
 
-    virtual const std::unordered_set<const Impl*> GetDependenceCell() const;
-    virtual void InvalidateCache() const;
-    virtual void ClearCache() const {}
-
-private:
-    std::unordered_set<const Impl*> depending_cells_;
+    // ,          
+    virtual ValueTag GetInitialTag() const = 0;
+    //       
+    virtual void InitValue(ValueSlot slot) const;
 };
 
 //-----Implementation Impl------
-void Cell::Impl::SetDependence(const Impl* cell)
+std::vector<Position> Cell::Impl::GetReferencedCells() const
 {
-    depending_cells_.emplace(cell);
+    return std::vector<Position>();
 }
 
-const std::unordered_set<const Cell::Impl*> Cell::Impl::GetDependenceCell() const
+std::vector<CellRange> Cell::Impl::GetReferencedRanges() const
 {
-    return depending_cells_;
+    return {};
 }
-void Cell::Impl::InvalidateCache() const
+
+const FormulaInterface* Cell::Impl::GetFormula() const
 {
-    for (const Impl* cell : depending_cells_)
-    {
-        cell->ClearCache();
-    }
+    return nullptr;
 }
-std::vector<Position> Cell::Impl::GetReferencedCells() const
+
+void Cell::Impl::InitValue(ValueSlot slot) const
 {
-    return std::vector<Position>();
+    slot.SetTag(GetInitialTag());
 }
 
 class Cell::EmptyImpl : public Cell::Impl
 {
 public:
-    Value GetValue() const override
+    Value GetValue(ValueSlot) const override
     {
         using namespace std::string_literals;
         return Value(0.0);
     }
 
+    ValueTag GetInitialTag() const override
+    {
+        return ValueTag::Empty;
+    }
+
+    std::string GetText() const override
+    {
+        return {};
+    }
+
     std::vector<Position> GetReferencedCells() const override
     {
         return {};
     }
 };
 
+//    ,    . ,   std::stod,
+//           
+// ;    double  .
+//        
 class Cell::TextImpl : public Cell::Impl
 {
 public:
-    explicit TextImpl(std::string_view text)
-        : value_(text) {}
+    explicit TextImpl(std::string text)
+        : text_(std::move(text))
+    {
+        const bool escaped = text_.at(0) == ESCAPE_SIGN;
+        const char* begin = text_.c_str() + (escaped ? 1 : 0);
+        const char* const text_end = text_.c_str() + text_.size();
+        char* end = nullptr;
+        errno = 0;
+        const double number = begin == text_end ? 0.0 : std::strtod(begin, &end);
+        if (begin != text_end && end == text_end && errno != ERANGE)
+        {
+            kind_ = Kind::Number;
+            //  NaN    "nan(...)"  ,  
+            //     ,  
+            number_ = std::isnan(number) ? std::copysign(std::numeric_limits<double>::quiet_NaN(), number) : number;
+        }
+        else
+        {
+            kind_ = escaped ? Kind::EscapedText : Kind::Text;
+        }
+    }
 
-    Value GetValue() const override
+    // ,   (,   )
+    TextImpl(std::string text, std::optional<double> number)
+        : text_(std::move(text))
     {
-        try
+        if (number)
         {
-            return std::stod(std::string(value_.data(), value_.size()));
+            kind_ = Kind::Number;
+            number_ = *number;
         }
-        catch(std::exception&)
+        else
         {
-            return std::string(value_.data(), value_.size());;
+            kind_ = text_.at(0) == ESCAPE_SIGN ? Kind::EscapedText : Kind::Text;
+        }
+    }
+
+    Value GetValue(ValueSlot) const override
+    {
+        switch (kind_)
+        {
+        case Kind::Number:
+            return number_;
+        case Kind::EscapedText:
+            return text_.substr(1);
+        default:
+            return text_;
+        }
+    }
+
+    std::string GetText() const override
+    {
+        return text_;
+    }
+
+    ValueTag GetInitialTag() const override
+    {
+        return kind_ == Kind::Number ? ValueTag::Number : ValueTag::Text;
+    }
+
+    void InitValue(ValueSlot slot) const override
+    {
+        if (kind_ == Kind::Number)
+        {
+            slot.Set(number_);
+        }
+        else
+        {
+            slot.SetTag(ValueTag::Text);
         }
     }
 private:
-    std::string_view value_;
+    enum class Kind
+    {
+        Number,
+        Text,
+        EscapedText,
+    };
+
+    std::string text_;
+    Kind kind_;
+    double number_ = 0.0;
 };
 
 class Cell::FormulaImpl : public Cell::Impl
 {
 public:
     explicit FormulaImpl(SheetInterface& sheet, std::string_view text);
+    FormulaImpl(SheetInterface& sheet, std::unique_ptr<FormulaInterface> formula);
+
+    Value GetValue(ValueSlot slot) const override;
 
-    Value GetValue() const override;
+    std::string GetText() const override;
 
     std::vector<Position> GetReferencedCells() const override;
 
+    std::vector<CellRange> GetReferencedRanges() const override;
+
+    const FormulaInterface* GetFormula() const override;
+
     std::string GetExpression() const;
 
-    void ClearCache() const override;
+    ValueTag GetInitialTag() const override;
 
     ~FormulaImpl() = default;
 
 private:
     SheetInterface& sheet_;
     std::unique_ptr<FormulaInterface> formula_;
-    mutable std::optional<FormulaInterface::Value> cache_value_;
-    std::unordered_set<const FormulaImpl*> depending_cells_;
-
-    void InvalidateCache() const;
-
-    //,      
-    bool IsMoreCell(std::list<Position>& cell_list, CellInterface* cell);
-
-    //      
-    bool IsCycleRef(std::vector<Position> cells);
 };
 
 //-----Implementation FormulaImpl------
@@ -128,38 +209,68 @@ Cell::FormulaImpl::FormulaImpl(SheetInterface& sheet, std::string_view text)
         formula_.reset(f_temp);
         throw FormulaException(error.what());
     }
-    std::vector<Position> ref_cells = formula_->GetReferencedCells();
-    if (!ref_cells.empty() && IsCycleRef(ref_cells))
-    {
-        throw CircularDependencyException("Circular dependency detecting"s);
-    }
 }
 
+Cell::FormulaImpl::FormulaImpl(SheetInterface& sheet, std::unique_ptr<FormulaInterface> formula)
+    : sheet_(sheet), formula_(std::move(formula)) {}
+
 std::string Cell::FormulaImpl::GetExpression() const
 {
     return formula_->GetExpression();
 }
 
-void Cell::FormulaImpl::ClearCache() const
+std::string Cell::FormulaImpl::GetText() const
 {
-    cache_value_.reset();
-    InvalidateCache();
+    return FORMULA_SIGN + GetExpression();
 }
 
-CellInterface::Value Cell::FormulaImpl::GetValue() const
+ValueTag Cell::FormulaImpl::GetInitialTag() const
 {
-    if (!cache_value_)
+    return ValueTag::Dirty;
+}
+
+// ,     ,  ,  
+//     Computing,   .  
+//   ,     ,  -
+//            
+CellInterface::Value Cell::FormulaImpl::GetValue(ValueSlot slot) const
+{
+    FormulaInterface::Value value;
+    if (!slot.IsBound())
     {
-        cache_value_ = formula_->Evaluate(sheet_);
-        InvalidateCache();
+        value = formula_->Evaluate(sheet_);
     }
-    if (std::holds_alternative<double>(*cache_value_))
+    else
     {
-        return std::get<double>(*cache_value_);
+        //     ,   Dirty, 
+        //     ,      Dirty
+        ValueTag tag = slot.GetTag();
+        while (tag == ValueTag::Dirty || tag == ValueTag::Computing)
+        {
+            if (tag == ValueTag::Dirty && slot.TryStartComputing())
+            {
+                try
+                {
+                    slot.Set(formula_->Evaluate(sheet_));
+                }
+                catch (...)
+                {
+                    slot.SetTag(ValueTag::Dirty);
+                    throw;
+                }
+                break;
+            }
+            tag = slot.WaitComputed();
+        }
+        value = slot.Get();
+    }
+    if (std::holds_alternative<double>(value))
+    {
+        return std::get<double>(value);
     }
     else
     {
-        return std::get<FormulaError>(*cache_value_);
+        return std::get<FormulaError>(value);
     }
 }
 
@@ -167,165 +278,149 @@ std::vector<Position> Cell::FormulaImpl::GetReferencedCells() const
 {
     return formula_->GetReferencedCells();
 }
-void  Cell::FormulaImpl::InvalidateCache() const
+
+std::vector<CellRange> Cell::FormulaImpl::GetReferencedRanges() const
 {
-    for (const Impl* cell : depending_cells_)
-    {
-        cell->ClearCache();
-    }
+    return formula_->GetReferencedRanges();
+}
+
+const FormulaInterface* Cell::FormulaImpl::GetFormula() const
+{
+    return formula_.get();
+}
+
+Cell::Cell(SheetInterface& sheet, std::string text)
+	: Cell(sheet) 
+{
+    Set(std::move(text));
 }
 
-bool Cell::FormulaImpl::IsMoreCell(std::list<Position>& cell_list, CellInterface* cell)
+Cell::Cell(SheetInterface& sheet)
+    : impl_(std::make_shared<EmptyImpl>()), sheet_(sheet) {}
+
+Cell::Cell(const Cell& other)
+    : impl_(other.impl_), sheet_(other.sheet_) {}
+
+Cell::Cell(Cell&&) = default;
+
+Cell::~Cell() = default;
+
+void Cell::Set(std::string text)
 {
-    if (!cell)
+    if (text.empty())
     {
-        return false;
+        impl_ = std::make_shared<EmptyImpl>();
     }
-    std::vector<Position>&& vect = cell->GetReferencedCells();
-    if (vect.empty())
+    else if (text.size() > 1 && text.at(0) == FORMULA_SIGN)
+    {
+        impl_ = std::make_shared<FormulaImpl>(sheet_, std::string_view(text).substr(1));
+    }
+    else
     {
-        return false;
+        impl_ = std::make_shared<TextImpl>(std::move(text));
     }
-    cell_list.splice(cell_list.begin(), { vect.begin(), vect.end() });
-    return true;
+    //        
+    InvalidateCache();
+}
+
+void Cell::Set(std::string text, std::optional<double> number)
+{
+    assert(!text.empty() && !(text.size() > 1 && text.at(0) == FORMULA_SIGN));
+    impl_ = std::make_shared<TextImpl>(std::move(text), number);
+    InvalidateCache();
 }
 
-bool Cell::FormulaImpl::IsCycleRef(std::vector<Position> cells)
+void Cell::Set(std::string text, Position pos, FormulaPool& pool)
 {
-    using CellSet = std::unordered_set<Position, PositionHasher>;;
-    CellSet visited; //black colored
-    CellSet gray_list; //gray colored
-    std::list<Position> white_list; //white colored
-    white_list.splice(white_list.begin(), { cells.begin(), cells.end() });
-    if (white_list.empty())
+    if (text.size() > 1 && text.at(0) == FORMULA_SIGN)
     {
-        return false;
+        impl_ = std::make_shared<FormulaImpl>(sheet_, pool.Parse(text.substr(1), pos));
+        InvalidateCache();
     }
-    gray_list.emplace(white_list.front());
-    CellInterface* cell_ptr = sheet_.GetCell(white_list.front());
-    white_list.pop_front();
-    if (!IsMoreCell(white_list, cell_ptr))
+    else
     {
-        return false;
+        Set(std::move(text));
     }
-    Position cell = white_list.front();
-    while (!white_list.empty())
+}
+
+void Cell::Set(std::unique_ptr<FormulaInterface> formula)
+{
+    impl_ = std::make_shared<FormulaImpl>(sheet_, std::move(formula));
+    InvalidateCache();
+}
+
+void Cell::Clear()
+{
+    impl_ = std::make_shared<EmptyImpl>();
+    InvalidateCache();
+}
+
+void Cell::InvalidateCache()
+{
+    if (value_slot_.IsBound())
     {
-        if (visited.count(cell))
-        {
-            cell = white_list.front();
-            white_list.pop_front();
-            continue;
-        }
-        if (gray_list.count(cell))
-        {
-            return true;
-        }
-        cell_ptr = sheet_.GetCell(cell);
-        if (!IsMoreCell(white_list, cell_ptr))
-        {
-            visited.insert(cell);
-        }
-        else
-        {
-            gray_list.insert(cell);
-        }
-        cell = white_list.front();
-        white_list.pop_front();
+        impl_->InitValue(value_slot_);
     }
-    if (gray_list.count(cell))
+}
+
+bool Cell::HasCache() const
+{
+    if (!value_slot_.IsBound())
     {
-        return true;
+        return impl_->GetInitialTag() != ValueTag::Dirty;
     }
-    return false;
+    const ValueTag tag = value_slot_.GetTag();
+    return tag != ValueTag::Dirty && tag != ValueTag::Computing;
 }
 
-Cell::Cell(SheetInterface& sheet, std::string text)
-	: Cell(sheet) 
+void Cell::BindValue(ValueSlot slot)
 {
-    Set(text);
+    value_slot_ = slot;
+    impl_->InitValue(value_slot_);
 }
 
-Cell::Cell(SheetInterface& sheet)
-    : impl_(std::make_unique<EmptyImpl>(EmptyImpl())), sheet_(sheet) {}
-
-Cell::~Cell() = default;
+void Cell::RebindValue(ValueSlot slot)
+{
+    value_slot_ = slot;
+}
 
-#define CATCH_RESTORE_IMPL(exc) catch(exc){   restore();  throw;  }
-void Cell::Set(std::string text)
-{	
-    std::string temp_string = text_value_;
-	text_value_ = std::move(text);
-    std::unique_ptr<Impl> temp_ptr(impl_.release());
-    const auto restore = [&]()
-        {
-            impl_.reset(temp_ptr.release());
-            text_value_ = temp_string;
-        };
-	if (text_value_.empty())
-	{
-        try
-        {
-            impl_.reset(new EmptyImpl());
-        }
-        CATCH_RESTORE_IMPL(std::bad_alloc&)
-		return;
-	}
-	else if (text_value_.size() > 1 && text_value_.at(0) == FORMULA_SIGN)
-	{
-        try 
-		{
-			impl_.reset(new FormulaImpl(sheet_, std::string_view(text_value_.data() + 1, text_value_.size() - 1)));
-		}
-        CATCH_RESTORE_IMPL(const FormulaException&)
-        CATCH_RESTORE_IMPL(const CircularDependencyException&)
-        text_value_ = FORMULA_SIGN + dynamic_cast<FormulaImpl*>(impl_.get())-> GetExpression();
-	}
-	else
-    {
-        std::string_view text = text_value_;
-        if (text_value_.at(0) == ESCAPE_SIGN)
-        {
-            text.remove_prefix(1);
-        }
-        try
-        {
-            impl_.reset(new TextImpl(text));
-        }
-        CATCH_RESTORE_IMPL(std::bad_alloc&)
-	}
+Cell::Value Cell::GetValue() const 
+{
+	return impl_->GetValue(value_slot_);
 }
 
-void Cell::Clear()
+std::optional<double> Cell::GetCachedNumber() const
 {
-    std::unordered_set<const Impl*> temp = impl_->GetDependenceCell();
-    if (temp.empty())
+    if (value_slot_.IsBound() && value_slot_.GetTag() == ValueTag::Number)
     {
-        impl_.release();
+        return value_slot_.GetNumber();
     }
-    else
+    return std::nullopt;
+}
+
+std::optional<FormulaInterface::Value> Cell::GetCachedValue() const
+{
+    if (!impl_->GetFormula() || !HasCache())
     {
-        impl_->InvalidateCache();
-        try
-        {
-            impl_.reset(new EmptyImpl());
-        }
-        catch (std::bad_alloc&)
-        {
-            impl_.release();
-            throw;
-        }
+        return std::nullopt;
     }
+    return value_slot_.Get();
 }
 
-Cell::Value Cell::GetValue() const 
+void Cell::RestoreCachedValue(const FormulaInterface::Value& value)
 {
-	return impl_->GetValue();
+    assert(impl_->GetFormula() && value_slot_.IsBound());
+    value_slot_.Set(value);
+}
+
+const FormulaInterface* Cell::GetFormula() const
+{
+    return impl_->GetFormula();
 }
 
 std::string Cell::GetText() const 
 {
-	return text_value_;
+	return impl_->GetText();
 }
 
 std::vector<Position> Cell::GetReferencedCells() const
@@ -334,6 +429,11 @@ std::vector<Position> Cell::GetReferencedCells() const
     return impl_->GetReferencedCells();
 }
 
+std::vector<CellRange> Cell::GetReferencedRanges() const
+{
+    return impl_->GetReferencedRanges();
+}
+
 bool Cell::IsReferenced() const
 {
     return !impl_->GetReferencedCells().empty();
@@ -2,6 +2,7 @@
 
 #include "common.h"
 #include "formula.h"
+#include "values.h"
 
 #include <optional>
 
@@ -9,14 +10,47 @@ class Cell : public CellInterface {
 public:
     explicit Cell(SheetInterface& sheet);
     Cell(SheetInterface& sheet, std::string text);
+    // Копия разделяет с оригиналом неизменяемое содержимое и не привязана к
+    // кэшу значений (см. RebindValue)
+    Cell(const Cell& other);
+    Cell(Cell&&);
     ~Cell();
 
     void Set(std::string text);
+    // Формула разбирается через пул: ячейки с одинаковой относительно своей
+    // позиции pos формулой разделяют одно разобранное дерево
+    void Set(std::string text, Position pos, FormulaPool& pool);
+    // Делает ячейку формулой из уже разобранной формулы
+    void Set(std::unique_ptr<FormulaInterface> formula);
+    // Делает ячейку текстом, разобранным раньше: number - значение текста,
+    // если он является числом. Текст не пуст и не является формулой
+    void Set(std::string text, std::optional<double> number);
     void Clear();
 
+    // Сбрасывает закэшированное значение формулы. Вызывается таблицей, когда
+    // меняется одна из ячеек, от которых формула зависит
+    void InvalidateCache();
+    bool HasCache() const;
+
+    // Привязывает ячейку к её месту в столбцовом кэше значений хранилища
+    void BindValue(ValueSlot slot);
+    // Привязывает ячейку к новому месту в кэше, куда уже скопировано её значение
+    void RebindValue(ValueSlot slot);
+
     Value GetValue() const override;
+    // Число из кэша значений, если значение ячейки уже вычислено и является числом
+    std::optional<double> GetCachedNumber() const;
+    // Вычисленное значение формулы из кэша, если оно есть
+    std::optional<FormulaInterface::Value> GetCachedValue() const;
+    // Записывает в кэш значение формулы, вычисленное раньше. Ячейка должна
+    // быть формулой и находиться в хранилище
+    void RestoreCachedValue(const FormulaInterface::Value& value);
+    // Формула ячейки или nullptr, если ячейка - не формула
+    const FormulaInterface* GetFormula() const;
     std::string GetText() const override;
     std::vector<Position> GetReferencedCells() const override;
+    // Диапазоны, на которые ссылается формула; их ячейки в GetReferencedCells() не входят
+    std::vector<CellRange> GetReferencedRanges() const;
     bool IsReferenced() const;
 
 private:
@@ -25,7 +59,8 @@ private:
     class EmptyImpl;
     class FormulaImpl;
     
-    std::unique_ptr<Impl> impl_;
-    std::string text_value_;
+    // содержимое не меняется после создания, поэтому его разделяют копии ячейки
+    std::shared_ptr<const Impl> impl_;
     SheetInterface& sheet_;
+    ValueSlot value_slot_;
 };
@@ -0,0 +1,191 @@
+#include "checkpoint.h"
+
+#include "durable_file.h"
+#include "snapshot.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <sstream>
+
+using namespace std::literals;
+
+Checkpointer::Checkpointer(Sheet& sheet, EditJournal& journal, const std::string& snapshot_path,
+    const CheckpointOptions& options)
+    : sheet_(sheet), journal_(journal), snapshot_path_(snapshot_path), options_(options)
+    , last_checkpoint_(std::chrono::steady_clock::now()), last_journal_bytes_(journal.GetStats().bytes)
+    , writer_(&Checkpointer::WriterLoop, this)
+{
+}
+
+Checkpointer::~Checkpointer()
+{
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    task_ready_.notify_one();
+    writer_.join();
+}
+
+bool Checkpointer::Poll()
+{
+    {
+        std::lock_guard lock(mutex_);
+        if (error_)
+        {
+            std::rethrow_exception(error_);
+        }
+        if (task_)
+        {
+            return false;
+        }
+    }
+    if (std::chrono::steady_clock::now() - last_checkpoint_ < options_.interval
+        && journal_.GetStats().bytes - last_journal_bytes_ < options_.journal_bytes)
+    {
+        return false;
+    }
+    Checkpoint();
+    return true;
+}
+
+void Checkpointer::Checkpoint()
+{
+    {
+        std::unique_lock lock(mutex_);
+        WaitTask(lock);
+    }
+    const auto capture_start = std::chrono::steady_clock::now();
+    Task task;
+    // изменения таблицы идут в этом же потоке, поэтому снимок и номер
+    // записи журнала соответствуют одному моменту
+    task.stats.journal_sequence = journal_.GetLastSequence();
+    last_journal_bytes_ = journal_.GetStats().bytes;
+    task.version = sheet_.CaptureVersion();
+    last_checkpoint_ = std::chrono::steady_clock::now();
+    task.stats.capture_duration =
+        std::chrono::duration_cast<std::chrono::microseconds>(last_checkpoint_ - capture_start);
+    {
+        std::lock_guard lock(mutex_);
+        task_ = std::move(task);
+    }
+    task_ready_.notify_one();
+}
+
+void Checkpointer::Wait()
+{
+    std::unique_lock lock(mutex_);
+    WaitTask(lock);
+}
+
+std::optional<CheckpointStats> Checkpointer::GetLastStats() const
+{
+    std::lock_guard lock(mutex_);
+    return last_stats_;
+}
+
+void Checkpointer::WaitTask(std::unique_lock<std::mutex>& lock)
+{
+    task_done_.wait(lock, [this] {
+        return !task_ || error_;
+    });
+    if (error_)
+    {
+        std::rethrow_exception(error_);
+    }
+}
+
+void Checkpointer::WriterLoop()
+{
+    std::unique_lock lock(mutex_);
+    while (true)
+    {
+        task_ready_.wait(lock, [this] {
+            return stop_ || task_;
+        });
+        if (!task_)
+        {
+            return;
+        }
+        Task& task = *task_;
+        lock.unlock();
+        std::exception_ptr error;
+        try
+        {
+            Write(task);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        lock.lock();
+        if (error)
+        {
+            error_ = error;
+        }
+        else
+        {
+            last_stats_ = task.stats;
+        }
+        task_.reset();
+        task_done_.notify_all();
+    }
+}
+
+void Checkpointer::Write(Task& task)
+{
+    const auto start = std::chrono::steady_clock::now();
+    std::ostringstream output;
+    SaveSnapshot(*task.version, output, task.stats.journal_sequence);
+    // версия больше не нужна, и таблица перестаёт копировать общие с ней плитки
+    task.version.reset();
+    const std::string data = std::move(output).str();
+    AtomicFileWriter writer(snapshot_path_);
+    if (!writer.IsOpen())
+    {
+        throw SnapshotError("Cannot open snapshot file "s + snapshot_path_);
+    }
+    const std::string_view snapshot = data;
+    const size_t block = std::max<size_t>(1, options_.write_block);
+    for (size_t offset = 0; offset < snapshot.size(); offset += block)
+    {
+        if (!writer.Write(snapshot.substr(offset, block)))
+        {
+            throw SnapshotError("Cannot write snapshot file "s + snapshot_path_);
+        }
+        task.stats.bytes_written = std::min(offset + block, snapshot.size());
+        // Запись не опережает расписание, заданное скоростью: поток спит,
+        // пока не наступит время, к которому можно записать уже записанное
+        if (options_.write_rate > 0)
+        {
+            const auto due = std::chrono::duration<double>(
+                static_cast<double>(task.stats.bytes_written) / options_.write_rate);
+            std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::microseconds>(due));
+        }
+    }
+    if (!writer.Commit())
+    {
+        throw SnapshotError("Cannot write snapshot file "s + snapshot_path_);
+    }
+    // записи журнала удаляются только после того, как снимок с ними на диске
+    journal_.Truncate(task.stats.journal_sequence);
+    task.stats.write_duration =
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    if (options_.on_checkpoint)
+    {
+        options_.on_checkpoint(task.stats);
+    }
+}
+
+std::unique_ptr<Sheet> RecoverSheet(const std::string& snapshot_path, const std::string& journal_path)
+{
+    uint64_t journal_sequence = 0;
+    std::unique_ptr<Sheet> sheet = std::filesystem::exists(snapshot_path)
+        ? LoadSnapshotFile(snapshot_path, &journal_sequence)
+        : std::make_unique<Sheet>();
+    if (std::filesystem::exists(journal_path))
+    {
+        ReplayJournalFile(journal_path, *sheet, journal_sequence);
+    }
+    return sheet;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "journal.h"
+#include "sheet.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+struct CheckpointStats
+{
+    // Номер последней записи журнала, вошедшей в снимок
+    uint64_t journal_sequence = 0;
+    // Время, на которое контрольная точка задерживает поток таблицы:
+    // вычисление формул без значений и копирование O(числа полос хранилища)
+    // (Sheet::CaptureVersion). От числа ячеек не зависит
+    std::chrono::microseconds capture_duration{ 0 };
+    // Время сборки, записи и синхронизации снимка и сжатия журнала в фоновом потоке
+    std::chrono::microseconds write_duration{ 0 };
+    uint64_t bytes_written = 0;
+};
+
+struct CheckpointOptions
+{
+    // Poll() начинает контрольную точку, когда с прошлой прошло interval или
+    // журнал вырос на journal_bytes
+    std::chrono::milliseconds interval{ 60000 };
+    uint64_t journal_bytes = 64 << 20;
+    // Скорость записи снимка, байт в секунду; 0 - без ограничения. Снимок
+    // пишется блоками по write_block байт
+    uint64_t write_rate = 0;
+    size_t write_block = 1 << 20;
+    // Вызывается фоновым потоком после каждой контрольной точки
+    std::function<void(const CheckpointStats&)> on_checkpoint;
+};
+
+// Контрольные точки таблицы, которая ведёт журнал journal: снимок таблицы
+// записывается в файл snapshot_path, после чего из журнала удаляются записи,
+// вошедшие в снимок.
+// Состояние на момент контрольной точки фиксируется в потоке таблицы как
+// неопубликованная версия (Sheet::CaptureVersion), и номер последней записи
+// журнала берётся в тот же момент. Сборка снимка из версии, его запись на
+// диск с ограничением скорости, синхронизация и сжатие журнала идут в
+// фоновом потоке, пока таблица продолжает меняться.
+// Poll(), Checkpoint() и Wait() вызываются из потока таблицы
+class Checkpointer
+{
+public:
+    Checkpointer(Sheet& sheet, EditJournal& journal, const std::string& snapshot_path,
+        const CheckpointOptions& options = {});
+    Checkpointer(const Checkpointer&) = delete;
+    Checkpointer& operator=(const Checkpointer&) = delete;
+    // Дожидается записи начатой контрольной точки
+    ~Checkpointer();
+
+    // Начинает контрольную точку, если пора и предыдущая уже записана.
+    // Возвращает true, если контрольная точка начата
+    bool Poll();
+
+    // Начинает контрольную точку, дождавшись записи предыдущей
+    void Checkpoint();
+
+    // Дожидается записи начатой контрольной точки. Ошибки записи снимка и
+    // журнала бросаются отсюда, из Checkpoint() и Poll()
+    void Wait();
+
+    std::optional<CheckpointStats> GetLastStats() const;
+
+private:
+    struct Task
+    {
+        std::shared_ptr<const SheetVersion> version;
+        CheckpointStats stats;
+    };
+
+    Sheet& sheet_;
+    EditJournal& journal_;
+    const std::string snapshot_path_;
+    const CheckpointOptions options_;
+    std::chrono::steady_clock::time_point last_checkpoint_;
+    uint64_t last_journal_bytes_ = 0;
+
+    mutable std::mutex mutex_;
+    std::condition_variable task_ready_;
+    std::condition_variable task_done_;
+    std::optional<Task> task_;
+    bool stop_ = false;
+    std::exception_ptr error_;
+    std::optional<CheckpointStats> last_stats_;
+    std::thread writer_;
+
+    void WriterLoop();
+    void Write(Task& task);
+    // Вызывается под mutex_
+    void WaitTask(std::unique_lock<std::mutex>& lock);
+};
+
+// Восстанавливает таблицу по снимку и журналу, записанным контрольными
+// точками: загружает снимок и применяет записи журнала, не вошедшие в него.
+// Любого из файлов может не быть
+std::unique_ptr<Sheet> RecoverSheet(const std::string& snapshot_path, const std::string& journal_path);
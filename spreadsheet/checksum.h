@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// FNV-1a, 64 бита. Считается по частям: сумма частей подряд равна сумме
+// их объединения
+class Checksum
+{
+public:
+    void Add(std::string_view data)
+    {
+        for (const char c : data)
+        {
+            hash_ ^= static_cast<unsigned char>(c);
+            hash_ *= 1099511628211ull;
+        }
+    }
+
+    std::uint64_t Get() const
+    {
+        return hash_;
+    }
+
+private:
+    std::uint64_t hash_ = 14695981039346656037ull;
+};
@@ -1,7 +1,12 @@
 #pragma once
 
+#include <charconv>
+#include <cstdint>
+#include <cstring>
 #include <iosfwd>
+#include <limits>
 #include <memory>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <string_view>
@@ -17,22 +22,128 @@ struct Position {
     bool operator==(Position rhs) const;
     bool operator<(Position rhs) const;
 
-    bool IsValid() const;
+    constexpr bool IsValid() const;
     std::string ToString() const;
 
-    static Position FromString(std::string_view str);
+    // Записывает позицию в буфер [first, last) без завершающего нуля, как
+    // std::to_chars. Для некорректной позиции возвращает invalid_argument,
+    // при нехватке места - value_too_large; буфер в этих случаях не меняется
+    constexpr std::to_chars_result ToChars(char* first, char* last) const;
+
+    // Для строки, не являющейся корректной позицией, возвращает NONE
+    static constexpr Position FromString(std::string_view str);
 
     static const int MAX_ROWS = 16384;
     static const int MAX_COLS = 16384;
+    // Длина самой длинной корректной позиции, "XFD16384"
+    static const int MAX_STRING_LENGTH = 8;
     static const Position NONE;
+
+private:
+    static const int LETTERS = 26;
+    // Строки длиннее не разбираются даже с ведущими нулями в номере строки
+    static const int MAX_POSITION_LENGTH = 17;
 };
 
+constexpr bool Position::IsValid() const
+{
+    return !(row < 0 || col < 0 || row >= MAX_ROWS || col >= MAX_COLS);
+}
+
+constexpr std::to_chars_result Position::ToChars(char* first, char* last) const
+{
+    if (!IsValid())
+    {
+        return { first, std::errc::invalid_argument };
+    }
+    // Столбец записывается в биективной системе по основанию 26 (A..Z, AA..),
+    // строка - в десятичной, начиная с единицы. Цифры собираются с младших
+    char letters[MAX_STRING_LENGTH] = {};
+    int letter_count = 0;
+    for (int number = col + 1; number > 0; number = (number - 1) / LETTERS)
+    {
+        letters[letter_count++] = static_cast<char>('A' + (number - 1) % LETTERS);
+    }
+    char digits[MAX_STRING_LENGTH] = {};
+    int digit_count = 0;
+    for (int number = row + 1; number > 0; number /= 10)
+    {
+        digits[digit_count++] = static_cast<char>('0' + number % 10);
+    }
+    if (last - first < letter_count + digit_count)
+    {
+        return { last, std::errc::value_too_large };
+    }
+    while (letter_count > 0)
+    {
+        *first++ = letters[--letter_count];
+    }
+    while (digit_count > 0)
+    {
+        *first++ = digits[--digit_count];
+    }
+    return { first, std::errc() };
+}
+
+constexpr Position Position::FromString(std::string_view str)
+{
+    constexpr Position none = { -1, -1 };
+    if (str.size() > static_cast<size_t>(MAX_POSITION_LENGTH))
+    {
+        return none;
+    }
+    size_t index = 0;
+    int col_number = 0;
+    for (; index < str.size() && str[index] >= 'A' && str[index] <= 'Z'; ++index)
+    {
+        col_number = col_number * LETTERS + (str[index] - 'A' + 1);
+        if (col_number > MAX_COLS)
+        {
+            return none;
+        }
+    }
+    if (index == 0 || index == str.size())
+    {
+        return none;
+    }
+    int row_number = 0;
+    for (; index < str.size(); ++index)
+    {
+        if (str[index] < '0' || str[index] > '9')
+        {
+            return none;
+        }
+        row_number = row_number * 10 + (str[index] - '0');
+        if (row_number > MAX_ROWS)
+        {
+            return none;
+        }
+    }
+    if (row_number == 0)
+    {
+        return none;
+    }
+    return { row_number - 1, col_number - 1 };
+}
+
 struct Size {
     int rows = 0;
     int cols = 0;
 
     bool operator==(Size rhs) const;
 };
+
+// Прямоугольный диапазон ячеек, например A1:B10: first - левый верхний угол,
+// last - правый нижний
+struct CellRange {
+    Position first;
+    Position last;
+
+    bool operator==(const CellRange& rhs) const;
+    bool IsValid() const;
+    bool Contains(Position pos) const;
+};
+
 using namespace std::string_literals;
 // Описывает ошибки, которые могут возникнуть при вычислении формулы.
 class FormulaError {
@@ -60,6 +171,52 @@ private:
 
 std::ostream& operator<<(std::ostream& output, FormulaError fe);
 
+// Ошибки передаются при вычислении формулы как числа, без исключений:
+// ошибка - это NaN с меткой и категорией в младших битах мантиссы. Знак не
+// учитывается, так что смена знака ошибку не портит. Бесконечности и NaN без
+// метки ошибками не считаются
+namespace error_number {
+    inline constexpr std::uint64_t MARK = 0x7ff8'0000'fe00'0000;
+    inline constexpr std::uint64_t CATEGORY_MASK = 0xff;
+    inline constexpr std::uint64_t SIGN_MASK = 0x8000'0000'0000'0000;
+}
+
+inline double ToErrorNumber(FormulaError::Category category) {
+    const std::uint64_t bits = error_number::MARK | static_cast<std::uint64_t>(category);
+    double result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+inline bool IsErrorNumber(double value) {
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return (bits & ~error_number::SIGN_MASK & ~error_number::CATEGORY_MASK) == error_number::MARK
+        && (bits & error_number::CATEGORY_MASK) <= static_cast<std::uint64_t>(FormulaError::Category::Arithmetic);
+}
+
+// value должно быть ошибкой
+inline FormulaError ToFormulaError(double value) {
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return FormulaError(static_cast<FormulaError::Category>(bits & error_number::CATEGORY_MASK));
+}
+
+// Итог по числам диапазонов и аргументов функции, из которого вычисляются
+// SUM, AVERAGE, MIN, MAX и COUNT
+struct RangeSummary {
+    double sum = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    size_t count = 0;
+    // первая ошибка, встреченная в ячейках; после неё итог не подводится
+    std::optional<FormulaError> error;
+
+    void Add(double value);
+    void Merge(const RangeSummary& other);
+};
+
+
 // Исключение, выбрасываемое при попытке передать в метод некорректную позицию
 class InvalidPositionException : public std::out_of_range {
 public:
@@ -131,6 +288,18 @@ public:
     virtual const CellInterface* GetCell(Position pos) const = 0;
     virtual CellInterface* GetCell(Position pos) = 0;
 
+    // Возвращает значение ячейки как операнд формулы: пустая ячейка даёт 0,
+    // ошибка в ячейке или текст, не являющийся числом, возвращаются как
+    // ошибка в виде числа (см. ToErrorNumber). Таблица может переопределить
+    // метод, чтобы читать готовые значения из своего кэша, минуя GetCell()
+    virtual double GetCellNumber(Position pos) const;
+
+    // Подводит итог по числам диапазона для функций над диапазонами. Пустые
+    // ячейки и текст, не являющийся числом, пропускаются; на первой ошибке в
+    // ячейке обход прекращается и ошибка записывается в итог. Таблица может
+    // переопределить метод, чтобы обходить значения диапазона блоками
+    virtual RangeSummary SummarizeRange(CellRange range) const;
+
     // Очищает ячейку.
     // Последующий вызов GetCell() для этой ячейки вернёт либо nullptr, либо
     // объект с пустым текстом.
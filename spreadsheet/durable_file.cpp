@@ -0,0 +1,92 @@
+#include "durable_file.h"
+
+#include <filesystem>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    // В Windows переименование записывается в журнал файловой системы, и
+    // отдельная синхронизация каталога не нужна
+    bool SyncDirectory(const std::filesystem::path& path)
+    {
+#ifdef _WIN32
+        return true;
+#else
+        std::filesystem::path directory = path.parent_path();
+        if (directory.empty())
+        {
+            directory = ".";
+        }
+        const int fd = open(directory.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        const bool synced = fsync(fd) == 0;
+        close(fd);
+        return synced;
+#endif
+    }
+}
+
+bool SyncFile(std::FILE* file)
+{
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+AtomicFileWriter::AtomicFileWriter(const std::string& path)
+    : path_(path), temp_path_(path + ".tmp")
+{
+    file_ = std::fopen(temp_path_.c_str(), "wb");
+}
+
+AtomicFileWriter::~AtomicFileWriter()
+{
+    if (file_)
+    {
+        std::fclose(file_);
+        std::error_code error;
+        std::filesystem::remove(temp_path_, error);
+    }
+}
+
+bool AtomicFileWriter::IsOpen() const
+{
+    return file_ != nullptr;
+}
+
+bool AtomicFileWriter::Write(std::string_view data)
+{
+    return file_ && std::fwrite(data.data(), 1, data.size(), file_) == data.size();
+}
+
+bool AtomicFileWriter::Commit()
+{
+    if (!file_ || std::fflush(file_) != 0 || !SyncFile(file_))
+    {
+        return false;
+    }
+    const bool closed = std::fclose(file_) == 0;
+    file_ = nullptr;
+    std::error_code error;
+    if (closed)
+    {
+        std::filesystem::rename(temp_path_, path_, error);
+    }
+    if (!closed || error)
+    {
+        std::filesystem::remove(temp_path_, error);
+        return false;
+    }
+    return SyncDirectory(path_);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+// Переносит на диск данные файла, уже переданные ему через fflush
+bool SyncFile(std::FILE* file);
+
+// Заменяет файл целиком: данные пишутся во временный файл рядом, который
+// после синхронизации переименовывается в path. После сбоя на месте path
+// остаётся либо старый файл, либо новый, но не их смесь. Если Commit() не
+// был вызван, временный файл удаляется
+class AtomicFileWriter
+{
+public:
+    explicit AtomicFileWriter(const std::string& path);
+    AtomicFileWriter(const AtomicFileWriter&) = delete;
+    AtomicFileWriter& operator=(const AtomicFileWriter&) = delete;
+    ~AtomicFileWriter();
+
+    bool IsOpen() const;
+    bool Write(std::string_view data);
+    // Синхронизирует файл, заменяет им path и синхронизирует каталог, чтобы
+    // само переименование пережило сбой
+    bool Commit();
+
+private:
+    std::string path_;
+    std::string temp_path_;
+    std::FILE* file_ = nullptr;
+};
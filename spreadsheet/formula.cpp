@@ -5,16 +5,18 @@
 #include <algorithm>
 #include <cassert>
 #include <cctype>
+#include <iterator>
 #include <sstream>
 
 using namespace std::literals;
 
 namespace {
-    class Formula : public FormulaInterface {
-    public:
-        //   :
-        explicit Formula(std::string expression) try
-            : ast_(ParseFormulaAST(expression)){}
+    std::shared_ptr<const FormulaAST> ParseSharedAST(std::string_view expression)
+    {
+        try
+        {
+            return std::make_shared<const FormulaAST>(ParseFormulaAST(expression));
+        }
         catch (const FormulaException&)
         {
             throw;
@@ -23,38 +25,148 @@ namespace {
         {
             throw FormulaException(error.what());
         }
+    }
+
+    class Formula : public FormulaInterface {
+    public:
+        // offset -       ast,
+        //       
+        Formula(std::shared_ptr<const FormulaAST> ast, Position offset)
+            : ast_(std::move(ast)), offset_(offset) {}
+
         Value Evaluate(const SheetInterface& sheet) const override;
         std::string GetExpression() const override;
         std::vector<Position> GetReferencedCells() const override;
+        std::vector<CellRange> GetReferencedRanges() const override;
+
+        const std::shared_ptr<const FormulaAST>& GetAST() const override
+        {
+            return ast_;
+        }
+
+        Position GetOffset() const override
+        {
+            return offset_;
+        }
 
     private:
-        FormulaAST ast_;
+        std::shared_ptr<const FormulaAST> ast_;
+        Position offset_;
     };
     FormulaInterface::Value Formula::Evaluate(const SheetInterface& sheet) const
     {
-        try
+        const double result = ast_->Execute(sheet, offset_);
+        if (IsErrorNumber(result))
         {
-            return (ast_.Execute(sheet));
-        }
-        catch (const FormulaError& error)
-        {
-            return { error };
+            return ToFormulaError(result);
         }
+        return result;
     }
     std::string Formula::GetExpression() const
     {
         std::ostringstream str_out;
-        ast_.PrintFormula(str_out);
+        ast_->PrintFormula(str_out, offset_);
         return str_out.str();
     }
     std::vector<Position> Formula::GetReferencedCells() const
     {
-        std::forward_list<Position> result = ast_.GetCells();
-        result.unique();
-        return { result.begin(), result.end() };
+        //          
+        const Span<const Position> cells = ast_->GetCells();
+        std::vector<Position> result;
+        result.reserve(cells.size());
+        for (const Position pos : cells)
+        {
+            const Position shifted = { pos.row + offset_.row, pos.col + offset_.col };
+            if (result.empty() || !(result.back() == shifted))
+            {
+                result.push_back(shifted);
+            }
+        }
+        return result;
+    }
+    std::vector<CellRange> Formula::GetReferencedRanges() const
+    {
+        std::vector<CellRange> result;
+        for (const CellRange& range : ast_->GetRanges())
+        {
+            const CellRange shifted = {
+                { range.first.row + offset_.row, range.first.col + offset_.col },
+                { range.last.row + offset_.row, range.last.col + offset_.col } };
+            if (std::find(result.begin(), result.end(), shifted) == result.end())
+            {
+                result.push_back(shifted);
+            }
+        }
+        return result;
     }
 }  // namespace
 
 std::unique_ptr<FormulaInterface> ParseFormula(std::string expression) {
-    return std::make_unique<Formula>(std::move(expression));
+    return std::make_unique<Formula>(ParseSharedAST(expression), Position{ 0, 0 });
+}
+
+std::unique_ptr<FormulaInterface> MakeFormula(std::shared_ptr<const FormulaAST> ast, Position offset) {
+    return std::make_unique<Formula>(std::move(ast), offset);
+}
+
+namespace {
+    const size_t MIN_SWEEP_SIZE = 1024;
+}
+
+FormulaPool::FormulaPool()
+    : sweep_size_(MIN_SWEEP_SIZE) {}
+
+FormulaPool::~FormulaPool() = default;
+
+std::unique_ptr<FormulaInterface> FormulaPool::Parse(std::string expression, Position pos)
+{
+    std::optional<std::string> key = GetRelativeFormulaKey(expression, pos);
+    if (!key)
+    {
+        //    ,    
+        return ParseFormula(std::move(expression));
+    }
+    {
+        std::lock_guard lock(mutex_);
+        const auto it = entries_.find(*key);
+        if (it != entries_.end())
+        {
+            if (std::shared_ptr<const FormulaAST> ast = it->second.ast.lock())
+            {
+                const Position origin = it->second.origin;
+                return std::make_unique<Formula>(std::move(ast),
+                    Position{ pos.row - origin.row, pos.col - origin.col });
+            }
+        }
+    }
+    //    ,      
+    std::shared_ptr<const FormulaAST> ast = ParseSharedAST(expression);
+    {
+        std::lock_guard lock(mutex_);
+        entries_[std::move(*key)] = Entry{ ast, pos };
+        SweepIfNeeded();
+    }
+    return std::make_unique<Formula>(std::move(ast), Position{ 0, 0 });
+}
+
+size_t FormulaPool::GetSharedCount() const
+{
+    std::lock_guard lock(mutex_);
+    return std::count_if(entries_.begin(), entries_.end(),
+        [](const auto& entry) { return !entry.second.ast.expired(); });
+}
+
+//   .     ,   
+//      O(1) 
+void FormulaPool::SweepIfNeeded()
+{
+    if (entries_.size() < sweep_size_)
+    {
+        return;
+    }
+    for (auto it = entries_.begin(); it != entries_.end();)
+    {
+        it = it->second.ast.expired() ? entries_.erase(it) : std::next(it);
+    }
+    sweep_size_ = std::max(MIN_SWEEP_SIZE, entries_.size() * 2);
 }
\ No newline at end of file
@@ -3,12 +3,19 @@
 #include "common.h"
 
 #include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
+class FormulaAST;
+
 // ,      .
 //  :
 // *     , : 1+2*3, 2.5*(2+3.5/7)
 // *     : A1+B2*C3
+// *  SUM, AVERAGE, MIN, MAX  COUNT     :
+//   SUM(A1:A100), MAX(A1:B10,C1,0)
 // ,   ,    ,   .  
 // ,    ,      . 
 //          .
@@ -32,10 +39,55 @@ public:
 
     //   ,     
     // .        
-    // .
+    // .      .
     virtual std::vector<Position> GetReferencedCells() const = 0;
+
+    //  ,    ,  .
+    virtual std::vector<CellRange> GetReferencedRanges() const = 0;
+
+    //  ,       , 
+    //      
+    virtual const std::shared_ptr<const FormulaAST>& GetAST() const = 0;
+    virtual Position GetOffset() const = 0;
 };
 
 //       .
 //  FormulaException  ,    .
-std::unique_ptr<FormulaInterface> ParseFormula(std::string expression);
\ No newline at end of file
+std::unique_ptr<FormulaInterface> ParseFormula(std::string expression);
+
+//     ,     offset
+std::unique_ptr<FormulaInterface> MakeFormula(std::shared_ptr<const FormulaAST> ast, Position offset);
+
+//    . ,    
+//      (    ), 
+//  :         , 
+//    .       
+//    .
+//     :  ,   
+//   .      .
+class FormulaPool {
+public:
+    FormulaPool();
+    ~FormulaPool();
+
+    //     pos,    ParseFormula()
+    std::unique_ptr<FormulaInterface> Parse(std::string expression, Position pos);
+
+    //   ,    
+    size_t GetSharedCount() const;
+
+private:
+    struct Entry
+    {
+        std::weak_ptr<const FormulaAST> ast;
+        Position origin;
+    };
+
+    //  -   ,    
+    std::unordered_map<std::string, Entry> entries_;
+    //          
+    size_t sweep_size_;
+    mutable std::mutex mutex_;
+
+    void SweepIfNeeded();
+};
\ No newline at end of file
@@ -0,0 +1,644 @@
+#include "graph.h"
+
+#include <algorithm>
+#include <cassert>
+
+const std::vector<Position> DependencyGraph::NO_REFERENCES;
+const DependencyGraph::PositionSet DependencyGraph::NO_DEPENDENTS;
+
+bool DependencyGraph::TrySetReferences(Position pos, std::vector<Position> refs,
+    std::vector<CellRange> ranges)
+{
+    for (const CellRange& range : ranges)
+    {
+        if (range.Contains(pos))
+        {
+            return false;
+        }
+    }
+
+    // Новые вершины-ссылки встают перед всеми, а новая ячейка - после всех,
+    // поэтому рёбра от новых ссылок порядок не нарушают
+    for (const Position ref : refs)
+    {
+        AssignReferenceOrder(ref);
+    }
+    AssignOrder(pos);
+
+    std::vector<Position> added;
+    bool acyclic = true;
+    for (const Position ref : refs)
+    {
+        if (dependents_.count(ref) && dependents_.at(ref).count(pos))
+        {
+            continue;
+        }
+        if (!AddEdge(ref, pos))
+        {
+            acyclic = false;
+            break;
+        }
+        added.push_back(ref);
+    }
+    if (acyclic && !ranges.empty())
+    {
+        // рёбра от вершин внутри диапазонов не хранятся, но порядок и
+        // отсутствие циклов должны их учитывать
+        std::vector<Position> range_vertices;
+        for (const CellRange& range : ranges)
+        {
+            ForEachVertexIn(range, [&range_vertices](Position vertex) {
+                range_vertices.push_back(vertex);
+            });
+        }
+        for (const Position vertex : range_vertices)
+        {
+            if (!OrderEdge(vertex, pos))
+            {
+                acyclic = false;
+                break;
+            }
+        }
+    }
+    if (!acyclic)
+    {
+        for (const Position added_ref : added)
+        {
+            EraseDependent(added_ref, pos);
+        }
+        for (const Position ref_to_release : refs)
+        {
+            ReleaseOrder(ref_to_release);
+        }
+        ReleaseOrder(pos);
+        return false;
+    }
+
+    for (const Position old_ref : GetReferences(pos))
+    {
+        if (!std::binary_search(refs.begin(), refs.end(), old_ref))
+        {
+            EraseDependent(old_ref, pos);
+            ReleaseOrder(old_ref);
+        }
+    }
+    if (refs.empty())
+    {
+        references_.erase(pos);
+    }
+    else
+    {
+        references_[pos] = std::move(refs);
+    }
+
+    if (auto it = ranges_.find(pos); it != ranges_.end())
+    {
+        for (const RangeReference& reference : it->second)
+        {
+            range_index_.Erase(reference.id);
+        }
+        ranges_.erase(it);
+    }
+    if (!ranges.empty())
+    {
+        std::vector<RangeReference>& range_refs = ranges_[pos];
+        range_refs.reserve(ranges.size());
+        for (const CellRange& range : ranges)
+        {
+            range_refs.push_back({ range, range_index_.Insert(range, pos) });
+        }
+    }
+    ReleaseOrder(pos);
+    return true;
+}
+
+bool DependencyGraph::TrySetReferences(std::vector<ReferenceUpdate> updates)
+{
+    for (const ReferenceUpdate& update : updates)
+    {
+        if (std::binary_search(update.refs.begin(), update.refs.end(), update.pos))
+        {
+            return false;
+        }
+        for (const CellRange& range : update.ranges)
+        {
+            if (range.Contains(update.pos))
+            {
+                return false;
+            }
+        }
+    }
+
+    std::vector<ReferenceUpdate> previous;
+    previous.reserve(updates.size());
+    for (const ReferenceUpdate& update : updates)
+    {
+        ReferenceUpdate& old = previous.emplace_back();
+        old.pos = update.pos;
+        old.refs = GetReferences(update.pos);
+        if (auto it = ranges_.find(update.pos); it != ranges_.end())
+        {
+            for (const RangeReference& reference : it->second)
+            {
+                old.ranges.push_back(reference.range);
+            }
+        }
+    }
+
+    // По одной ячейке набор применяется, пока ни одно изменение не замкнуло
+    // цикл. Иначе промежуточное состояние может быть циклическим, хотя
+    // итоговое - нет, поэтому изменения откатываются, и набор проверяется целиком
+    if (updates.size() * INCREMENTAL_UPDATE_RATIO < order_.size())
+    {
+        size_t applied = 0;
+        while (applied < updates.size()
+            && TrySetReferences(updates[applied].pos, updates[applied].refs, updates[applied].ranges))
+        {
+            ++applied;
+        }
+        if (applied == updates.size())
+        {
+            return true;
+        }
+        // каждый откат возвращает граф к состоянию, которое уже было
+        // ацикличным, поэтому он не может не удаться
+        while (applied-- > 0)
+        {
+            [[maybe_unused]] const bool restored =
+                TrySetReferences(previous[applied].pos, previous[applied].refs, previous[applied].ranges);
+            assert(restored);
+        }
+    }
+
+    std::vector<Position> touched;
+    for (ReferenceUpdate& update : updates)
+    {
+        touched.push_back(update.pos);
+        touched.insert(touched.end(), update.refs.begin(), update.refs.end());
+        ReplaceReferences(update.pos, std::move(update.refs), std::move(update.ranges));
+    }
+    const bool acyclic = RebuildOrder();
+    if (!acyclic)
+    {
+        for (ReferenceUpdate& old : previous)
+        {
+            ReplaceReferences(old.pos, std::move(old.refs), std::move(old.ranges));
+        }
+    }
+    for (const ReferenceUpdate& old : previous)
+    {
+        touched.insert(touched.end(), old.refs.begin(), old.refs.end());
+    }
+    for (const Position pos : touched)
+    {
+        ReleaseOrder(pos);
+    }
+    return acyclic;
+}
+
+bool DependencyGraph::RestoreReferences(std::vector<ReferenceUpdate> updates)
+{
+    assert(order_.empty());
+    order_.reserve(updates.size());
+    references_.reserve(updates.size());
+    for (ReferenceUpdate& update : updates)
+    {
+        // формула без ссылок становится вершиной, только если на неё ссылаются
+        if (update.refs.empty() && update.ranges.empty())
+        {
+            continue;
+        }
+        if (order_.count(update.pos) || std::binary_search(update.refs.begin(), update.refs.end(), update.pos))
+        {
+            return false;
+        }
+        for (const CellRange& range : update.ranges)
+        {
+            if (range.Contains(update.pos))
+            {
+                return false;
+            }
+        }
+        // вершина, которая встретилась впервые как ссылка, - не формула из
+        // updates: входящих рёбер у неё нет, и она встаёт перед всеми
+        for (const Position ref : update.refs)
+        {
+            AssignReferenceOrder(ref);
+            dependents_[ref].insert(update.pos);
+        }
+        order_.emplace(update.pos, next_order_++);
+        vertices_by_col_[update.pos.col].insert(update.pos.row);
+        if (!update.refs.empty())
+        {
+            references_[update.pos] = std::move(update.refs);
+        }
+        if (!update.ranges.empty())
+        {
+            std::vector<RangeReference>& range_refs = ranges_[update.pos];
+            range_refs.reserve(update.ranges.size());
+            for (const CellRange& range : update.ranges)
+            {
+                range_refs.push_back({ range, range_index_.Insert(range, update.pos) });
+            }
+        }
+    }
+    return true;
+}
+
+void DependencyGraph::RemoveReferences(Position pos)
+{
+    if (auto it = ranges_.find(pos); it != ranges_.end())
+    {
+        for (const RangeReference& reference : it->second)
+        {
+            range_index_.Erase(reference.id);
+        }
+        ranges_.erase(it);
+    }
+    auto it = references_.find(pos);
+    if (it != references_.end())
+    {
+        const std::vector<Position> refs = std::move(it->second);
+        references_.erase(it);
+        for (const Position ref : refs)
+        {
+            EraseDependent(ref, pos);
+            ReleaseOrder(ref);
+        }
+    }
+    ReleaseOrder(pos);
+}
+
+size_t DependencyGraph::GetRangeCount() const
+{
+    return range_index_.GetSize();
+}
+
+const std::vector<Position>& DependencyGraph::GetReferences(Position pos) const
+{
+    auto it = references_.find(pos);
+    return it == references_.end() ? NO_REFERENCES : it->second;
+}
+
+const DependencyGraph::PositionSet& DependencyGraph::GetDependents(Position pos) const
+{
+    auto it = dependents_.find(pos);
+    return it == dependents_.end() ? NO_DEPENDENTS : it->second;
+}
+
+std::vector<Position> DependencyGraph::CollectDependents(Position pos) const
+{
+    return CollectDependents(std::vector<Position>{ pos });
+}
+
+std::vector<Position> DependencyGraph::CollectDependents(const std::vector<Position>& sources) const
+{
+    std::vector<Position> result;
+    PositionSet visited;
+    std::vector<Position> stack = sources;
+    while (!stack.empty())
+    {
+        const Position current = stack.back();
+        stack.pop_back();
+        ForEachDependent(current, [&](Position dependent) {
+            if (visited.insert(dependent).second)
+            {
+                result.push_back(dependent);
+                stack.push_back(dependent);
+            }
+        });
+    }
+    return result;
+}
+
+std::vector<Position> DependencyGraph::SortTopologically(const PositionSet& cells) const
+{
+    // ячейки без рёбер ни от кого не зависят и идут первыми
+    std::vector<std::pair<size_t, Position>> ordered;
+    ordered.reserve(cells.size());
+    for (const Position pos : cells)
+    {
+        auto it = order_.find(pos);
+        ordered.emplace_back(it == order_.end() ? 0 : it->second + 1, pos);
+    }
+    std::sort(ordered.begin(), ordered.end());
+    std::vector<Position> result;
+    result.reserve(ordered.size());
+    for (const auto& [order, pos] : ordered)
+    {
+        result.push_back(pos);
+    }
+    return result;
+}
+
+std::optional<size_t> DependencyGraph::GetOrder(Position pos) const
+{
+    auto it = order_.find(pos);
+    if (it == order_.end())
+    {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+std::vector<std::vector<Position>> DependencyGraph::SplitIntoLevels(const PositionSet& cells) const
+{
+    // Степень ячейки считается по рёбрам от её зависимостей, а не по её
+    // ссылкам: так ссылки на диапазоны не нужно раскрывать по ячейкам
+    std::unordered_map<Position, int, PositionHasher> in_degree;
+    in_degree.reserve(cells.size());
+    for (const Position pos : cells)
+    {
+        in_degree[pos] = 0;
+    }
+    for (const Position pos : cells)
+    {
+        ForEachDependent(pos, [&in_degree](Position dependent) {
+            auto it = in_degree.find(dependent);
+            if (it != in_degree.end())
+            {
+                ++it->second;
+            }
+        });
+    }
+    std::vector<std::vector<Position>> levels(1);
+    for (const Position pos : cells)
+    {
+        if (in_degree.at(pos) == 0)
+        {
+            levels.back().push_back(pos);
+        }
+    }
+    while (!levels.back().empty())
+    {
+        std::vector<Position> next_level;
+        for (const Position pos : levels.back())
+        {
+            ForEachDependent(pos, [&in_degree, &next_level](Position dependent) {
+                auto it = in_degree.find(dependent);
+                if (it != in_degree.end() && --it->second == 0)
+                {
+                    next_level.push_back(dependent);
+                }
+            });
+        }
+        levels.push_back(std::move(next_level));
+    }
+    levels.pop_back();
+    return levels;
+}
+
+void DependencyGraph::AssignReferenceOrder(Position ref)
+{
+    if (order_.emplace(ref, first_order_ - 1).second)
+    {
+        --first_order_;
+        vertices_by_col_[ref.col].insert(ref.row);
+    }
+}
+
+void DependencyGraph::AssignOrder(Position pos)
+{
+    if (order_.count(pos))
+    {
+        return;
+    }
+    vertices_by_col_[pos.col].insert(pos.row);
+    // Если новая ячейка попадает в диапазоны существующих формул, она должна
+    // идти перед ними и ставится перед всеми вершинами; рёбра от её ссылок
+    // затем переставляют её на место
+    bool in_range = false;
+    range_index_.ForEachContaining(pos, [&in_range](const CellRange&, Position) {
+        in_range = true;
+    });
+    order_.emplace(pos, in_range ? --first_order_ : next_order_++);
+}
+
+void DependencyGraph::ReplaceReferences(Position pos, std::vector<Position> refs, std::vector<CellRange> ranges)
+{
+    const auto register_vertex = [this](Position vertex) {
+        if (order_.emplace(vertex, next_order_).second)
+        {
+            vertices_by_col_[vertex.col].insert(vertex.row);
+        }
+    };
+    for (const Position old_ref : GetReferences(pos))
+    {
+        if (!std::binary_search(refs.begin(), refs.end(), old_ref))
+        {
+            EraseDependent(old_ref, pos);
+        }
+    }
+    for (const Position ref : refs)
+    {
+        register_vertex(ref);
+        dependents_[ref].insert(pos);
+    }
+    if (refs.empty())
+    {
+        references_.erase(pos);
+    }
+    else
+    {
+        references_[pos] = std::move(refs);
+    }
+
+    if (auto it = ranges_.find(pos); it != ranges_.end())
+    {
+        for (const RangeReference& reference : it->second)
+        {
+            range_index_.Erase(reference.id);
+        }
+        ranges_.erase(it);
+    }
+    if (!ranges.empty())
+    {
+        std::vector<RangeReference>& range_refs = ranges_[pos];
+        range_refs.reserve(ranges.size());
+        for (const CellRange& range : ranges)
+        {
+            range_refs.push_back({ range, range_index_.Insert(range, pos) });
+        }
+    }
+    register_vertex(pos);
+}
+
+// Алгоритм Кана: вершина получает номер, когда пронумерованы все вершины,
+// от которых она зависит. Вершины цикла номера так и не получают
+bool DependencyGraph::RebuildOrder()
+{
+    std::unordered_map<Position, int, PositionHasher> in_degree;
+    in_degree.reserve(order_.size());
+    for (const auto& [pos, order] : order_)
+    {
+        in_degree.emplace(pos, 0);
+    }
+    for (const auto& [pos, order] : order_)
+    {
+        ForEachDependent(pos, [&in_degree](Position dependent) {
+            ++in_degree.at(dependent);
+        });
+    }
+    std::vector<Position> sorted;
+    sorted.reserve(order_.size());
+    for (const auto& [pos, degree] : in_degree)
+    {
+        if (degree == 0)
+        {
+            sorted.push_back(pos);
+        }
+    }
+    for (size_t i = 0; i < sorted.size(); ++i)
+    {
+        ForEachDependent(sorted[i], [&in_degree, &sorted](Position dependent) {
+            if (--in_degree.at(dependent) == 0)
+            {
+                sorted.push_back(dependent);
+            }
+        });
+    }
+    if (sorted.size() != order_.size())
+    {
+        return false;
+    }
+    first_order_ = SIZE_MAX / 2;
+    next_order_ = first_order_;
+    for (const Position pos : sorted)
+    {
+        order_[pos] = next_order_++;
+    }
+    return true;
+}
+
+void DependencyGraph::ReleaseOrder(Position pos)
+{
+    if (references_.count(pos) || dependents_.count(pos) || ranges_.count(pos))
+    {
+        return;
+    }
+    if (order_.erase(pos) == 0)
+    {
+        return;
+    }
+    auto it = vertices_by_col_.find(pos.col);
+    it->second.erase(pos.row);
+    if (it->second.empty())
+    {
+        vertices_by_col_.erase(it);
+    }
+}
+
+void DependencyGraph::EraseDependent(Position pos, Position dependent)
+{
+    auto it = dependents_.find(pos);
+    if (it == dependents_.end())
+    {
+        return;
+    }
+    it->second.erase(dependent);
+    if (it->second.empty())
+    {
+        dependents_.erase(it);
+    }
+}
+
+bool DependencyGraph::AddEdge(Position from, Position to)
+{
+    if (!OrderEdge(from, to))
+    {
+        return false;
+    }
+    dependents_[from].insert(to);
+    return true;
+}
+
+bool DependencyGraph::OrderEdge(Position from, Position to)
+{
+    if (from == to)
+    {
+        return false;
+    }
+    const size_t lower_bound = order_.at(to);
+    const size_t upper_bound = order_.at(from);
+    if (upper_bound > lower_bound)
+    {
+        std::vector<Position> forward;
+        if (!CollectForward(to, upper_bound, from, forward))
+        {
+            return false;
+        }
+        std::vector<Position> backward;
+        CollectBackward(from, lower_bound, backward);
+        Reorder(forward, backward);
+    }
+    return true;
+}
+
+bool DependencyGraph::CollectForward(Position pos, size_t upper_bound, Position target,
+    std::vector<Position>& result) const
+{
+    PositionSet visited = { pos };
+    result.push_back(pos);
+    bool found = false;
+    for (size_t i = 0; i < result.size() && !found; ++i)
+    {
+        ForEachDependent(result[i], [&](Position dependent) {
+            if (dependent == target)
+            {
+                found = true;
+            }
+            else if (order_.at(dependent) < upper_bound && visited.insert(dependent).second)
+            {
+                result.push_back(dependent);
+            }
+        });
+    }
+    return !found;
+}
+
+void DependencyGraph::CollectBackward(Position pos, size_t lower_bound,
+    std::vector<Position>& result) const
+{
+    PositionSet visited = { pos };
+    result.push_back(pos);
+    for (size_t i = 0; i < result.size(); ++i)
+    {
+        ForEachReference(result[i], [&](Position ref) {
+            if (order_.at(ref) > lower_bound && visited.insert(ref).second)
+            {
+                result.push_back(ref);
+            }
+        });
+    }
+}
+
+void DependencyGraph::Reorder(std::vector<Position>& forward, std::vector<Position>& backward)
+{
+    const auto by_order = [this](Position lhs, Position rhs) {
+        return order_.at(lhs) < order_.at(rhs);
+    };
+    std::sort(forward.begin(), forward.end(), by_order);
+    std::sort(backward.begin(), backward.end(), by_order);
+
+    std::vector<size_t> orders;
+    orders.reserve(forward.size() + backward.size());
+    for (const Position pos : backward)
+    {
+        orders.push_back(order_.at(pos));
+    }
+    for (const Position pos : forward)
+    {
+        orders.push_back(order_.at(pos));
+    }
+    std::sort(orders.begin(), orders.end());
+
+    size_t index = 0;
+    for (const Position pos : backward)
+    {
+        order_[pos] = orders[index++];
+    }
+    for (const Position pos : forward)
+    {
+        order_[pos] = orders[index++];
+    }
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+#include "common.h"
+#include "range_index.h"
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Граф зависимостей между ячейками таблицы.
+// Для каждой ячейки с формулой хранит список ячеек, на которые она ссылается,
+// а для каждой позиции - множество формул, которые от неё зависят. Позиции не
+// обязаны быть заполнены: на пустую ячейку тоже можно сослаться.
+// Ссылки на диапазоны хранятся целиком, в индексе диапазонов, а не рёбрами к
+// каждой ячейке: ячейки диапазона находятся запросом к индексу по позиции.
+// Граф всегда ацикличен. Для его вершин поддерживается топологический порядок
+// (алгоритм Пирса-Келли): при добавлении ребра, не нарушающего порядок, проверка
+// цикла ничего не стоит, иначе просматривается только участок графа между
+// концами ребра.
+class DependencyGraph
+{
+public:
+    using PositionSet = std::unordered_set<Position, PositionHasher>;
+
+    // Новые ссылки ячейки pos для TrySetReferences над несколькими ячейками
+    struct ReferenceUpdate
+    {
+        Position pos;
+        std::vector<Position> refs;
+        std::vector<CellRange> ranges;
+    };
+
+    // Заменяет ссылки ячейки pos на ячейки refs (список отсортирован, без
+    // повторов) и диапазоны ranges. Если новые ссылки образуют цикл, граф не
+    // меняется и возвращается false
+    bool TrySetReferences(Position pos, std::vector<Position> refs, std::vector<CellRange> ranges = {});
+
+    // Заменяет ссылки сразу нескольких ячеек (позиции в updates без повторов).
+    // Если вместе они образуют цикл, граф не меняется и возвращается false.
+    // Большой набор применяется без поддержки порядка, а затем порядок всего
+    // графа строится заново одним проходом за линейное время. Небольшой набор
+    // относительно размера графа сначала пробует применить по одной ячейке
+    bool TrySetReferences(std::vector<ReferenceUpdate> updates);
+
+    // Заполняет пустой граф ссылками ячеек, перечисленных в топологическом
+    // порядке: ячейка идёт после всех формул, от которых зависит, в том числе
+    // через диапазоны. Порядок графа берётся из порядка updates, циклы не
+    // ищутся. Возвращает false, если на ячейку сослались раньше её записи или
+    // она ссылается на себя; граф после этого нужно отбросить
+    bool RestoreReferences(std::vector<ReferenceUpdate> updates);
+
+    // Удаляет все ссылки ячейки pos. Ячейки, зависящие от pos, остаются в графе
+    void RemoveReferences(Position pos);
+
+    // Вызывает func(Position) для каждой ячейки, которая непосредственно
+    // зависит от pos: ссылается на неё саму или на содержащий её диапазон.
+    // Ячейка может встретиться несколько раз
+    template <typename Func>
+    void ForEachDependent(Position pos, Func&& func) const;
+
+    // Вызывает func(Position) для каждой вершины графа, на которую ссылается pos:
+    // для ячеек из ссылок и для вершин внутри диапазонов. Ячейки диапазонов, у
+    // которых нет рёбер, не перечисляются. Вершина может встретиться несколько раз
+    template <typename Func>
+    void ForEachReference(Position pos, Func&& func) const;
+
+    // Число ссылок на диапазоны во всех формулах
+    size_t GetRangeCount() const;
+
+    // Возвращает все ячейки, транзитивно зависящие от pos. Сама pos в список
+    // не входит. Каждая ячейка встречается один раз
+    std::vector<Position> CollectDependents(Position pos) const;
+
+    // То же для нескольких ячеек. Ячейка из sources входит в результат, если
+    // зависит от другой ячейки из sources
+    std::vector<Position> CollectDependents(const std::vector<Position>& sources) const;
+
+    // Упорядочивает ячейки cells так, что каждая ячейка стоит после всех
+    // ячеек из cells, на которые она ссылается
+    std::vector<Position> SortTopologically(const PositionSet& cells) const;
+
+    // Номер ячейки в топологическом порядке графа. У ячеек без рёбер номера нет
+    std::optional<size_t> GetOrder(Position pos) const;
+
+    // Разбивает ячейки cells на уровни: ячейка попадает на уровень, следующий
+    // за максимальным уровнем ячеек из cells, на которые она ссылается.
+    // Ячейки одного уровня друг от друга не зависят
+    std::vector<std::vector<Position>> SplitIntoLevels(const PositionSet& cells) const;
+
+private:
+    struct RangeReference
+    {
+        CellRange range;
+        RangeIndex::EntryId id;
+    };
+
+    std::unordered_map<Position, std::vector<Position>, PositionHasher> references_;
+    std::unordered_map<Position, PositionSet, PositionHasher> dependents_;
+    std::unordered_map<Position, std::vector<RangeReference>, PositionHasher> ranges_;
+    RangeIndex range_index_;
+    std::unordered_map<Position, size_t, PositionHasher> order_;
+    // строки вершин по столбцам, чтобы находить вершины внутри диапазона
+    std::map<int, std::set<int>> vertices_by_col_;
+    // номера новых вершин растут от середины диапазона size_t в обе стороны:
+    // вершина без входящих рёбер может встать перед всеми остальными
+    size_t next_order_ = SIZE_MAX / 2;
+    size_t first_order_ = SIZE_MAX / 2;
+
+    const std::vector<Position>& GetReferences(Position pos) const;
+    const PositionSet& GetDependents(Position pos) const;
+
+    // Вызывает func(Position) для каждой вершины графа внутри range
+    template <typename Func>
+    void ForEachVertexIn(const CellRange& range, Func&& func) const;
+
+    // Новая вершина-ссылка без рёбер может стоять где угодно и получает
+    // номер перед всеми прежними: так ребро от неё не требует перестановки
+    void AssignReferenceOrder(Position ref);
+    // Новая ячейка с формулой получает номер после всех прежних, если не
+    // попадает в диапазоны других формул
+    void AssignOrder(Position pos);
+
+    // Заменяет ссылки ячейки, не меняя порядок. Новые вершины получают
+    // временные номера, вершины без рёбер не удаляются
+    void ReplaceReferences(Position pos, std::vector<Position> refs, std::vector<CellRange> ranges);
+
+    // Перенумеровывает все вершины в топологическом порядке. Возвращает false
+    // и оставляет номера прежними, если в графе есть цикл
+    bool RebuildOrder();
+
+    // Удаляет номер ячейки, если у неё не осталось рёбер
+    void ReleaseOrder(Position pos);
+
+    void EraseDependent(Position pos, Position dependent);
+
+    // Добавляет ребро from -> to (to ссылается на from), восстанавливая
+    // топологический порядок. Возвращает false, если ребро замыкает цикл
+    bool AddEdge(Position from, Position to);
+
+    // То же для ребра, которое не хранится в графе, а следует из диапазона
+    bool OrderEdge(Position from, Position to);
+
+    // Ячейки, достижимые из pos по зависимым с номером не больше upper_bound.
+    // Возвращает false, если среди них встретилась ячейка target
+    bool CollectForward(Position pos, size_t upper_bound, Position target,
+        std::vector<Position>& result) const;
+
+    // Ячейки, от которых транзитивно зависит pos, с номером не меньше lower_bound
+    void CollectBackward(Position pos, size_t lower_bound, std::vector<Position>& result) const;
+
+    // Переставляет ячейки участка так, что backward оказываются перед forward,
+    // используя освободившиеся номера
+    void Reorder(std::vector<Position>& forward, std::vector<Position>& backward);
+
+    // Во сколько раз граф должен быть больше набора изменений, чтобы набор
+    // применялся по одной ячейке, а не перестройкой порядка
+    static const size_t INCREMENTAL_UPDATE_RATIO = 16;
+
+    static const std::vector<Position> NO_REFERENCES;
+    static const PositionSet NO_DEPENDENTS;
+};
+
+template <typename Func>
+void DependencyGraph::ForEachDependent(Position pos, Func&& func) const
+{
+    for (const Position dependent : GetDependents(pos))
+    {
+        func(dependent);
+    }
+    range_index_.ForEachContaining(pos, [&func](const CellRange&, Position dependent) {
+        func(dependent);
+    });
+}
+
+template <typename Func>
+void DependencyGraph::ForEachReference(Position pos, Func&& func) const
+{
+    for (const Position ref : GetReferences(pos))
+    {
+        func(ref);
+    }
+    const auto it = ranges_.find(pos);
+    if (it == ranges_.end())
+    {
+        return;
+    }
+    for (const RangeReference& reference : it->second)
+    {
+        ForEachVertexIn(reference.range, func);
+    }
+}
+
+template <typename Func>
+void DependencyGraph::ForEachVertexIn(const CellRange& range, Func&& func) const
+{
+    const auto end = vertices_by_col_.upper_bound(range.last.col);
+    for (auto col_it = vertices_by_col_.lower_bound(range.first.col); col_it != end; ++col_it)
+    {
+        const std::set<int>& rows = col_it->second;
+        const auto rows_end = rows.upper_bound(range.last.row);
+        for (auto row_it = rows.lower_bound(range.first.row); row_it != rows_end; ++row_it)
+        {
+            func(Position{ *row_it, col_it->first });
+        }
+    }
+}
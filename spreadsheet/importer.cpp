@@ -0,0 +1,257 @@
+#include "importer.h"
+
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <memory>
+#include <string_view>
+
+namespace
+{
+    // Записи части порции. Строки ячеек отсчитываются от начала части
+    struct ParsedRecords
+    {
+        std::vector<CellEdit> edits;
+        int rows = 0;
+        int cols = 0;
+    };
+
+    // Делит data не более чем на parts частей из целых записей и возвращает
+    // концы частей. Последний конец - конец последней целой записи; если
+    // целых записей нет, список пуст.
+    // Без кавычек конец записи - любой перевод строки, и части находятся
+    // поиском от границ равного деления. С кавычками перевод строки может
+    // быть внутри поля, поэтому порция просматривается целиком, с теми же
+    // правилами, что в ParseRecords: кавычка открывает поле только в его
+    // начале, а две кавычки внутри поля - одна кавычка текста
+    std::vector<size_t> SplitRecords(std::string_view data, const ImportOptions& options, size_t parts)
+    {
+        std::vector<size_t> ends;
+        const size_t part_size = std::max<size_t>(1, data.size() / parts);
+        const char quote = options.quote;
+        if (!quote)
+        {
+            const size_t last_newline = data.rfind('\n');
+            if (last_newline == std::string_view::npos)
+            {
+                return ends;
+            }
+            const size_t records_end = last_newline + 1;
+            for (size_t begin = 0; begin < records_end;)
+            {
+                size_t end = records_end;
+                if (begin + part_size < records_end)
+                {
+                    end = data.find('\n', begin + part_size - 1) + 1;
+                }
+                ends.push_back(end);
+                begin = end;
+            }
+            return ends;
+        }
+
+        bool field_start = true;
+        bool quoted = false;
+        size_t records_end = 0;
+        size_t next_end = part_size;
+        for (size_t i = 0; i < data.size(); ++i)
+        {
+            if (quoted)
+            {
+                if (data[i] == quote)
+                {
+                    if (i + 1 < data.size() && data[i + 1] == quote)
+                    {
+                        ++i;
+                    }
+                    else
+                    {
+                        quoted = false;
+                    }
+                }
+                continue;
+            }
+            if (field_start && data[i] == quote)
+            {
+                quoted = true;
+                field_start = false;
+                continue;
+            }
+            field_start = data[i] == options.delimiter || data[i] == '\n';
+            if (data[i] == '\n')
+            {
+                records_end = i + 1;
+                if (records_end >= next_end)
+                {
+                    ends.push_back(records_end);
+                    next_end = records_end + part_size;
+                }
+            }
+        }
+        if (records_end != 0 && (ends.empty() || ends.back() != records_end))
+        {
+            ends.push_back(records_end);
+        }
+        return ends;
+    }
+
+    void ParseRecords(std::string_view data, const ImportOptions& options, ParsedRecords& result)
+    {
+        const char separators[] = { options.delimiter, '\n' };
+        const std::string_view field_end(separators, sizeof(separators));
+        std::string field;
+        size_t record_begin = 0;
+        int col = 0;
+        size_t i = 0;
+        while (i < data.size())
+        {
+            field.clear();
+            if (options.quote && data[i] == options.quote)
+            {
+                for (++i; i < data.size(); ++i)
+                {
+                    if (data[i] != options.quote)
+                    {
+                        field += data[i];
+                    }
+                    else if (i + 1 < data.size() && data[i + 1] == options.quote)
+                    {
+                        field += data[i++];
+                    }
+                    else
+                    {
+                        ++i;
+                        break;
+                    }
+                }
+            }
+            const size_t end = std::min(data.find_first_of(field_end, i), data.size());
+            field.append(data.substr(i, end - i));
+            i = end;
+            const bool record_ends = i == data.size() || data[i] == '\n';
+            // перевод строки в стиле Windows
+            if (record_ends && !field.empty() && field.back() == '\r')
+            {
+                field.pop_back();
+            }
+            if (!field.empty())
+            {
+                result.edits.push_back({ Position{ result.rows, col }, field });
+            }
+            if (!record_ends)
+            {
+                ++col;
+                ++i;
+                continue;
+            }
+            // пустая строка - запись без полей
+            if (i > record_begin)
+            {
+                result.cols = std::max(result.cols, col + 1);
+            }
+            ++result.rows;
+            col = 0;
+            if (i < data.size())
+            {
+                ++i;
+            }
+            record_begin = i;
+        }
+    }
+}
+
+Size ImportDelimited(std::istream& input, Sheet& sheet, const ImportOptions& options)
+{
+    // на время импорта таблица разбирает формулы тем же числом потоков
+    struct RecalcThreadsGuard
+    {
+        Sheet& sheet;
+        const size_t thread_count;
+
+        ~RecalcThreadsGuard()
+        {
+            if (sheet.GetRecalcThreads() != thread_count)
+            {
+                sheet.SetRecalcThreads(thread_count);
+            }
+        }
+    };
+    const RecalcThreadsGuard guard{ sheet, sheet.GetRecalcThreads() };
+    if (std::max<size_t>(1, options.thread_count) != guard.thread_count)
+    {
+        sheet.SetRecalcThreads(options.thread_count);
+    }
+
+    std::unique_ptr<ThreadPool> pool;
+    if (options.thread_count > 1)
+    {
+        pool = std::make_unique<ThreadPool>(options.thread_count);
+    }
+    const size_t parts = std::max<size_t>(1, options.thread_count);
+
+    Size size;
+    std::string buffer;
+    bool input_ended = false;
+    while (!input_ended || !buffer.empty())
+    {
+        if (!input_ended)
+        {
+            const size_t kept = buffer.size();
+            buffer.resize(kept + options.chunk_size);
+            input.read(buffer.data() + kept, options.chunk_size);
+            buffer.resize(kept + input.gcount());
+            input_ended = !input;
+        }
+        std::vector<size_t> ends = SplitRecords(buffer, options, parts);
+        if (input_ended && (ends.empty() || ends.back() != buffer.size()))
+        {
+            // последняя запись без перевода строки
+            ends.push_back(buffer.size());
+        }
+        if (ends.empty())
+        {
+            // запись длиннее порции
+            continue;
+        }
+
+        std::vector<ParsedRecords> parsed(ends.size());
+        const auto parse_part = [&](size_t part) {
+            const size_t begin = part == 0 ? 0 : ends[part - 1];
+            ParseRecords(std::string_view(buffer).substr(begin, ends[part] - begin), options, parsed[part]);
+        };
+        if (pool)
+        {
+            pool->ParallelFor(parsed.size(), parse_part);
+        }
+        else
+        {
+            for (size_t part = 0; part < parsed.size(); ++part)
+            {
+                parse_part(part);
+            }
+        }
+
+        std::vector<CellEdit> edits;
+        size_t edit_count = 0;
+        for (const ParsedRecords& records : parsed)
+        {
+            edit_count += records.edits.size();
+        }
+        edits.reserve(edit_count);
+        int first_row = size.rows;
+        for (ParsedRecords& records : parsed)
+        {
+            for (CellEdit& edit : records.edits)
+            {
+                edit.pos.row += first_row;
+                edits.push_back(std::move(edit));
+            }
+            first_row += records.rows;
+            size.cols = std::max(size.cols, records.cols);
+        }
+        sheet.SetCells(std::move(edits));
+        size.rows = first_row;
+        buffer.erase(0, ends.back());
+    }
+    return size;
+}
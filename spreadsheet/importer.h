@@ -0,0 +1,35 @@
+#pragma once
+
+#include "common.h"
+#include "sheet.h"
+
+#include <istream>
+
+// Параметры чтения таблицы из текста с разделителями
+struct ImportOptions
+{
+    // Разделитель полей: '\t' для TSV, ',' для CSV
+    char delimiter = '\t';
+    // Поля в кавычках (CSV): внутри них разделители и переводы строк - часть
+    // текста, а две кавычки подряд обозначают одну. 0 - кавычки не особые,
+    // как в выводе Sheet::PrintTexts
+    char quote = 0;
+    // Сколько байт читается из потока за раз. Записи целиком попадают в
+    // одну порцию, поэтому более длинная запись увеличивает порцию
+    size_t chunk_size = 1 << 20;
+    // Потоки для разбора порции на поля и для разбора формул: на время
+    // импорта таблица получает это число потоков (Sheet::SetRecalcThreads),
+    // а после возвращает прежнее
+    size_t thread_count = 1;
+};
+
+// Читает записи из input порциями и записывает поле j записи i в ячейку
+// (i, j). Пустые поля не создают ячеек. Поле трактуется так же, как текст в
+// SetCell: формула, текст или число.
+// Каждая порция записывается в таблицу одним вызовом Sheet::SetCells, поэтому
+// дополнительная память не зависит от размера входа; при thread_count > 1
+// порция делится на поля и её формулы разбираются параллельно. При ошибке в порции она не записывается, а
+// исключение пробрасывается, прежние порции остаются в таблице.
+// Вывод Sheet::PrintTexts читается с параметрами по умолчанию в ту же таблицу.
+// Возвращает размер прочитанной области
+Size ImportDelimited(std::istream& input, Sheet& sheet, const ImportOptions& options = {});
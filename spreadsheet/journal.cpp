@@ -0,0 +1,526 @@
+#include "journal.h"
+
+#include "checksum.h"
+#include "durable_file.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <unordered_map>
+
+using namespace std::literals;
+
+// Журнал - заголовок и за ним записи с номерами больше номера в заголовке.
+// Запись - заголовок записи и текст ячейки; контрольная сумма считается по
+// заголовку записи с нулевым полем суммы и тексту
+namespace
+{
+    const char MAGIC[8] = { 'S', 'H', 'E', 'E', 'T', 'J', 'N', 'L' };
+    const std::uint32_t FORMAT_VERSION = 2;
+    const std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+    struct FileHeader
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byte_order;
+        // номер последней записи, удалённой при сжатии
+        std::uint64_t base_sequence;
+    };
+    static_assert(sizeof(FileHeader) == 24);
+
+    enum class RecordKind : std::uint8_t
+    {
+        Set,
+        Clear,
+    };
+
+    struct RecordHeader
+    {
+        std::uint64_t sequence;
+        std::uint64_t checksum;
+        std::int32_t row;
+        std::int32_t col;
+        std::uint32_t text_size;
+        RecordKind kind;
+        std::uint8_t reserved[3];
+    };
+    static_assert(sizeof(RecordHeader) == 32);
+
+    std::uint64_t GetChecksum(RecordHeader header, std::string_view text)
+    {
+        header.checksum = 0;
+        Checksum checksum;
+        checksum.Add({ reinterpret_cast<const char*>(&header), sizeof(header) });
+        checksum.Add(text);
+        return checksum.Get();
+    }
+
+    FileHeader MakeFileHeader(std::uint64_t base_sequence)
+    {
+        FileHeader header{};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = FORMAT_VERSION;
+        header.byte_order = BYTE_ORDER_MARK;
+        header.base_sequence = base_sequence;
+        return header;
+    }
+
+    std::string_view AsBytes(const FileHeader& header)
+    {
+        return { reinterpret_cast<const char*>(&header), sizeof(header) };
+    }
+
+    // Проверяет заголовок журнала и возвращает записи и номер, после
+    // которого они нумеруются
+    std::string_view GetRecords(std::string_view data, std::uint64_t& base_sequence)
+    {
+        FileHeader header;
+        if (data.size() < sizeof(header))
+        {
+            throw JournalError("Journal is truncated"s);
+        }
+        std::memcpy(&header, data.data(), sizeof(header));
+        if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+        {
+            throw JournalError("Not a journal"s);
+        }
+        if (header.version != FORMAT_VERSION)
+        {
+            throw JournalError("Unsupported journal version "s + std::to_string(header.version));
+        }
+        if (header.byte_order != BYTE_ORDER_MARK)
+        {
+            throw JournalError("Journal was written with a different byte order"s);
+        }
+        base_sequence = header.base_sequence;
+        return data.substr(sizeof(header));
+    }
+
+    // Вызывает func(header, text) для целых записей подряд и возвращает
+    // размер этих записей. Просмотр останавливается на первой оборванной
+    // или повреждённой записи: после сбоя дальше неё ничего не записано
+    template <typename Func>
+    size_t ForEachRecord(std::string_view records, std::uint64_t base_sequence, Func&& func)
+    {
+        size_t offset = 0;
+        std::uint64_t sequence = base_sequence;
+        RecordHeader header;
+        while (records.size() - offset >= sizeof(header))
+        {
+            std::memcpy(&header, records.data() + offset, sizeof(header));
+            if (header.text_size > records.size() - offset - sizeof(header))
+            {
+                break;
+            }
+            const std::string_view text = records.substr(offset + sizeof(header), header.text_size);
+            if (header.checksum != GetChecksum(header, text) || header.sequence <= sequence
+                || !Position{ header.row, header.col }.IsValid()
+                || (header.kind != RecordKind::Set && header.kind != RecordKind::Clear))
+            {
+                break;
+            }
+            func(header, text);
+            sequence = header.sequence;
+            offset += sizeof(header) + text.size();
+        }
+        return offset;
+    }
+
+    std::optional<std::string> ReadFile(const std::string& path)
+    {
+        std::ifstream input(path, std::ios::binary);
+        if (!input)
+        {
+            return std::nullopt;
+        }
+        return std::string(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+    }
+}
+
+EditJournal::EditJournal(const std::string& path, const JournalOptions& options)
+    : path_(path), options_(options)
+{
+    // файл короче заголовка остаётся от сбоя при создании журнала
+    std::optional<std::string> data = ReadFile(path);
+    const bool exists = data && data->size() >= sizeof(FileHeader);
+    last_sequence_ = options.base_sequence;
+    if (exists)
+    {
+        const std::string_view records = GetRecords(*data, last_sequence_);
+        truncated_sequence_ = last_sequence_;
+        const size_t valid_size = ForEachRecord(records, last_sequence_,
+            [this](const RecordHeader& header, std::string_view) {
+            last_sequence_ = header.sequence;
+        });
+        if (valid_size < records.size())
+        {
+            std::error_code error;
+            std::filesystem::resize_file(path, sizeof(FileHeader) + valid_size, error);
+            if (error)
+            {
+                throw JournalError("Cannot truncate journal file "s + path);
+            }
+        }
+    }
+    synced_sequence_ = last_sequence_;
+
+    file_ = std::fopen(path.c_str(), exists ? "ab" : "wb");
+    if (!file_)
+    {
+        throw JournalError("Cannot open journal file "s + path);
+    }
+    if (!exists)
+    {
+        truncated_sequence_ = last_sequence_;
+        try
+        {
+            WriteAndSync(AsBytes(MakeFileHeader(last_sequence_)));
+        }
+        catch (...)
+        {
+            std::fclose(file_);
+            throw;
+        }
+    }
+    writer_ = std::thread(&EditJournal::WriterLoop, this);
+}
+
+EditJournal::~EditJournal()
+{
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    data_ready_.notify_one();
+    writer_.join();
+    if (file_)
+    {
+        std::fclose(file_);
+    }
+}
+
+void EditJournal::AppendSet(Position pos, std::string_view text)
+{
+    bool notify;
+    {
+        std::lock_guard lock(mutex_);
+        notify = pending_.empty();
+        AppendRecord(pos, text, false);
+        notify = notify || pending_.size() >= options_.commit_bytes;
+    }
+    if (notify)
+    {
+        data_ready_.notify_one();
+    }
+}
+
+void EditJournal::AppendSet(const std::vector<CellEdit>& edits)
+{
+    {
+        std::lock_guard lock(mutex_);
+        for (const CellEdit& edit : edits)
+        {
+            AppendRecord(edit.pos, edit.text, false);
+        }
+    }
+    data_ready_.notify_one();
+}
+
+void EditJournal::AppendClear(Position pos)
+{
+    bool notify;
+    {
+        std::lock_guard lock(mutex_);
+        notify = pending_.empty();
+        AppendRecord(pos, {}, true);
+        notify = notify || pending_.size() >= options_.commit_bytes;
+    }
+    if (notify)
+    {
+        data_ready_.notify_one();
+    }
+}
+
+void EditJournal::Sync()
+{
+    std::unique_lock lock(mutex_);
+    const std::uint64_t sequence = last_sequence_;
+    if (synced_sequence_ < sequence)
+    {
+        sync_requested_ = true;
+        data_ready_.notify_one();
+    }
+    data_synced_.wait(lock, [this, sequence] {
+        return synced_sequence_ >= sequence || error_;
+    });
+    if (error_)
+    {
+        std::rethrow_exception(error_);
+    }
+}
+
+void EditJournal::Truncate(uint64_t sequence)
+{
+    std::unique_lock lock(mutex_);
+    sequence = std::min(sequence, last_sequence_);
+    if (sequence <= truncated_sequence_)
+    {
+        return;
+    }
+    truncate_sequence_ = std::max(truncate_sequence_, sequence);
+    sync_requested_ = true;
+    data_ready_.notify_one();
+    data_synced_.wait(lock, [this, sequence] {
+        return truncated_sequence_ >= sequence || error_;
+    });
+    if (error_)
+    {
+        std::rethrow_exception(error_);
+    }
+}
+
+uint64_t EditJournal::GetLastSequence() const
+{
+    std::lock_guard lock(mutex_);
+    return last_sequence_;
+}
+
+uint64_t EditJournal::GetSyncedSequence() const
+{
+    std::lock_guard lock(mutex_);
+    return synced_sequence_;
+}
+
+JournalStats EditJournal::GetStats() const
+{
+    std::lock_guard lock(mutex_);
+    return stats_;
+}
+
+void EditJournal::AppendRecord(Position pos, std::string_view text, bool clear)
+{
+    RecordHeader header{};
+    header.sequence = ++last_sequence_;
+    header.row = pos.row;
+    header.col = pos.col;
+    header.text_size = static_cast<std::uint32_t>(text.size());
+    header.kind = clear ? RecordKind::Clear : RecordKind::Set;
+    header.checksum = GetChecksum(header, text);
+    pending_.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    pending_.append(text);
+    ++stats_.records;
+    stats_.bytes += sizeof(header) + text.size();
+}
+
+void EditJournal::WriterLoop()
+{
+    std::string writing;
+    std::unique_lock lock(mutex_);
+    while (true)
+    {
+        data_ready_.wait(lock, [this] {
+            return stop_ || !pending_.empty() || truncate_sequence_ > truncated_sequence_;
+        });
+        const bool has_records = !pending_.empty();
+        const bool truncate = truncate_sequence_ > truncated_sequence_;
+        if (!has_records && !truncate)
+        {
+            return;
+        }
+        if (has_records && !truncate)
+        {
+            // групповая фиксация: записи, пришедшие за время ожидания,
+            // попадут на диск вместе с уже накопленными
+            data_ready_.wait_for(lock, options_.commit_delay, [this] {
+                return stop_ || sync_requested_ || pending_.size() >= options_.commit_bytes;
+            });
+        }
+        writing.swap(pending_);
+        const std::uint64_t sequence = last_sequence_;
+        // записи до запрошенного номера уже в writing или в файле
+        const std::uint64_t truncate_sequence = truncate_sequence_;
+        sync_requested_ = false;
+        lock.unlock();
+
+        std::exception_ptr error;
+        try
+        {
+            if (!writing.empty())
+            {
+                WriteAndSync(writing);
+            }
+            if (truncate)
+            {
+                Compact(truncate_sequence);
+            }
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        const bool written = !writing.empty();
+        writing.clear();
+
+        lock.lock();
+        if (error)
+        {
+            // после ошибки в файле может остаться оборванная запись, поэтому
+            // дальше журнал не пишется
+            error_ = error;
+            data_synced_.notify_all();
+            return;
+        }
+        synced_sequence_ = sequence;
+        if (written)
+        {
+            ++stats_.commits;
+        }
+        if (truncate)
+        {
+            truncated_sequence_ = truncate_sequence;
+            ++stats_.truncations;
+        }
+        data_synced_.notify_all();
+    }
+}
+
+void EditJournal::WriteAndSync(std::string_view data)
+{
+    if (std::fwrite(data.data(), 1, data.size(), file_) != data.size() || std::fflush(file_) != 0)
+    {
+        throw JournalError("Cannot write journal file "s + path_);
+    }
+    if (options_.sync && !SyncFile(file_))
+    {
+        throw JournalError("Cannot sync journal file "s + path_);
+    }
+}
+
+// Файл журнала дописывается только этим потоком, поэтому его можно прочитать
+// и заменить, пока другие потоки добавляют записи в буфер
+void EditJournal::Compact(uint64_t sequence)
+{
+    const std::optional<std::string> data = ReadFile(path_);
+    if (!data)
+    {
+        throw JournalError("Cannot read journal file "s + path_);
+    }
+    std::uint64_t base_sequence;
+    const std::string_view records = GetRecords(*data, base_sequence);
+    size_t removed_size = 0;
+    ForEachRecord(records, base_sequence, [&](const RecordHeader& header, std::string_view text) {
+        if (header.sequence <= sequence)
+        {
+            removed_size += sizeof(header) + text.size();
+        }
+    });
+
+    AtomicFileWriter writer(path_);
+    if (!writer.Write(AsBytes(MakeFileHeader(sequence))) || !writer.Write(records.substr(removed_size)))
+    {
+        throw JournalError("Cannot write journal file "s + path_);
+    }
+    // дописываемый файл закрывается до переименования: в Windows открытый
+    // файл нельзя заменить
+    std::fclose(file_);
+    const bool committed = writer.Commit();
+    file_ = std::fopen(path_.c_str(), "ab");
+    if (!committed || !file_)
+    {
+        throw JournalError("Cannot replace journal file "s + path_);
+    }
+}
+
+JournalReplay ReplayJournal(std::string_view data, Sheet& sheet, uint64_t after_sequence)
+{
+    JournalReplay result;
+    const std::string_view records = GetRecords(data, result.last_sequence);
+    // записи после after_sequence, но до начала журнала удалены сжатием:
+    // журнал продолжает более новый снимок, чем тот, на который он ложится
+    if (after_sequence < result.last_sequence)
+    {
+        throw JournalError("Journal starts after sequence "s + std::to_string(result.last_sequence));
+    }
+    // последнее изменение каждой ячейки; nullopt - очистка
+    std::unordered_map<Position, std::optional<std::string_view>, PositionHasher> last_edits;
+    const size_t valid_size = ForEachRecord(records, result.last_sequence,
+        [&](const RecordHeader& header, std::string_view text) {
+        result.last_sequence = header.sequence;
+        if (header.sequence <= after_sequence)
+        {
+            return;
+        }
+        ++result.records;
+        std::optional<std::string_view>& edit = last_edits[Position{ header.row, header.col }];
+        if (header.kind == RecordKind::Set)
+        {
+            edit = text;
+        }
+        else
+        {
+            edit.reset();
+        }
+    });
+    result.complete = valid_size == records.size();
+
+    std::vector<Position> cleared;
+    std::vector<CellEdit> edits;
+    edits.reserve(last_edits.size());
+    for (const auto& [pos, text] : last_edits)
+    {
+        if (text)
+        {
+            edits.push_back({ pos, std::string(*text) });
+        }
+        else
+        {
+            cleared.push_back(pos);
+        }
+    }
+
+    EditJournal* const journal = sheet.GetJournal();
+    const RecalcPolicy policy = sheet.GetRecalcPolicy();
+    sheet.SetJournal(nullptr);
+    sheet.SetRecalcPolicy(RecalcPolicy::Lazy);
+    const auto restore = [&] {
+        sheet.SetJournal(journal);
+        sheet.SetRecalcPolicy(policy);
+    };
+    try
+    {
+        // Итоговое состояние ячеек журнала ацикличное, но вместе со старыми
+        // формулами очищаемых ячеек цикл возможен. Очистка циклов не создаёт,
+        // поэтому выполняется первой
+        for (const Position pos : cleared)
+        {
+            sheet.ClearCell(pos);
+        }
+        sheet.SetCells(std::move(edits));
+    }
+    catch (const CircularDependencyException&)
+    {
+        restore();
+        throw JournalError("Journal does not match the sheet"s);
+    }
+    catch (...)
+    {
+        restore();
+        throw;
+    }
+    restore();
+    return result;
+}
+
+JournalReplay ReplayJournalFile(const std::string& path, Sheet& sheet, uint64_t after_sequence)
+{
+    const std::optional<std::string> data = ReadFile(path);
+    if (!data)
+    {
+        throw JournalError("Cannot open journal file "s + path);
+    }
+    return ReplayJournal(*data, sheet, after_sequence);
+}
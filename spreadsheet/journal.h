@@ -0,0 +1,132 @@
+#pragma once
+
+#include "sheet.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+class JournalError : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+struct JournalOptions
+{
+    // Сколько писатель ждёт новых записей, прежде чем записать и
+    // синхронизировать накопленные одним вызовом fsync
+    std::chrono::microseconds commit_delay{ 1000 };
+    // Накопленный объём, при котором записи сбрасываются, не дожидаясь конца
+    // commit_delay
+    size_t commit_bytes = 1 << 20;
+    // Без синхронизации записи попадают только в кэш файловой системы
+    bool sync = true;
+    // Номер, после которого нумеруются записи нового журнала. Журнал,
+    // созданный рядом с существующим снимком, продолжает его нумерацию
+    uint64_t base_sequence = 0;
+};
+
+struct JournalStats
+{
+    uint64_t records = 0;
+    uint64_t bytes = 0;
+    // Число записей на диск, каждая завершается одной синхронизацией
+    uint64_t commits = 0;
+    // Число сжатий файла вызовом Truncate
+    uint64_t truncations = 0;
+};
+
+// Журнал изменений таблицы, файл только для дописывания. Каждая запись -
+// одно изменение ячейки с порядковым номером и контрольной суммой.
+// Append* только копируют запись в буфер в памяти; буфер записывается в файл
+// и синхронизируется отдельным потоком, который собирает в одну
+// синхронизацию все записи, пришедшие за commit_delay (групповая фиксация).
+// Sync() дожидается, пока на диске окажутся все записи, добавленные до
+// вызова, и бросает JournalError, если запись на диск не удалась.
+// Хвост файла, оборванный при сбое, при открытии журнала отбрасывается,
+// и номера записей продолжаются с последней целой записи.
+// Все методы можно вызывать из разных потоков
+class EditJournal
+{
+public:
+    explicit EditJournal(const std::string& path, const JournalOptions& options = {});
+    EditJournal(const EditJournal&) = delete;
+    EditJournal& operator=(const EditJournal&) = delete;
+    // Записывает на диск все добавленные записи
+    ~EditJournal();
+
+    void AppendSet(Position pos, std::string_view text);
+    void AppendSet(const std::vector<CellEdit>& edits);
+    void AppendClear(Position pos);
+
+    void Sync();
+
+    // Удаляет из файла записи с номерами до sequence включительно, которые
+    // уже вошли в снимок. Файл переписывается потоком-писателем, и новые
+    // записи тем временем продолжают добавляться. Возвращает управление,
+    // когда сжатый файл занял место старого
+    void Truncate(uint64_t sequence);
+
+    // Номер последней добавленной записи; 0, если записей ещё не было
+    uint64_t GetLastSequence() const;
+    // Номер последней записи, которая уже на диске
+    uint64_t GetSyncedSequence() const;
+    JournalStats GetStats() const;
+
+private:
+    const std::string path_;
+    const JournalOptions options_;
+    std::FILE* file_ = nullptr;
+
+    mutable std::mutex mutex_;
+    std::condition_variable data_ready_;
+    std::condition_variable data_synced_;
+    std::string pending_;
+    uint64_t last_sequence_ = 0;
+    uint64_t synced_sequence_ = 0;
+    // номер, до которого записи удалены из файла, и запрошенный номер
+    uint64_t truncated_sequence_ = 0;
+    uint64_t truncate_sequence_ = 0;
+    bool sync_requested_ = false;
+    bool stop_ = false;
+    std::exception_ptr error_;
+    JournalStats stats_;
+    std::thread writer_;
+
+    // Вызывается под mutex_
+    void AppendRecord(Position pos, std::string_view text, bool clear);
+
+    void WriterLoop();
+    void WriteAndSync(std::string_view data);
+    // Переписывает файл без записей с номерами до sequence включительно
+    void Compact(uint64_t sequence);
+};
+
+struct JournalReplay
+{
+    // Число применённых записей
+    size_t records = 0;
+    // Номер последней целой записи журнала
+    uint64_t last_sequence = 0;
+    // false, если журнал оканчивается оборванной или повреждённой записью
+    bool complete = true;
+};
+
+// Применяет к таблице записи журнала с номерами больше after_sequence, как
+// правило - поверх снимка, в который вошли записи до after_sequence.
+// Записи применяются одним набором: от каждой ячейки берётся последнее
+// изменение, и формулы пересчитываются один раз после применения.
+// В журнал самой таблицы применённые записи не попадают. Бросает
+// JournalError, если данные не являются журналом или не согласуются с таблицей,
+// а также если записи после after_sequence уже удалены из журнала сжатием
+JournalReplay ReplayJournal(std::string_view data, Sheet& sheet, uint64_t after_sequence = 0);
+JournalReplay ReplayJournalFile(const std::string& path, Sheet& sheet, uint64_t after_sequence = 0);
@@ -1,7 +1,24 @@
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
 #include <limits>
+#include <random>
+#include <regex>
+#include <set>
+#include <thread>
 
+#include "checkpoint.h"
+#include "checksum.h"
 #include "common.h"
 #include "formula.h"
+#include "FormulaAST.h"
+#include "importer.h"
+#include "journal.h"
+#include "sheet.h"
+#include "snapshot.h"
 #include "test_runner_p.h"
 
 inline std::ostream& operator<<(std::ostream& output, Position pos) {
@@ -16,6 +33,10 @@ inline std::ostream& operator<<(std::ostream& output, Size size) {
     return output << "(" << size.rows << ", " << size.cols << ")";
 }
 
+inline std::ostream& operator<<(std::ostream& output, const CellRange& range) {
+    return output << range.first << ":" << range.last;
+}
+
 inline std::ostream& operator<<(std::ostream& output, const CellInterface::Value& value) {
     std::visit(
         [&](const auto& x) {
@@ -529,6 +550,2150 @@ void TestClearPrint() {
 
 }
 
+void TestCacheInvalidation()
+{
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "1");
+    sheet->SetCell("A2"_pos, "=A1+1");
+    sheet->SetCell("A3"_pos, "=A2*2");
+    sheet->SetCell("B1"_pos, "=C1");
+    ASSERT_EQUAL(sheet->GetCell("A3"_pos)->GetValue(), CellInterface::Value(4.0));
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(0.0));
+
+    sheet->SetCell("A1"_pos, "5");
+    ASSERT_EQUAL(sheet->GetCell("A2"_pos)->GetValue(), CellInterface::Value(6.0));
+    ASSERT_EQUAL(sheet->GetCell("A3"_pos)->GetValue(), CellInterface::Value(12.0));
+
+    sheet->SetCell("C1"_pos, "=A2");
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(6.0));
+
+    sheet->ClearCell("A1"_pos);
+    ASSERT_EQUAL(sheet->GetCell("A3"_pos)->GetValue(), CellInterface::Value(2.0));
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(1.0));
+
+    sheet->SetCell("A2"_pos, "text");
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(),
+        CellInterface::Value(FormulaError::Category::Value));
+}
+
+void TestRecalculate()
+{
+    auto sheet_ptr = CreateSheet();
+    Sheet& sheet = dynamic_cast<Sheet&>(*sheet_ptr);
+    ASSERT(sheet.GetRecalcPolicy() == RecalcPolicy::Lazy);
+
+    sheet.SetCell("A1"_pos, "2");
+    sheet.SetCell("B1"_pos, "=A1*A1");
+    sheet.SetCell("C1"_pos, "=B1+A1");
+    sheet.SetCell("D1"_pos, "=C1/B1");
+    sheet.Recalculate();
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(1.5));
+
+    sheet.SetRecalcPolicy(RecalcPolicy::Eager);
+    sheet.SetCell("A1"_pos, "0");
+    ASSERT(dynamic_cast<const Cell*>(sheet.GetCell("D1"_pos))->HasCache());
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(0.0));
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(),
+        CellInterface::Value(FormulaError::Category::Arithmetic));
+
+    sheet.ClearCell("A1"_pos);
+    ASSERT(dynamic_cast<const Cell*>(sheet.GetCell("D1"_pos))->HasCache());
+
+    sheet.SetRecalcPolicy(RecalcPolicy::Lazy);
+    sheet.SetCell("A1"_pos, "4");
+    ASSERT(!dynamic_cast<const Cell*>(sheet.GetCell("D1"_pos))->HasCache());
+    sheet.Recalculate();
+    ASSERT(dynamic_cast<const Cell*>(sheet.GetCell("D1"_pos))->HasCache());
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(1.25));
+}
+
+void TestParallelRecalculate()
+{
+    auto sheet_ptr = CreateSheet();
+    Sheet& sheet = dynamic_cast<Sheet&>(*sheet_ptr);
+    sheet.SetRecalcThreads(4);
+    ASSERT_EQUAL(sheet.GetRecalcThreads(), 4u);
+
+    const int INPUTS = 100;
+    const int ROWS = 12;
+    for (int col = 0; col < INPUTS; ++col)
+    {
+        sheet.SetCell(Position{ 0, col }, std::to_string(col));
+    }
+    for (int row = 1; row < ROWS; ++row)
+    {
+        for (int col = 0; col < INPUTS; ++col)
+        {
+            //           
+            const std::string above = Position{ row - 1, col }.ToString();
+            const std::string input = Position{ 0, (col + 1) % INPUTS }.ToString();
+            sheet.SetCell(Position{ row, col }, "=" + above + "+" + input);
+        }
+    }
+    sheet.Recalculate();
+    for (int col = 0; col < INPUTS; ++col)
+    {
+        const double expected = col + (ROWS - 1) * ((col + 1) % INPUTS);
+        ASSERT_EQUAL(sheet.GetCell(Position{ ROWS - 1, col })->GetValue(),
+            CellInterface::Value(expected));
+    }
+
+    sheet.SetCell("A1"_pos, "100");
+    sheet.Recalculate();
+    ASSERT_EQUAL(sheet.GetCell(Position{ ROWS - 1, INPUTS - 1 })->GetValue(),
+        CellInterface::Value(INPUTS - 1 + (ROWS - 1) * 100.0));
+
+    sheet.SetRecalcThreads(1);
+    ASSERT_EQUAL(sheet.GetRecalcThreads(), 1u);
+}
+
+void TestIncrementalCycleCheck()
+{
+    auto sheet = CreateSheet();
+    const int CHAIN_LENGTH = 2000;
+    sheet->SetCell(Position{ 0, 0 }, "1");
+    for (int row = 1; row < CHAIN_LENGTH; ++row)
+    {
+        sheet->SetCell(Position{ row, 0 }, "=" + Position{ row - 1, 0 }.ToString() + "+1");
+    }
+    const Position bottom = { CHAIN_LENGTH - 1, 0 };
+    const Position above_bottom = { CHAIN_LENGTH - 2, 0 };
+    {
+        LOG_DURATION("Rewriting the bottom of a long chain"s);
+        for (int i = 0; i < CHAIN_LENGTH; ++i)
+        {
+            sheet->SetCell(bottom, "=" + above_bottom.ToString() + "*" + std::to_string(i));
+        }
+    }
+    sheet->SetCell(bottom, "=" + above_bottom.ToString() + "*2");
+    ASSERT_EQUAL(sheet->GetCell(bottom)->GetValue(), CellInterface::Value(2.0 * (CHAIN_LENGTH - 1)));
+
+    // ,      , -  
+    sheet->SetCell("B1"_pos, "=A3+A2");
+    sheet->SetCell("C1"_pos, "=B1+A3");
+
+    bool caught = false;
+    try
+    {
+        sheet->SetCell("A1"_pos, "=" + bottom.ToString());
+    }
+    catch (const CircularDependencyException&)
+    {
+        caught = true;
+    }
+    ASSERT(caught);
+    ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetText(), "1");
+
+    caught = false;
+    try
+    {
+        sheet->SetCell("A2"_pos, "=C1");
+    }
+    catch (const CircularDependencyException&)
+    {
+        caught = true;
+    }
+    ASSERT(caught);
+    ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(8.0));
+
+    //     :    
+    sheet->SetCell("A2"_pos, "7");
+    sheet->SetCell("A1"_pos, "=" + bottom.ToString());
+    ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value(2.0 * (7 + CHAIN_LENGTH - 3)));
+
+    //       :  
+    //     ,     
+    {
+        LOG_DURATION("Rewriting the head of a long chain with new references"s);
+        for (int row = 0; row < CHAIN_LENGTH; ++row)
+        {
+            sheet->SetCell("A2"_pos, "=" + Position{ row, 5 }.ToString());
+        }
+    }
+    sheet->SetCell(Position{ CHAIN_LENGTH - 1, 5 }, "5");
+    ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value(2.0 * (5 + CHAIN_LENGTH - 3)));
+}
+
+void TestDenseRegion()
+{
+    auto sheet = CreateSheet();
+    const int ROWS = 150;
+    const int COLS = 40;
+    for (int row = 0; row < ROWS; ++row)
+    {
+        for (int col = 0; col < COLS; ++col)
+        {
+            sheet->SetCell(Position{ row, col }, std::to_string(row * COLS + col));
+        }
+    }
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ ROWS, COLS }));
+    ASSERT_EQUAL(sheet->GetCell(Position{ 64, 16 })->GetValue(), CellInterface::Value(64.0 * COLS + 16));
+    ASSERT_EQUAL(sheet->GetCell(Position{ ROWS - 1, COLS - 1 })->GetText(), std::to_string(ROWS * COLS - 1));
+
+    std::ostringstream expected;
+    for (int row = 0; row < ROWS; ++row)
+    {
+        for (int col = 0; col < COLS; ++col)
+        {
+            expected << (col ? "\t" : "") << row * COLS + col;
+        }
+        expected << '\n';
+    }
+    std::ostringstream texts;
+    sheet->PrintTexts(texts);
+    ASSERT_EQUAL(texts.str(), expected.str());
+
+    for (int row = 0; row < ROWS; ++row)
+    {
+        for (int col = COLS / 2; col < COLS; ++col)
+        {
+            sheet->ClearCell(Position{ row, col });
+        }
+    }
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ ROWS, COLS / 2 }));
+    ASSERT(!sheet->GetCell(Position{ 70, COLS / 2 }));
+    ASSERT(sheet->GetCell(Position{ 70, COLS / 2 - 1 }));
+}
+
+void TestValueCache()
+{
+    auto sheet_ptr = CreateSheet();
+    Sheet& sheet = dynamic_cast<Sheet&>(*sheet_ptr);
+    sheet.SetCell("A1"_pos, "=1/0");
+    sheet.SetCell("A2"_pos, "=A1+1");
+    sheet.SetCell("B2"_pos, "=2.5*2");
+    sheet.SetCell("C2"_pos, "text");
+    sheet.SetCell("D2"_pos, "=C2");
+    const auto has_cache = [&sheet](Position pos) {
+        return dynamic_cast<const Cell*>(sheet.GetCell(pos))->HasCache();
+    };
+    ASSERT(!has_cache("A2"_pos));
+    ASSERT(has_cache("C2"_pos));
+    sheet.Recalculate();
+    for (int i = 0; i < 2; ++i)
+    {
+        ASSERT(has_cache("A2"_pos));
+        ASSERT_EQUAL(sheet.GetCell("A2"_pos)->GetValue(),
+            CellInterface::Value(FormulaError::Category::Arithmetic));
+        ASSERT_EQUAL(sheet.GetCell("B2"_pos)->GetValue(), CellInterface::Value(5.0));
+        ASSERT_EQUAL(sheet.GetCell("D2"_pos)->GetValue(),
+            CellInterface::Value(FormulaError::Category::Value));
+    }
+
+    //        
+    sheet.SetCell("B2"_pos, "=7");
+    ASSERT(!has_cache("B2"_pos));
+    ASSERT_EQUAL(sheet.GetCell("B2"_pos)->GetValue(), CellInterface::Value(7.0));
+    sheet.ClearCell("B2"_pos);
+    sheet.SetCell("B2"_pos, "=A1");
+    ASSERT_EQUAL(sheet.GetCell("B2"_pos)->GetValue(),
+        CellInterface::Value(FormulaError::Category::Arithmetic));
+    sheet.SetCell("A1"_pos, "3");
+    ASSERT_EQUAL(sheet.GetCell("A2"_pos)->GetValue(), CellInterface::Value(4.0));
+    ASSERT_EQUAL(sheet.GetCell("B2"_pos)->GetValue(), CellInterface::Value(3.0));
+}
+
+void TestPositionCodec()
+{
+    static_assert(Position::FromString("A1").row == 0 && Position::FromString("A1").col == 0);
+    static_assert(Position::FromString("XFD16384").row == Position::MAX_ROWS - 1);
+    static_assert(Position::FromString("XFD16384").col == Position::MAX_COLS - 1);
+    static_assert(!Position::FromString("XFE1").IsValid());
+    static_assert(!Position::FromString("A16385").IsValid());
+
+    char buffer[Position::MAX_STRING_LENGTH];
+    auto result = Position{ 136, 2 }.ToChars(buffer, buffer + Position::MAX_STRING_LENGTH);
+    ASSERT(result.ec == std::errc());
+    ASSERT_EQUAL(std::string_view(buffer, result.ptr - buffer), std::string_view("C137"));
+
+    //   ,    
+    buffer[0] = '#';
+    result = Position{ 136, 2 }.ToChars(buffer, buffer + 3);
+    ASSERT(result.ec == std::errc::value_too_large);
+    ASSERT_EQUAL(buffer[0], '#');
+    result = Position::NONE.ToChars(buffer, buffer + Position::MAX_STRING_LENGTH);
+    ASSERT(result.ec == std::errc::invalid_argument);
+    ASSERT(result.ptr == buffer);
+
+    //      ,   
+    ASSERT_EQUAL(Position::FromString("B007"), (Position{ 6, 1 }));
+    ASSERT(!Position::FromString("AAAAAAAA1").IsValid());
+    ASSERT(!Position::FromString("A99999999999").IsValid());
+    ASSERT(!Position::FromString("a1").IsValid());
+    ASSERT(!Position::FromString("A1 ").IsValid());
+}
+
+//    ,   
+namespace legacy_position {
+
+const int LETTERS = 26;
+const int MAX_POSITION_LENGTH = 17;
+
+std::string GetStringNumber(int number)
+{
+    int remainder = number % LETTERS;
+    number = number / LETTERS;
+    std::deque<int> d_result;
+    while (number != 0)
+    {
+        d_result.push_front(remainder);
+        remainder = (number - 1) % LETTERS;
+        number = (number - 1) / LETTERS;
+    }
+    d_result.push_front(remainder);
+    std::string result;
+    for (const int digit : d_result)
+    {
+        result.push_back(static_cast<char>(digit + 65));
+    }
+    return result;
+}
+
+std::string ToString(Position pos)
+{
+    if (!pos.IsValid())
+    {
+        return {};
+    }
+    return GetStringNumber(pos.col) + (std::to_string(pos.row + 1));
+}
+
+int ConvertStringToInt(std::string_view str)
+{
+    int result = 0;
+    int index = 0;
+    for (const char* ch = str.data() + str.size() - 1; ch > str.data(); --ch)
+    {
+        result += (*ch - 65) * pow(LETTERS, index) + (index > 0 ? LETTERS : 0);
+        ++index;
+    }
+    if (str.size() > 1)
+    {
+        result += (*str.data() - 65 + 1) * pow(LETTERS, index);
+    }
+    else
+    {
+        result = *str.data() - 65;
+    }
+    return result;
+}
+
+Position FromString(std::string_view str)
+{
+    std::regex adress("[A-Z]+\\d+"s);
+    std::string s = std::string(str.data(), str.size());
+    if (!std::regex_match(s, adress) || str.size() > MAX_POSITION_LENGTH)
+    {
+        return Position::NONE;
+    }
+    size_t delim = str.find_first_of("0123456789");
+    return { std::stoi(std::string(str.substr(delim))) - 1, ConvertStringToInt(str.substr(0, delim)) };
+}
+
+}  // namespace legacy_position
+
+void BenchmarkPositionCodec()
+{
+    const int COUNT = 5000;
+    std::vector<Position> positions;
+    positions.reserve(COUNT);
+    for (int i = 0; i < COUNT; ++i)
+    {
+        positions.push_back(Position{ (i * 7919) % Position::MAX_ROWS, (i * 104729) % Position::MAX_COLS });
+    }
+    std::vector<std::string> texts;
+    texts.reserve(COUNT);
+    {
+        LOG_DURATION("Position::ToString, legacy"s);
+        for (const Position pos : positions)
+        {
+            texts.push_back(legacy_position::ToString(pos));
+        }
+    }
+    size_t total_length = 0;
+    {
+        LOG_DURATION("Position::ToChars"s);
+        char buffer[Position::MAX_STRING_LENGTH];
+        for (const Position pos : positions)
+        {
+            total_length += Position::MAX_STRING_LENGTH
+                - (buffer + Position::MAX_STRING_LENGTH - pos.ToChars(buffer, buffer + Position::MAX_STRING_LENGTH).ptr);
+        }
+    }
+    std::vector<Position> legacy_parsed;
+    legacy_parsed.reserve(COUNT);
+    {
+        LOG_DURATION("Position::FromString, legacy"s);
+        for (const std::string& text : texts)
+        {
+            legacy_parsed.push_back(legacy_position::FromString(text));
+        }
+    }
+    std::vector<Position> parsed;
+    parsed.reserve(COUNT);
+    {
+        LOG_DURATION("Position::FromString"s);
+        for (const std::string& text : texts)
+        {
+            parsed.push_back(Position::FromString(text));
+        }
+    }
+
+    size_t legacy_length = 0;
+    for (int i = 0; i < COUNT; ++i)
+    {
+        ASSERT_EQUAL(positions[i].ToString(), texts[i]);
+        ASSERT_EQUAL(parsed[i], legacy_parsed[i]);
+        ASSERT_EQUAL(parsed[i], positions[i]);
+        legacy_length += texts[i].size();
+    }
+    ASSERT_EQUAL(total_length, legacy_length);
+}
+
+std::string PrintAST(std::string_view formula)
+{
+    std::ostringstream out;
+    ParseFormulaAST(formula).Print(out);
+    return out.str();
+}
+
+//   : "ParsingError", "FormulaException"   
+template <typename Parse>
+std::string GetThrownParseError(Parse&& parse)
+{
+    try
+    {
+        parse();
+    }
+    catch (const ParsingError&)
+    {
+        return "ParsingError";
+    }
+    catch (const FormulaException&)
+    {
+        return "FormulaException";
+    }
+    return {};
+}
+
+std::string GetParseErrorKind(std::string_view formula)
+{
+    return GetThrownParseError([formula]() { ParseFormulaAST(formula); });
+}
+
+void TestFormulaParser()
+{
+    ASSERT_EQUAL(PrintAST("1+2*3"), "(+ 1 (* 2 3))");
+    ASSERT_EQUAL(PrintAST("1-2-3"), "(- (- 1 2) 3)");
+    ASSERT_EQUAL(PrintAST("8/4/2*A1"), "(* (/ (/ 8 4) 2) A1)");
+    ASSERT_EQUAL(PrintAST("-1*2"), "(* (- 1) 2)");
+    ASSERT_EQUAL(PrintAST("--A1"), "(- (- A1))");
+    ASSERT_EQUAL(PrintAST("1*-2+ +3"), "(+ (* 1 (- 2)) (+ 3))");
+    ASSERT_EQUAL(PrintAST("(1+2)*.5e1"), "(* (+ 1 2) 5)");
+    ASSERT_EQUAL(PrintAST(" 2 /\t( B2 )\r\n"), "(/ 2 B2)");
+    ASSERT_EQUAL(PrintAST("1.5E-1-ZZ10"), "(- 0.15 ZZ10)");
+
+    std::ostringstream cells;
+    ParseFormulaAST("B2+A1*(B2-A10)").PrintCells(cells);
+    ASSERT_EQUAL(cells.str(), "A1 B2 B2 A10 ");
+
+    for (const char* formula : { "", "1+", "(1", "1)", "()", "A", "1.", "1e", "1e+", "a1", "1 2",
+        "A1B", "1..2", "+", "2**3", "1+2=", "A1 B1" })
+    {
+        ASSERT_EQUAL(GetParseErrorKind(formula), "ParsingError");
+    }
+    ASSERT_EQUAL(GetParseErrorKind("ZZZZ1"), "FormulaException");
+    ASSERT_EQUAL(GetParseErrorKind("1+A16385"), "FormulaException");
+    //     ,     ANTLR
+    ASSERT_EQUAL(GetParseErrorKind("ZZZZ1+"), "ParsingError");
+    //        
+    ASSERT_EQUAL(GetParseErrorKind("1e999+ZZZZ1"), "ParsingError");
+    ASSERT_EQUAL(GetParseErrorKind("ZZZZ1+1e999"), "FormulaException");
+
+    const int COUNT = 20000;
+    std::vector<std::string> formulas;
+    formulas.reserve(COUNT);
+    for (int i = 0; i < COUNT; ++i)
+    {
+        formulas.push_back(Position{ i % 1000, i % 30 }.ToString() + "*1.5+(" + std::to_string(i)
+            + "-" + Position{ i % 700, 3 }.ToString() + ")/-2");
+    }
+    {
+        LOG_DURATION("Parsing formulas"s);
+        for (const std::string& formula : formulas)
+        {
+            ParseFormulaAST(formula);
+        }
+    }
+
+#ifdef SPREADSHEET_WITH_ANTLR
+    const auto print_antlr = [](const std::string& formula) {
+        std::istringstream in(formula);
+        std::ostringstream out;
+        ParseFormulaASTWithAntlr(in).Print(out);
+        return out.str();
+    };
+    std::vector<std::string> corpus = { "1+2*3", "-1*2", "--A1", "1*-2+ +3", "(1+2)*.5e1", "1.5E-1-ZZ10",
+        "((A1))/(B2-3e+2)", "1-2-3", "8/4/2*A1", "", "1+", "(1", "A", "1.", "1e", "a1", "1 2", "A1B", "1..2",
+        "ZZZZ1", "ZZZZ1+", "1e999+ZZZZ1", "ZZZZ1+1e999" };
+    corpus.insert(corpus.end(), formulas.begin(), formulas.begin() + 100);
+    for (const std::string& formula : corpus)
+    {
+        const std::string native_error = GetParseErrorKind(formula);
+        const std::string antlr_error = GetThrownParseError([&]() { print_antlr(formula); });
+        ASSERT_EQUAL(native_error.empty(), antlr_error.empty());
+        if (native_error.empty())
+        {
+            ASSERT_EQUAL(PrintAST(formula), print_antlr(formula));
+        }
+    }
+#endif
+}
+
+void TestFormulaEvaluation()
+{
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "2");
+    sheet->SetCell("A2"_pos, "text");
+    sheet->SetCell("A3"_pos, "=1/0");
+    const auto evaluate = [&sheet](std::string expression) {
+        return std::visit([](const auto& value) { return CellInterface::Value(value); },
+            ParseFormula(std::move(expression))->Evaluate(*sheet));
+    };
+    ASSERT_EQUAL(evaluate("-A1*3+ +B1-(A1-5)/-2"), CellInterface::Value(-7.5));
+    ASSERT_EQUAL(evaluate("A1*A1*A1*A1/A1/A1"), CellInterface::Value(4.0));
+    ASSERT_EQUAL(evaluate("1e308*10-1e308*10"),
+        CellInterface::Value(FormulaError::Category::Arithmetic));
+    ASSERT_EQUAL(evaluate("0/0"), CellInterface::Value(FormulaError::Category::Arithmetic));
+    //     ,  
+    ASSERT_EQUAL(evaluate("A2+A3"), CellInterface::Value(FormulaError::Category::Value));
+    ASSERT_EQUAL(evaluate("A3+A2"), CellInterface::Value(FormulaError::Category::Arithmetic));
+    ASSERT_EQUAL(evaluate("1/0+A2"), CellInterface::Value(FormulaError::Category::Arithmetic));
+
+    //      
+    std::string nested = "1";
+    std::string chain = "A1";
+    for (int i = 0; i < 200; ++i)
+    {
+        nested = "(" + nested + "+1)*1";
+        chain += "+A1";
+    }
+    ASSERT_EQUAL(evaluate(nested), CellInterface::Value(201.0));
+    ASSERT_EQUAL(evaluate(chain), CellInterface::Value(402.0));
+
+    //     ,     
+    sheet->SetCell("C1"_pos, "=2");
+    std::vector<std::unique_ptr<FormulaInterface>> formulas;
+    for (int i = 0; i < 100; ++i)
+    {
+        formulas.push_back(ParseFormula("(C1*1.5+" + std::to_string(i) + ")/(2-C1*3)-(-C1+4)*0.25+C1*C1*"
+            + std::to_string(i) + "-((1+2)*(3+4)-(5-6)/(7+8))"));
+    }
+    double total = 0;
+    {
+        LOG_DURATION("Evaluating arithmetic formulas"s);
+        for (int round = 0; round < 2000; ++round)
+        {
+            for (const auto& formula : formulas)
+            {
+                total += std::get<double>(formula->Evaluate(*sheet));
+            }
+        }
+    }
+    ASSERT(std::isfinite(total));
+}
+
+void TestFormulaArena()
+{
+    Arena arena(64);
+    char* text = static_cast<char*>(arena.Allocate(3, 1));
+    double* number = arena.Create<double>(2.5);
+    ASSERT_EQUAL(reinterpret_cast<std::uintptr_t>(number) % alignof(double), 0u);
+    ASSERT(reinterpret_cast<std::uintptr_t>(text + 3) <= reinterpret_cast<std::uintptr_t>(number));
+    ASSERT_EQUAL(arena.GetBlockCount(), 1u);
+    //       ,    
+    Span<Position> cells = arena.AllocateArray<Position>(100);
+    ASSERT_EQUAL(cells.size(), 100u);
+    ASSERT_EQUAL(cells[99], (Position{ 0, 0 }));
+    ASSERT_EQUAL(arena.GetBlockCount(), 2u);
+    ASSERT_EQUAL(*number, 2.5);
+    Arena moved = std::move(arena);
+    ASSERT_EQUAL(moved.GetBlockCount(), 2u);
+    ASSERT_EQUAL(*number, 2.5);
+
+    //        
+    std::string nested = "A1";
+    std::string chain = "1";
+    std::string unary = "1";
+    for (int i = 0; i < 300; ++i)
+    {
+        nested = "(" + nested + "+1)*B2";
+        chain += "+1";
+        unary = "-" + unary;
+    }
+    for (const std::string& formula : { "1"s, "A1+B1"s, "-(1+ZZ1)*.5e1/(C3-D4)"s, nested, chain, unary })
+    {
+        const FormulaAST ast = ParseFormulaAST(formula);
+        ASSERT_EQUAL(ast.GetArena().GetBlockCount(), 1u);
+    }
+    ASSERT_EQUAL(ParseFormulaAST(nested).GetCells().size(), 301u);
+
+    //     ,    
+    // ,        
+    const size_t small_size = ParseFormulaAST("A1+5").GetArena().GetUsedSize();
+    ASSERT(small_size <= 16 * sizeof(void*));
+    ParseFormulaAST(nested);
+    ASSERT_EQUAL(ParseFormulaAST("A1+5").GetArena().GetUsedSize(), small_size);
+    std::string serialized;
+    ParseFormulaAST(nested).Serialize(serialized);
+    ASSERT_EQUAL(DeserializeFormulaAST(serialized).GetArena().GetBlockCount(), 1u);
+}
+
+void TestSharedFormulas()
+{
+    auto sheet_ptr = CreateSheet();
+    Sheet& sheet = dynamic_cast<Sheet&>(*sheet_ptr);
+    const int ROWS = 10000;
+    for (int row = 0; row < ROWS; ++row)
+    {
+        sheet.SetCell(Position{ row, 0 }, std::to_string(row));
+        sheet.SetCell(Position{ row, 1 }, "2");
+        sheet.SetCell(Position{ row, 2 }, "1");
+    }
+    {
+        LOG_DURATION("Filling a formula down"s);
+        for (int row = 0; row < ROWS; ++row)
+        {
+            const std::string number = std::to_string(row + 1);
+            sheet.SetCell(Position{ row, 3 }, "=A" + number + "*B" + number + "+C" + number);
+        }
+    }
+    ASSERT_EQUAL(sheet.GetSharedFormulaCount(), 1u);
+    ASSERT_EQUAL(sheet.GetCell("D5"_pos)->GetText(), "=A5*B5+C5");
+    ASSERT_EQUAL(sheet.GetCell("D5"_pos)->GetReferencedCells(), (std::vector{ "A5"_pos, "B5"_pos, "C5"_pos }));
+    ASSERT_EQUAL(sheet.GetCell("D5"_pos)->GetValue(), CellInterface::Value(9.0));
+    ASSERT_EQUAL(sheet.GetCell(Position{ ROWS - 1, 3 })->GetValue(), CellInterface::Value(2.0 * ROWS - 1));
+
+    sheet.SetCell("A5"_pos, "10");
+    ASSERT_EQUAL(sheet.GetCell("D5"_pos)->GetValue(), CellInterface::Value(21.0));
+    ASSERT_EQUAL(sheet.GetCell("D6"_pos)->GetValue(), CellInterface::Value(11.0));
+
+    //     ,    
+    sheet.SetCell("E3"_pos, "=B4 - A4");
+    sheet.SetCell("E2"_pos, "= B3-A3");
+    sheet.SetCell("E1"_pos, "=B2 -A2");
+    ASSERT_EQUAL(sheet.GetSharedFormulaCount(), 2u);
+    ASSERT_EQUAL(sheet.GetCell("E2"_pos)->GetText(), "=B3-A3");
+    ASSERT_EQUAL(sheet.GetCell("E1"_pos)->GetValue(), CellInterface::Value(1.0));
+    ASSERT_EQUAL(sheet.GetCell("E3"_pos)->GetValue(), CellInterface::Value(-1.0));
+
+    //      -   
+    sheet.SetCell("F1"_pos, "=A1");
+    sheet.SetCell("F2"_pos, "=A1");
+    ASSERT_EQUAL(sheet.GetSharedFormulaCount(), 4u);
+    ASSERT_EQUAL(sheet.GetCell("F2"_pos)->GetText(), "=A1");
+
+    bool caught = false;
+    try
+    {
+        sheet.SetCell("G1"_pos, "=G2*B2");
+        sheet.SetCell("G2"_pos, "=G3*B3");
+        sheet.SetCell("G3"_pos, "=G1*B1");
+    }
+    catch (const CircularDependencyException&)
+    {
+        caught = true;
+    }
+    ASSERT(caught);
+    ASSERT_EQUAL(sheet.GetCell("G3"_pos)->GetText(), "");
+
+    for (int row = 0; row < ROWS; ++row)
+    {
+        sheet.ClearCell(Position{ row, 3 });
+    }
+    ASSERT_EQUAL(sheet.GetSharedFormulaCount(), 4u);
+    sheet.SetCell("E1"_pos, "1");
+    sheet.SetCell("E2"_pos, "1");
+    sheet.SetCell("E3"_pos, "1");
+    ASSERT_EQUAL(sheet.GetSharedFormulaCount(), 3u);
+}
+
+void TestRangeFunctions()
+{
+    ASSERT_EQUAL(PrintAST("SUM(A1:B2, 3)*2"), "(* (SUM A1:B2 3) 2)");
+    ASSERT_EQUAL(PrintAST("MAX(B2:A1)"), "(MAX A1:B2)");
+    ASSERT_EQUAL(PrintAST("-COUNT(A1, A2 : A3)"), "(- (COUNT A1 A2:A3))");
+    for (const char* formula : { "SUM()", "SUM(A1:)", "SUM(:A1)", "SUM(A1:B2+1)", "A1:B2", "SUM A1",
+        "SUM(1,)", "SUMM(1)", "sum(1)", "SUM(1 2)", "SUM((A1):B2)", "SUM((A1:B2))" })
+    {
+        ASSERT_EQUAL(GetParseErrorKind(formula), "ParsingError");
+    }
+    ASSERT_EQUAL(GetParseErrorKind("SUM(A1:ZZZZ1)"), "FormulaException");
+    // SUM1 - ,   
+    ASSERT_EQUAL(PrintAST("SUM1+1"), "(+ SUM1 1)");
+
+    auto sheet_ptr = CreateSheet();
+    Sheet& sheet = dynamic_cast<Sheet&>(*sheet_ptr);
+    sheet.SetCell("A1"_pos, "1");
+    sheet.SetCell("A2"_pos, "=A1*2");
+    sheet.SetCell("A3"_pos, "text");
+    sheet.SetCell("A5"_pos, "'4");
+    sheet.SetCell("B1"_pos, "-3");
+    sheet.SetCell("B4"_pos, "=SUM(A1:A5)+MIN(A1:B3)");
+    ASSERT_EQUAL(sheet.GetCell("B4"_pos)->GetText(), "=SUM(A1:A5)+MIN(A1:B3)");
+    ASSERT_EQUAL(sheet.GetCell("B4"_pos)->GetValue(), CellInterface::Value(7.0 - 3.0));
+    //     
+    ASSERT(sheet.GetCell("B4"_pos)->GetReferencedCells().empty());
+    ASSERT_EQUAL(dynamic_cast<const Cell*>(sheet.GetCell("B4"_pos))->GetReferencedRanges(),
+        (std::vector{ CellRange{ "A1"_pos, "A5"_pos }, CellRange{ "A1"_pos, "B3"_pos } }));
+
+    sheet.SetCell("C1"_pos, "=COUNT(A1:B5)");
+    sheet.SetCell("C2"_pos, "=AVERAGE(A1:A5,5)");
+    sheet.SetCell("C3"_pos, "=MAX(D1:D100)+MIN(D1:D100)");
+    sheet.SetCell("C4"_pos, "=AVERAGE(D1:D100)");
+    sheet.SetCell("C5"_pos, "=SUM(A1:A2,SUM(B1:B1,10),A2:A2)");
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(5.0));
+    ASSERT_EQUAL(sheet.GetCell("C2"_pos)->GetValue(), CellInterface::Value(3.0));
+    ASSERT_EQUAL(sheet.GetCell("C3"_pos)->GetValue(), CellInterface::Value(0.0));
+    ASSERT_EQUAL(sheet.GetCell("C4"_pos)->GetValue(), CellInterface::Value(FormulaError::Category::Arithmetic));
+    ASSERT_EQUAL(sheet.GetCell("C5"_pos)->GetValue(), CellInterface::Value(12.0));
+
+    //       ,     :
+    //     
+    for (const char* function : { "SUM", "AVERAGE", "MIN", "MAX", "COUNT" })
+    {
+        for (const char* cell : { "F1", "A3", "A5", "B1" })
+        {
+            const std::string name = function;
+            sheet.SetCell("G1"_pos, "=" + name + "(" + cell + ")");
+            sheet.SetCell("G2"_pos, "=" + name + "(" + cell + ":" + cell + ")");
+            ASSERT_EQUAL(sheet.GetCell("G1"_pos)->GetValue(), sheet.GetCell("G2"_pos)->GetValue());
+        }
+    }
+    sheet.SetCell("G1"_pos, "=COUNT(F1)+COUNT(A3)*10+COUNT(B1)*100+SUM(A3,B1)");
+    ASSERT_EQUAL(sheet.GetCell("G1"_pos)->GetValue(), CellInterface::Value(97.0));
+    //        
+    ASSERT_EQUAL(sheet.GetCell("G1"_pos)->GetReferencedCells(), (std::vector{ "B1"_pos, "F1"_pos, "A3"_pos }));
+    ASSERT(sheet.GetCell("F1"_pos));
+    sheet.SetCell("F1"_pos, "2");
+    ASSERT_EQUAL(sheet.GetCell("G1"_pos)->GetValue(), CellInterface::Value(98.0));
+    sheet.ClearCell("G1"_pos);
+    sheet.ClearCell("G2"_pos);
+    sheet.ClearCell("F1"_pos);
+
+    //       
+    sheet.SetCell("A4"_pos, "=1/0");
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(FormulaError::Category::Arithmetic));
+    sheet.SetCell("A4"_pos, "10");
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(6.0));
+    ASSERT_EQUAL(sheet.GetCell("B4"_pos)->GetValue(), CellInterface::Value(17.0 - 3.0));
+
+    bool caught = false;
+    try
+    {
+        sheet.SetCell("D1"_pos, "=SUM(C1:C5)");
+    }
+    catch (const CircularDependencyException&)
+    {
+        caught = true;
+    }
+    ASSERT(caught);
+
+    //       
+    const size_t shared_count = sheet.GetSharedFormulaCount();
+    for (int row = 10; row < 20; ++row)
+    {
+        const std::string number = std::to_string(row + 1);
+        sheet.SetCell(Position{ row, 0 }, number);
+        sheet.SetCell(Position{ row, 1 }, "=SUM(A" + std::to_string(row) + ":A" + number + ")");
+    }
+    ASSERT_EQUAL(sheet.GetSharedFormulaCount(), shared_count + 1);
+    ASSERT_EQUAL(sheet.GetCell("B20"_pos)->GetText(), "=SUM(A19:A20)");
+    ASSERT_EQUAL(sheet.GetCell("B20"_pos)->GetValue(), CellInterface::Value(39.0));
+
+    //      
+    const int ROWS = 2000;
+    std::string chain = "=A1";
+    for (int row = 0; row < ROWS; ++row)
+    {
+        sheet.SetCell(Position{ row, 4 }, "=" + std::to_string(row % 7));
+        if (row > 0)
+        {
+            chain += "+E" + std::to_string(row + 1);
+        }
+    }
+    chain[1] = 'E';
+    sheet.SetCell("F1"_pos, chain);
+    sheet.SetCell("G1"_pos, "=SUM(E1:E" + std::to_string(ROWS) + ")");
+    const auto chain_formula = ParseFormula(chain.substr(1));
+    const auto range_formula = ParseFormula("SUM(E1:E" + std::to_string(ROWS) + ")");
+    double chain_total = 0;
+    double range_total = 0;
+    {
+        LOG_DURATION("Summing cells one by one"s);
+        for (int round = 0; round < 1000; ++round)
+        {
+            chain_total += std::get<double>(chain_formula->Evaluate(sheet));
+        }
+    }
+    {
+        LOG_DURATION("Summing a range"s);
+        for (int round = 0; round < 1000; ++round)
+        {
+            range_total += std::get<double>(range_formula->Evaluate(sheet));
+        }
+    }
+    ASSERT_EQUAL(chain_total, range_total);
+    ASSERT_EQUAL(sheet.GetCell("F1"_pos)->GetValue(), sheet.GetCell("G1"_pos)->GetValue());
+}
+
+void TestRangeDependencies()
+{
+    auto sheet_ptr = CreateSheet();
+    Sheet& sheet = dynamic_cast<Sheet&>(*sheet_ptr);
+
+    //        
+    sheet.SetCell("A1"_pos, "=SUM(B1:XFD16384)");
+    sheet.SetCell("C3"_pos, "=COUNT(D2:Z100)");
+    sheet.SetCell("ZZ9000"_pos, "5");
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(5.0));
+    sheet.SetCell("D2"_pos, "2");
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(8.0));
+    sheet.ClearCell("ZZ9000"_pos);
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(3.0));
+    ASSERT_EQUAL(sheet.GetCell("C3"_pos)->GetValue(), CellInterface::Value(1.0));
+
+    //          
+    const auto is_circular = [&sheet](Position pos, std::string text) {
+        try
+        {
+            sheet.SetCell(pos, std::move(text));
+        }
+        catch (const CircularDependencyException&)
+        {
+            return true;
+        }
+        return false;
+    };
+    ASSERT(is_circular("B5"_pos, "=A1"));
+    ASSERT(!is_circular("A2"_pos, "=C3*2"));
+    ASSERT(is_circular("D4"_pos, "=A2"));
+    ASSERT(is_circular("E5"_pos, "=MAX(A2:A2)"));
+    ASSERT(is_circular("A1"_pos, "=SUM(A1:A2)"));
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetText(), "=SUM(B1:XFD16384)");
+    ASSERT(!sheet.GetCell("D4"_pos));
+    ASSERT_EQUAL(sheet.GetCell("A2"_pos)->GetValue(), CellInterface::Value(2.0));
+    ASSERT(!sheet.GetCell("B5"_pos));
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(3.0));
+
+    sheet.ClearCell("A1"_pos);
+    sheet.ClearCell("C3"_pos);
+    sheet.ClearCell("A2"_pos);
+    sheet.ClearCell("D2"_pos);
+    ASSERT_EQUAL(sheet.GetRangeReferenceCount(), 0u);
+
+    //       : 
+    //    
+    const int ROWS = 300;
+    for (int row = ROWS - 1; row > 0; --row)
+    {
+        sheet.SetCell(Position{ row, 1 }, "=MAX(B1:B" + std::to_string(row) + ")+1");
+    }
+    sheet.SetCell("B1"_pos, "1");
+    ASSERT_EQUAL(sheet.GetRangeReferenceCount(), static_cast<size_t>(ROWS - 1));
+    sheet.SetRecalcThreads(4);
+    sheet.Recalculate();
+    for (int row = 0; row < ROWS; ++row)
+    {
+        ASSERT_EQUAL(sheet.GetCell(Position{ row, 1 })->GetValue(), CellInterface::Value(row + 1.0));
+    }
+    sheet.SetCell("B1"_pos, "=10");
+    sheet.Recalculate();
+    ASSERT_EQUAL(sheet.GetCell(Position{ ROWS - 1, 1 })->GetValue(), CellInterface::Value(ROWS + 9.0));
+
+    //   
+    {
+        LOG_DURATION("Filling running totals down"s);
+        for (int row = 0; row < 10000; ++row)
+        {
+            const std::string number = std::to_string(row + 1);
+            sheet.SetCell(Position{ row, 3 }, number);
+            sheet.SetCell(Position{ row, 4 }, "=SUM(D1:D" + number + ")");
+        }
+        ASSERT_EQUAL(sheet.GetCell("E10000"_pos)->GetValue(), CellInterface::Value(50005000.0));
+    }
+    //   :     
+    //      
+    {
+        LOG_DURATION("Rewriting running totals"s);
+        for (int row = 0; row < 10000; ++row)
+        {
+            sheet.SetCell(Position{ row, 4 }, "=SUM(D1:D" + std::to_string(row + 1) + ")*2");
+        }
+    }
+    //    D     
+    {
+        LOG_DURATION("Editing under running totals"s);
+        for (int row = 0; row < 10000; row += 100)
+        {
+            sheet.SetCell(Position{ row, 3 }, std::to_string(row + 2));
+        }
+        ASSERT_EQUAL(sheet.GetCell("E10000"_pos)->GetValue(), CellInterface::Value(2 * (50005000.0 + 100)));
+    }
+    ASSERT_EQUAL(sheet.GetRangeReferenceCount(), static_cast<size_t>(ROWS - 1 + 10000));
+}
+
+void TestBatchEdit()
+{
+    auto sheet_ptr = CreateSheet();
+    Sheet& sheet = dynamic_cast<Sheet&>(*sheet_ptr);
+
+    //    ,     
+    sheet.SetCells({ { "A1"_pos, "=B1+1" }, { "B1"_pos, "=C1*2" }, { "C1"_pos, "3" }, { "C1"_pos, "5" },
+        { "E1"_pos, "=F1" }, { "D2"_pos, "text" } });
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(11.0));
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetText(), "5");
+    ASSERT_EQUAL(sheet.GetCell("F1"_pos)->GetText(), "");
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{ 2, 5 }));
+
+    //      
+    const auto print_texts = [&sheet]() {
+        std::ostringstream texts;
+        sheet.PrintTexts(texts);
+        return texts.str();
+    };
+    std::string texts = print_texts();
+    const auto rejects = [&](std::vector<CellEdit> edits, auto exception_tag) {
+        try
+        {
+            sheet.SetCells(std::move(edits));
+        }
+        catch (const decltype(exception_tag)&)
+        {
+            return print_texts() == texts && !sheet.GetCell("G1"_pos);
+        }
+        return false;
+    };
+    ASSERT(rejects({ { "G1"_pos, "1" }, { "C1"_pos, "=A1" } }, CircularDependencyException("")));
+    ASSERT(rejects({ { "G1"_pos, "=H1" }, { "H1"_pos, "=G1" } }, CircularDependencyException("")));
+    ASSERT(rejects({ { "G1"_pos, "=G1" } }, CircularDependencyException("")));
+    ASSERT(rejects({ { "G1"_pos, "=SUM(A1:G1)" } }, CircularDependencyException("")));
+    ASSERT(rejects({ { "G1"_pos, "=1" }, { "H1"_pos, "=)" } }, FormulaException("")));
+    ASSERT(rejects({ { "G1"_pos, "1" }, { Position{ -1, 0 }, "1" } }, InvalidPositionException("")));
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(11.0));
+    sheet.SetCell("C1"_pos, "1");
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(3.0));
+
+    // ,   :     
+    //      
+    const int CHAIN_LENGTH = 1000;
+    const auto chain_edits = [CHAIN_LENGTH](int col) {
+        std::vector<CellEdit> edits;
+        for (int row = CHAIN_LENGTH - 1; row > 0; --row)
+        {
+            edits.push_back({ Position{ row, col }, "=" + Position{ row - 1, col }.ToString() + "+1" });
+        }
+        edits.push_back({ Position{ 0, col }, "1" });
+        return edits;
+    };
+    {
+        LOG_DURATION("Loading a chain cell by cell"s);
+        for (CellEdit& edit : chain_edits(8))
+        {
+            sheet.SetCell(edit.pos, std::move(edit.text));
+        }
+    }
+    {
+        LOG_DURATION("Loading a chain in one batch"s);
+        sheet.SetCells(chain_edits(9));
+    }
+    const Position bottom = { CHAIN_LENGTH - 1, 9 };
+    ASSERT_EQUAL(sheet.GetCell(bottom)->GetValue(), CellInterface::Value(1.0 * CHAIN_LENGTH));
+    ASSERT_EQUAL(sheet.GetCell(Position{ CHAIN_LENGTH - 1, 8 })->GetValue(), CellInterface::Value(1.0 * CHAIN_LENGTH));
+
+    //     :         
+    sheet.SetCells({ { "J1"_pos, "=" + bottom.ToString() }, { "J6"_pos, "=7" } });
+    ASSERT_EQUAL(sheet.GetCell("J1"_pos)->GetValue(), CellInterface::Value(CHAIN_LENGTH + 1.0));
+    texts = print_texts();
+    ASSERT(rejects({ { "G1"_pos, "=5" }, { "J6"_pos, "=J5+1" } }, CircularDependencyException("")));
+    ASSERT_EQUAL(sheet.GetCell("J6"_pos)->GetText(), "=7");
+    sheet.SetCells({ { "J6"_pos, "=J5+1" }, { "J1"_pos, "1" } });
+    ASSERT_EQUAL(sheet.GetCell(bottom)->GetValue(), CellInterface::Value(1.0 * CHAIN_LENGTH));
+}
+
+void TestImport()
+{
+    const auto print = [](const Sheet& sheet, bool texts) {
+        std::ostringstream out;
+        if (texts)
+        {
+            sheet.PrintTexts(out);
+        }
+        else
+        {
+            sheet.PrintValues(out);
+        }
+        return out.str();
+    };
+
+    //  PrintTexts      ,   
+    //  ,      
+    Sheet source;
+    source.SetCell("A1"_pos, "=B2*2");
+    source.SetCell("B2"_pos, "=SUM(C1:C3)");
+    source.SetCell("C1"_pos, "3.5");
+    source.SetCell("C3"_pos, "'=text");
+    source.SetCell("D1"_pos, "two words");
+    source.SetCell("F4"_pos, "=C1/0");
+    source.SetCell("A6"_pos, "=Z1");
+    const std::string texts = print(source, true);
+    for (const size_t chunk_size : { 1, 7, 1000 })
+    {
+        for (const size_t thread_count : { 1, 3 })
+        {
+            Sheet sheet;
+            std::istringstream input(texts);
+            ImportOptions options;
+            options.chunk_size = chunk_size;
+            options.thread_count = thread_count;
+            ASSERT_EQUAL(ImportDelimited(input, sheet, options), source.GetPrintableSize());
+            ASSERT_EQUAL(print(sheet, true), texts);
+            ASSERT_EQUAL(print(sheet, false), print(source, false));
+        }
+    }
+
+    // CSV:   ,   Windows,    
+    {
+        Sheet sheet;
+        std::istringstream input("1,\"a,b\",\"say \"\"hi\"\"\"\r\n\"two\nlines\",,=A1+1\r\n,last");
+        ImportOptions options;
+        options.delimiter = ',';
+        options.quote = '"';
+        options.chunk_size = 4;
+        options.thread_count = 2;
+        ASSERT_EQUAL(ImportDelimited(input, sheet, options), (Size{ 3, 3 }));
+        ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetText(), "a,b");
+        ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetText(), "say \"hi\"");
+        ASSERT_EQUAL(sheet.GetCell("A2"_pos)->GetText(), "two\nlines");
+        ASSERT(!sheet.GetCell("B2"_pos));
+        ASSERT_EQUAL(sheet.GetCell("C2"_pos)->GetValue(), CellInterface::Value(2.0));
+        ASSERT_EQUAL(sheet.GetCell("B3"_pos)->GetText(), "last");
+    }
+
+    //      -        
+    for (const size_t thread_count : { 1, 2 })
+    {
+        Sheet sheet;
+        std::istringstream input("12\"\n\"x\ny\"\nz\n\"a\"\"\nb\"q\"\"\n");
+        ImportOptions options;
+        options.delimiter = ',';
+        options.quote = '"';
+        options.thread_count = thread_count;
+        ASSERT_EQUAL(ImportDelimited(input, sheet, options), (Size{ 4, 1 }));
+        ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetText(), "12\"");
+        ASSERT_EQUAL(sheet.GetCell("A2"_pos)->GetText(), "x\ny");
+        ASSERT_EQUAL(sheet.GetCell("A3"_pos)->GetText(), "z");
+        ASSERT_EQUAL(sheet.GetCell("A4"_pos)->GetText(), "a\"\nbq\"\"");
+    }
+
+    //     
+    {
+        Sheet sheet;
+        std::istringstream input("=B1\t=A1\n");
+        bool caught = false;
+        try
+        {
+            ImportDelimited(input, sheet);
+        }
+        catch (const CircularDependencyException&)
+        {
+            caught = true;
+        }
+        ASSERT(caught);
+        ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{ 0, 0 }));
+    }
+
+    //    
+    const int ROWS = 16000;
+    std::string feed;
+    for (int row = 1; row <= ROWS; ++row)
+    {
+        const std::string number = std::to_string(row);
+        feed += number + "\ttext " + number + "\t=A" + number + "*2\t=C" + number + "+A" + number + "\n";
+    }
+    Sheet sheet;
+    {
+        LOG_DURATION("Importing "s + std::to_string(ROWS) + " rows"s);
+        std::istringstream input(feed);
+        ImportOptions options;
+        options.chunk_size = 1 << 16;
+        options.thread_count = 4;
+        ASSERT_EQUAL(ImportDelimited(input, sheet, options), (Size{ ROWS, 4 }));
+    }
+    ASSERT_EQUAL(sheet.GetCell(Position{ ROWS - 1, 3 })->GetValue(), CellInterface::Value(3.0 * ROWS));
+    ASSERT_EQUAL(sheet.GetSharedFormulaCount(), 2u);
+    //        
+    ASSERT_EQUAL(sheet.GetRecalcThreads(), 1u);
+}
+
+//       ,     
+//  
+std::string PrintCellByCell(const SheetInterface& sheet, bool texts, std::ios_base& (*format)(std::ios_base&) = nullptr,
+    int precision = 6)
+{
+    std::ostringstream out;
+    if (format)
+    {
+        out << format;
+    }
+    out.precision(precision);
+    const Size size = sheet.GetPrintableSize();
+    for (int row = 0; row < size.rows; ++row)
+    {
+        for (int col = 0; col < size.cols; ++col)
+        {
+            if (col > 0)
+            {
+                out << '\t';
+            }
+            const CellInterface* cell = sheet.GetCell(Position{ row, col });
+            if (!cell)
+            {
+                continue;
+            }
+            if (texts)
+            {
+                out << cell->GetText();
+            }
+            else
+            {
+                std::visit([&out](const auto& value) { out << value; }, cell->GetValue());
+            }
+        }
+        out << '\n';
+    }
+    return out.str();
+}
+
+void TestPrintFormatting()
+{
+    const auto print = [](const SheetInterface& sheet, bool texts, std::ios_base& (*format)(std::ios_base&) = nullptr,
+        int precision = 6) {
+        std::ostringstream out;
+        if (format)
+        {
+            out << format;
+        }
+        out.precision(precision);
+        if (texts)
+        {
+            sheet.PrintTexts(out);
+        }
+        else
+        {
+            sheet.PrintValues(out);
+        }
+        return out.str();
+    };
+
+    auto sheet = CreateSheet();
+    const std::vector<std::string> formulas = { "=1/3", "=-2/7", "=0.1+0.2", "=123456789*10", "=1000000",
+        "=999999.5", "=0.00001234", "=1/0", "=0", "=-0", "=100000", "=2.5e-12*1", "=1e300*1e300" };
+    for (size_t i = 0; i < formulas.size(); ++i)
+    {
+        sheet->SetCell(Position{ static_cast<int>(i), static_cast<int>(i % 3) }, formulas[i]);
+    }
+    sheet->SetCell("E20"_pos, "'=escaped");
+    sheet->SetCell("Z3"_pos, "text with spaces");
+    sheet->SetCell(Position{ 100, 40 }, "=A1*3");
+    for (const bool texts : { false, true })
+    {
+        ASSERT_EQUAL(print(*sheet, texts), PrintCellByCell(*sheet, texts));
+        ASSERT_EQUAL(print(*sheet, texts, std::fixed, 2), PrintCellByCell(*sheet, texts, std::fixed, 2));
+        ASSERT_EQUAL(print(*sheet, texts, nullptr, 12), PrintCellByCell(*sheet, texts, nullptr, 12));
+        ASSERT_EQUAL(print(*sheet, texts, std::scientific, 3), PrintCellByCell(*sheet, texts, std::scientific, 3));
+    }
+    ASSERT_EQUAL(print(*CreateSheet(), false), "");
+
+    //   
+    auto big_sheet_ptr = CreateSheet();
+    Sheet& big_sheet = dynamic_cast<Sheet&>(*big_sheet_ptr);
+    const int ROWS = 500;
+    const int COLS = 200;
+    std::vector<CellEdit> edits;
+    for (int row = 0; row < ROWS; ++row)
+    {
+        for (int col = 0; col < COLS; ++col)
+        {
+            edits.push_back({ Position{ row, col }, "=" + std::to_string(row * COLS + col) + "/7" });
+        }
+    }
+    big_sheet.SetCells(std::move(edits));
+    big_sheet.Recalculate();
+    std::string reference;
+    {
+        LOG_DURATION("Printing 100000 values cell by cell"s);
+        reference = PrintCellByCell(big_sheet, false);
+    }
+    {
+        LOG_DURATION("Printing 100000 values"s);
+        ASSERT_EQUAL(print(big_sheet, false), reference);
+    }
+}
+
+void TestSnapshot()
+{
+    const auto print = [](const SheetInterface& sheet) {
+        std::ostringstream out;
+        sheet.PrintTexts(out);
+        out << '|';
+        sheet.PrintValues(out);
+        return out.str();
+    };
+    const auto save = [](const Sheet& sheet) {
+        std::ostringstream out;
+        SaveSnapshot(sheet, out);
+        return out.str();
+    };
+
+    Sheet source;
+    source.SetCell("A1"_pos, "2");
+    source.SetCell("A2"_pos, "text");
+    source.SetCell("A3"_pos, "'=escaped");
+    source.SetCell("A4"_pos, "");
+    source.SetCell("B1"_pos, "=A1*0.123456789");
+    source.SetCell("B2"_pos, "=+B1/(A1-2)");
+    source.SetCell("B3"_pos, "=SUM(A1:A3, -C7, B1)");
+    source.SetCell("B4"_pos, "=C9");
+    for (int row = 0; row < 10; ++row)
+    {
+        source.SetCell(Position{ row, 3 }, "=" + Position{ row, 0 }.ToString() + "+1");
+    }
+    source.Recalculate();
+    source.SetCell("E1"_pos, "=D10*2");
+
+    const std::string snapshot = save(source);
+    std::unique_ptr<Sheet> sheet = LoadSnapshot(snapshot);
+    ASSERT_EQUAL(print(*sheet), print(source));
+    ASSERT_EQUAL(sheet->GetPrintableSize(), source.GetPrintableSize());
+    //   ,    
+    ASSERT(dynamic_cast<const Cell*>(sheet->GetCell("B2"_pos))->HasCache());
+    ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetText(), "=+B1/(A1-2)");
+    //    ,     
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(2 * 0.123456789));
+    ASSERT_EQUAL(sheet->GetCell("C9"_pos)->GetText(), "");
+    // E1            
+    ASSERT_EQUAL(save(*sheet), save(source));
+
+    //   
+    sheet->SetCell("A1"_pos, "5");
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(5 * 0.123456789));
+    ASSERT_EQUAL(sheet->GetCell("E1"_pos)->GetValue(), CellInterface::Value(2.0));
+    sheet->SetCell("A10"_pos, "9");
+    ASSERT_EQUAL(sheet->GetCell("E1"_pos)->GetValue(), CellInterface::Value(20.0));
+    bool caught = false;
+    try
+    {
+        sheet->SetCell("C7"_pos, "=B3");
+    }
+    catch (const CircularDependencyException&)
+    {
+        caught = true;
+    }
+    ASSERT(caught);
+
+    //     : ,  
+    // ,     -   ,   
+    {
+        Sheet chain;
+        chain.SetCell("B1"_pos, "=SUM(A1:A10)");
+        for (int row = 0; row < 9; ++row)
+        {
+            chain.SetCell(Position{ row, 0 }, "=A" + std::to_string(row + 2) + "+1");
+        }
+        chain.SetCell("A10"_pos, "1");
+        std::ostringstream version_out;
+        SaveSnapshot(*chain.CaptureVersion(), version_out);
+        for (const std::string& data : { save(chain), version_out.str() })
+        {
+            std::unique_ptr<Sheet> loaded = LoadSnapshot(data);
+            ASSERT_EQUAL(print(*loaded), print(chain));
+            loaded->SetCell("A10"_pos, "5");
+            ASSERT_EQUAL(loaded->GetCell("A1"_pos)->GetValue(), CellInterface::Value(14.0));
+            ASSERT_EQUAL(loaded->GetCell("B1"_pos)->GetValue(), CellInterface::Value(95.0));
+            bool cycle = false;
+            try
+            {
+                loaded->SetCell("A10"_pos, "=B1");
+            }
+            catch (const CircularDependencyException&)
+            {
+                cycle = true;
+            }
+            ASSERT(cycle);
+        }
+    }
+
+    //    
+    const std::filesystem::path path = std::filesystem::temp_directory_path() / "spreadsheet_snapshot_test.bin";
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << snapshot;
+    }
+    ASSERT_EQUAL(print(*LoadSnapshotFile(path.string())), print(source));
+    std::filesystem::remove(path);
+
+    const auto rejects = [](std::string_view data) {
+        try
+        {
+            LoadSnapshot(data);
+        }
+        catch (const SnapshotError&)
+        {
+            return true;
+        }
+        return false;
+    };
+    ASSERT(rejects(""));
+    ASSERT(rejects(std::string_view(snapshot).substr(0, snapshot.size() - 1)));
+    ASSERT(rejects("not a snapshot at all, but long enough to hold a header..."));
+    for (const size_t corrupted : { size_t{ 8 }, size_t{ 60 }, snapshot.size() / 2, snapshot.size() - 1 })
+    {
+        std::string data = snapshot;
+        data[corrupted] ^= 0x10;
+        ASSERT(rejects(data));
+    }
+    ASSERT(rejects(snapshot + "x"));
+    ASSERT(rejects("x"));
+
+    //    ,     
+    {
+        Sheet crafted;
+        crafted.SetCell("E5"_pos, "=SUM(B2:C3)");
+        const std::string original = save(crafted);
+        const auto read = [](const std::string& data, size_t offset) {
+            std::int32_t value;
+            std::memcpy(&value, data.data() + offset, sizeof(value));
+            return value;
+        };
+        //   -   64- 
+        const auto patch = [&original](size_t offset, std::int32_t value) {
+            std::string data = original;
+            std::memcpy(data.data() + offset, &value, sizeof(value));
+            std::memset(data.data() + 56, 0, sizeof(std::uint64_t));
+            Checksum checksum;
+            checksum.Add(data);
+            const std::uint64_t sum = checksum.Get();
+            std::memcpy(data.data() + 56, &sum, sizeof(sum));
+            return data;
+        };
+        const std::int32_t range[] = { 1, 1, 2, 2 };
+        const size_t range_offset = original.rfind(std::string_view(reinterpret_cast<const char*>(range), sizeof(range)));
+        ASSERT(range_offset != std::string::npos);
+        ASSERT_EQUAL(print(*LoadSnapshot(patch(range_offset, 1))), print(crafted));
+        ASSERT(rejects(patch(range_offset, -1)));
+        ASSERT(rejects(patch(range_offset + 4, Position::MAX_COLS)));
+        ASSERT(rejects(patch(range_offset, 3)));
+        //         
+        const size_t origin_row_offset = 64 + read(original, 24) * 32 + 12;
+        ASSERT_EQUAL(read(original, origin_row_offset), 4);
+        ASSERT(rejects(patch(origin_row_offset, 6)));
+        ASSERT(rejects(patch(origin_row_offset, 4 - Position::MAX_ROWS)));
+    }
+    ASSERT_EQUAL(print(*LoadSnapshot(save(Sheet()))), print(Sheet()));
+
+    //      
+    const int ROWS = 16000;
+    std::vector<CellEdit> edits;
+    for (int row = 0; row < ROWS; ++row)
+    {
+        const std::string number = std::to_string(row + 1);
+        edits.push_back({ Position{ row, 0 }, number });
+        edits.push_back({ Position{ row, 1 }, "text " + number });
+        edits.push_back({ Position{ row, 2 }, "=A" + number + "*2+SUM(A" + std::to_string(std::max(1, row - 8)) + ":A" + number + ")" });
+        edits.push_back({ Position{ row, 3 }, "=C" + number + "/" + number });
+    }
+    Sheet big_sheet;
+    big_sheet.SetCells(std::move(edits));
+    big_sheet.Recalculate();
+    std::ostringstream texts;
+    big_sheet.PrintTexts(texts);
+    const std::string big_snapshot = save(big_sheet);
+    {
+        LOG_DURATION("Loading 64000 cells from texts"s);
+        Sheet reparsed;
+        std::istringstream input(texts.str());
+        ImportDelimited(input, reparsed);
+        reparsed.Recalculate();
+    }
+    {
+        LOG_DURATION("Loading 64000 cells from a snapshot"s);
+        sheet = LoadSnapshot(big_snapshot);
+    }
+    ASSERT_EQUAL(sheet->GetCell(Position{ ROWS - 1, 3 })->GetValue(), big_sheet.GetCell(Position{ ROWS - 1, 3 })->GetValue());
+}
+
+void TestJournal()
+{
+    const auto print = [](const SheetInterface& sheet) {
+        std::ostringstream out;
+        sheet.PrintTexts(out);
+        out << '|';
+        sheet.PrintValues(out);
+        return out.str();
+    };
+    const std::filesystem::path path = std::filesystem::temp_directory_path() / "spreadsheet_journal_test.bin";
+    std::filesystem::remove(path);
+
+    Sheet sheet;
+    std::string snapshot;
+    uint64_t snapshot_sequence = 0;
+    {
+        EditJournal journal(path.string());
+        sheet.SetJournal(&journal);
+        sheet.SetCell("A1"_pos, "1");
+        sheet.SetCell("A2"_pos, "=A1+B5");
+        sheet.SetCell("A3"_pos, "'=escaped");
+        sheet.SetCells({ { "B1"_pos, "=SUM(A1:A2)" }, { "B2"_pos, "text" }, { "B3"_pos, "" } });
+        std::ostringstream out;
+        SaveSnapshot(sheet, out);
+        snapshot = out.str();
+        snapshot_sequence = journal.GetLastSequence();
+        ASSERT_EQUAL(snapshot_sequence, 6u);
+
+        sheet.SetCell("A1"_pos, "5");
+        sheet.ClearCell("B2"_pos);
+        sheet.ClearCell("Z100"_pos);
+        //   ,    
+        sheet.ClearCell("B1"_pos);
+        sheet.SetCell("C1"_pos, "=B1*2");
+        sheet.SetCell("B1"_pos, "=A1");
+        bool caught = false;
+        try
+        {
+            sheet.SetCell("A1"_pos, "=C1");
+        }
+        catch (const CircularDependencyException&)
+        {
+            caught = true;
+        }
+        ASSERT(caught);
+        journal.Sync();
+        ASSERT_EQUAL(journal.GetSyncedSequence(), 11u);
+        sheet.SetJournal(nullptr);
+    }
+
+    Sheet replayed;
+    JournalReplay replay = ReplayJournalFile(path.string(), replayed);
+    ASSERT_EQUAL(replay.records, 11u);
+    ASSERT_EQUAL(replay.last_sequence, 11u);
+    ASSERT(replay.complete);
+    ASSERT_EQUAL(print(replayed), print(sheet));
+
+    //   
+    std::unique_ptr<Sheet> restored = LoadSnapshot(snapshot);
+    restored->SetRecalcPolicy(RecalcPolicy::Eager);
+    replay = ReplayJournalFile(path.string(), *restored, snapshot_sequence);
+    ASSERT_EQUAL(replay.records, 5u);
+    ASSERT_EQUAL(print(*restored), print(sheet));
+    ASSERT(dynamic_cast<const Cell*>(restored->GetCell("C1"_pos))->HasCache());
+
+    //     ,    
+    //   
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::app);
+        file << "torn record";
+    }
+    Sheet torn;
+    replay = ReplayJournalFile(path.string(), torn);
+    ASSERT(!replay.complete);
+    ASSERT_EQUAL(print(torn), print(sheet));
+    {
+        EditJournal journal(path.string());
+        ASSERT_EQUAL(journal.GetLastSequence(), 11u);
+        sheet.SetJournal(&journal);
+        sheet.SetCell("D4"_pos, "=A1/0");
+        sheet.SetJournal(nullptr);
+    }
+    Sheet reopened;
+    replay = ReplayJournalFile(path.string(), reopened);
+    ASSERT(replay.complete);
+    ASSERT_EQUAL(replay.last_sequence, 12u);
+    ASSERT_EQUAL(print(reopened), print(sheet));
+
+    bool caught = false;
+    try
+    {
+        ReplayJournal("not a journal", reopened);
+    }
+    catch (const JournalError&)
+    {
+        caught = true;
+    }
+    ASSERT(caught);
+
+    //           
+    {
+        EditJournal journal(path.string());
+        journal.Truncate(snapshot_sequence);
+    }
+    restored = LoadSnapshot(snapshot);
+    replay = ReplayJournalFile(path.string(), *restored, snapshot_sequence);
+    ASSERT_EQUAL(print(*restored), print(sheet));
+    caught = false;
+    try
+    {
+        Sheet stale;
+        ReplayJournalFile(path.string(), stale, snapshot_sequence - 1);
+    }
+    catch (const JournalError&)
+    {
+        caught = true;
+    }
+    ASSERT(caught);
+
+    //  :     
+    const int EDITS = 20000;
+    std::filesystem::remove(path);
+    Sheet plain;
+    {
+        LOG_DURATION("20000 edits without a journal"s);
+        for (int i = 0; i < EDITS; ++i)
+        {
+            plain.SetCell(Position{ i % 1000, 1 + i / 1000 }, "=A1+" + std::to_string(i));
+        }
+    }
+    Sheet journaled;
+    {
+        EditJournal journal(path.string());
+        journaled.SetJournal(&journal);
+        {
+            LOG_DURATION("20000 edits with a journal"s);
+            for (int i = 0; i < EDITS; ++i)
+            {
+                journaled.SetCell(Position{ i % 1000, 1 + i / 1000 }, "=A1+" + std::to_string(i));
+            }
+        }
+        journal.Sync();
+        const JournalStats stats = journal.GetStats();
+        ASSERT_EQUAL(stats.records, static_cast<uint64_t>(EDITS));
+        ASSERT(stats.commits < stats.records / 10);
+        journaled.SetJournal(nullptr);
+    }
+    Sheet bulk;
+    {
+        LOG_DURATION("Replaying 20000 journal records"s);
+        ReplayJournalFile(path.string(), bulk);
+    }
+    ASSERT_EQUAL(print(bulk), print(plain));
+    std::filesystem::remove(path);
+}
+
+void TestCheckpoint()
+{
+    const auto print = [](const SheetInterface& sheet) {
+        std::ostringstream out;
+        sheet.PrintTexts(out);
+        out << '|';
+        sheet.PrintValues(out);
+        return out.str();
+    };
+    const std::filesystem::path directory = std::filesystem::temp_directory_path();
+    const std::string snapshot_path = (directory / "spreadsheet_checkpoint_test.snp").string();
+    const std::string journal_path = (directory / "spreadsheet_checkpoint_test.jnl").string();
+    std::filesystem::remove(snapshot_path);
+    std::filesystem::remove(journal_path);
+
+    Sheet sheet;
+    {
+        EditJournal journal(journal_path);
+        sheet.SetJournal(&journal);
+        const int ROWS = 2000;
+        for (int row = 0; row < ROWS; ++row)
+        {
+            sheet.SetCell(Position{ row, 0 }, std::to_string(row));
+            sheet.SetCell(Position{ row, 1 }, "=A" + std::to_string(row + 1) + "*2");
+        }
+
+        CheckpointOptions options;
+        //     0.2 ,      
+        options.write_rate = 256 << 10;
+        options.write_block = 4 << 10;
+        int reported = 0;
+        options.on_checkpoint = [&reported](const CheckpointStats&) {
+            ++reported;
+        };
+        Checkpointer checkpointer(sheet, journal, snapshot_path, options);
+        ASSERT(!checkpointer.Poll());
+        {
+            LOG_DURATION("Checkpoint of 4000 cells: capture"s);
+            checkpointer.Checkpoint();
+        }
+        const uint64_t checkpoint_sequence = journal.GetLastSequence();
+        for (int row = 0; row < 10; ++row)
+        {
+            sheet.SetCell(Position{ row, 2 }, "=B" + std::to_string(row + 1) + "+1");
+        }
+        sheet.ClearCell("A1"_pos);
+        ASSERT(!checkpointer.GetLastStats().has_value());
+        checkpointer.Wait();
+
+        const std::optional<CheckpointStats> stats = checkpointer.GetLastStats();
+        ASSERT(stats.has_value());
+        ASSERT_EQUAL(reported, 1);
+        ASSERT_EQUAL(stats->journal_sequence, checkpoint_sequence);
+        ASSERT_EQUAL(stats->bytes_written, static_cast<uint64_t>(std::filesystem::file_size(snapshot_path)));
+        ASSERT(stats->write_duration >= std::chrono::milliseconds(100));
+        ASSERT(stats->capture_duration < stats->write_duration);
+        std::cerr << "Checkpoint of 4000 cells: " << stats->bytes_written << " bytes in "
+            << stats->write_duration.count() / 1000 << " ms" << std::endl;
+        ASSERT_EQUAL(journal.GetStats().truncations, 1u);
+
+        //        
+        journal.Sync();
+        Sheet tail;
+        const JournalReplay replay = ReplayJournalFile(journal_path, tail, checkpoint_sequence);
+        ASSERT_EQUAL(replay.records, 11u);
+        ASSERT_EQUAL(replay.last_sequence, checkpoint_sequence + 11);
+        ASSERT_EQUAL(print(*RecoverSheet(snapshot_path, journal_path)), print(sheet));
+
+        //     
+        CheckpointOptions frequent;
+        frequent.journal_bytes = 1000;
+        Checkpointer frequent_checkpointer(sheet, journal, snapshot_path, frequent);
+        ASSERT(!frequent_checkpointer.Poll());
+        for (int row = 0; row < 100; ++row)
+        {
+            sheet.SetCell(Position{ row, 3 }, "text");
+        }
+        ASSERT(frequent_checkpointer.Poll());
+        frequent_checkpointer.Wait();
+        sheet.SetCell("E1"_pos, "=D1");
+        sheet.SetJournal(nullptr);
+    }
+
+    // ,   ,  
+    {
+        EditJournal journal(journal_path);
+        sheet.SetJournal(&journal);
+        sheet.SetCell("E2"_pos, "=E1");
+        sheet.SetJournal(nullptr);
+    }
+    ASSERT_EQUAL(print(*RecoverSheet(snapshot_path, journal_path)), print(sheet));
+
+    std::filesystem::remove(snapshot_path);
+    std::filesystem::remove(journal_path);
+    ASSERT_EQUAL(print(*RecoverSheet(snapshot_path, journal_path)), print(Sheet()));
+
+    //        :
+    //       ,     
+    const auto capture = [&](int rows) {
+        Sheet filled;
+        std::vector<CellEdit> edits;
+        for (int row = 0; row < rows; ++row)
+        {
+            for (int col = 0; col < 15; ++col)
+            {
+                edits.push_back({ Position{ row, col }, std::to_string(row * col) });
+            }
+            edits.push_back({ Position{ row, 15 }, "=SUM(A" + std::to_string(row + 1) + ":O" + std::to_string(row + 1) + ")" });
+        }
+        filled.SetCells(std::move(edits));
+        filled.Recalculate();
+        const std::string captured = print(filled);
+        EditJournal journal(journal_path);
+        Checkpointer checkpointer(filled, journal, snapshot_path);
+        checkpointer.Checkpoint();
+        //        
+        for (int row = 0; row < rows; row += 7)
+        {
+            filled.SetCell(Position{ row, 0 }, "changed");
+        }
+        checkpointer.Wait();
+        ASSERT_EQUAL(print(*LoadSnapshotFile(snapshot_path)), captured);
+        std::filesystem::remove(snapshot_path);
+        std::filesystem::remove(journal_path);
+        return *checkpointer.GetLastStats();
+    };
+    const CheckpointStats small = capture(100);
+    const CheckpointStats large = capture(16000);
+    std::cerr << "Checkpoint capture: " << small.capture_duration.count() << " us for 1600 cells, "
+        << large.capture_duration.count() << " us for 256000 cells; building and writing the larger snapshot: "
+        << large.write_duration.count() / 1000 << " ms" << std::endl;
+    ASSERT(large.capture_duration < small.capture_duration + std::chrono::milliseconds(5));
+    ASSERT(large.capture_duration * 10 < large.write_duration);
+}
+
+void TestSheetVersions()
+{
+    const auto print = [](const auto& sheet) {
+        std::ostringstream out;
+        sheet.PrintTexts(out);
+        out << '|';
+        sheet.PrintValues(out);
+        return out.str();
+    };
+
+    Sheet sheet;
+    ASSERT(!sheet.GetPublishedVersion());
+    sheet.SetCell("A1"_pos, "1");
+    sheet.SetCell("A2"_pos, "=A1*10");
+    sheet.SetCell("Z200"_pos, "far");
+    const std::shared_ptr<const SheetVersion> first = sheet.PublishVersion();
+    const std::string first_print = print(*first);
+    ASSERT_EQUAL(first_print, print(sheet));
+    ASSERT_EQUAL(first->GetNumber(), 1u);
+
+    sheet.SetCell("A1"_pos, "2");
+    sheet.SetCell("B1"_pos, "=A2+1");
+    sheet.ClearCell("Z200"_pos);
+    ASSERT_EQUAL(print(*first), first_print);
+    ASSERT_EQUAL(first->GetCell("A2"_pos)->GetValue(), CellInterface::Value(10.0));
+    ASSERT(first->GetCell("B1"_pos) == nullptr);
+    ASSERT_EQUAL(first->GetPrintableSize(), (Size{ 200, 26 }));
+    ASSERT_EQUAL(sheet.GetCell("A2"_pos)->GetValue(), CellInterface::Value(20.0));
+
+    const std::shared_ptr<const SheetVersion> second = sheet.PublishVersion();
+    ASSERT_EQUAL(sheet.GetPublishedVersion(), second);
+    ASSERT_EQUAL(print(*second), print(sheet));
+    ASSERT_EQUAL(print(*first), first_print);
+
+    //     :    A
+    //   ,  B1 -  
+    const int ROWS = 1000;
+    const int GENERATIONS = 50;
+    Sheet shared;
+    const auto write_generation = [&shared](int generation) {
+        std::vector<CellEdit> edits;
+        for (int row = 0; row < ROWS; ++row)
+        {
+            edits.push_back({ Position{ row, 0 }, std::to_string(generation) });
+        }
+        shared.SetCells(std::move(edits));
+    };
+    write_generation(0);
+    shared.SetCell("B1"_pos, "=SUM(A1:A" + std::to_string(ROWS) + ")");
+    shared.SetCell("C1"_pos, "=B1/A1");
+    shared.PublishVersion();
+    std::atomic<bool> done = false;
+    std::atomic<int> inconsistent = 0;
+    std::atomic<int> checked = 0;
+    std::thread reader([&] {
+        uint64_t last_number = 0;
+        while (!done || last_number < GENERATIONS + 1)
+        {
+            const std::shared_ptr<const SheetVersion> version = shared.GetPublishedVersion();
+            if (version->GetNumber() == last_number)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            last_number = version->GetNumber();
+            const double generation = std::get<double>(version->GetCell("A1"_pos)->GetValue());
+            for (int row = 0; row < ROWS; ++row)
+            {
+                if (std::get<double>(version->GetCell(Position{ row, 0 })->GetValue()) != generation)
+                {
+                    ++inconsistent;
+                }
+            }
+            if (!(version->GetCell("B1"_pos)->GetValue() == CellInterface::Value(generation * ROWS)))
+            {
+                ++inconsistent;
+            }
+            std::ostringstream out;
+            version->PrintValues(out);
+            ++checked;
+        }
+    });
+    for (int generation = 1; generation <= GENERATIONS; ++generation)
+    {
+        write_generation(generation);
+        shared.PublishVersion();
+    }
+    done = true;
+    reader.join();
+    ASSERT_EQUAL(inconsistent.load(), 0);
+    ASSERT(checked.load() > 0);
+
+    //       
+    std::vector<CellEdit> edits;
+    for (int row = 0; row < 4000; ++row)
+    {
+        for (int col = 0; col < 8; ++col)
+        {
+            edits.push_back({ Position{ row, col }, "=" + std::to_string(row) + "+" + std::to_string(col) });
+        }
+    }
+    Sheet big;
+    big.SetCells(std::move(edits));
+    std::shared_ptr<const SheetVersion> pinned;
+    {
+        LOG_DURATION("Publishing a version of 32000 cells"s);
+        pinned = big.PublishVersion();
+    }
+    const std::string pinned_print = print(*pinned);
+    std::string exported;
+    std::thread exporter([&] {
+        for (int i = 0; i < 5; ++i)
+        {
+            exported = print(*pinned);
+        }
+    });
+    {
+        LOG_DURATION("1000 edits during an export"s);
+        for (int i = 0; i < 1000; ++i)
+        {
+            big.SetCell(Position{ (i * 37) % 4000, i % 8 }, std::to_string(i));
+        }
+    }
+    exporter.join();
+    ASSERT_EQUAL(exported, pinned_print);
+    ASSERT(print(big) != pinned_print);
+}
+
+void TestConcurrentReads()
+{
+    //          , 
+    //            
+    const int ROWS = 1000;
+    const int THREADS = 4;
+    Sheet sheet;
+    std::vector<CellEdit> edits;
+    for (int row = 0; row < ROWS; ++row)
+    {
+        const std::string number = std::to_string(row + 1);
+        edits.push_back({ Position{ row, 0 }, number });
+        edits.push_back({ Position{ row, 1 }, row == 0 ? "=A1" : "=B" + std::to_string(row) + "+A" + number });
+        edits.push_back({ Position{ row, 2 }, "=SUM(A1:A" + number + ")-B" + number + "+1/(A" + number + "-7)" });
+    }
+    sheet.SetCells(edits);
+
+    Sheet expected;
+    expected.SetCells(edits);
+    expected.Recalculate();
+
+    for (int round = 0; round < 3; ++round)
+    {
+        const SheetInterface& reader = sheet;
+        std::atomic<int> mismatches = 0;
+        std::vector<std::thread> threads;
+        for (int thread = 0; thread < THREADS; ++thread)
+        {
+            threads.emplace_back([&, thread] {
+                //      
+                for (int i = 0; i < ROWS; ++i)
+                {
+                    const int row = thread % 2 == 0 ? ROWS - 1 - i : (i * 7 + thread) % ROWS;
+                    for (int col = 1; col <= 2; ++col)
+                    {
+                        const Position pos{ row, col };
+                        if (!(reader.GetCell(pos)->GetValue() == expected.GetCell(pos)->GetValue()))
+                        {
+                            ++mismatches;
+                        }
+                    }
+                }
+            });
+        }
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+        ASSERT_EQUAL(mismatches.load(), 0);
+        ASSERT(dynamic_cast<const Cell*>(sheet.GetCell(Position{ ROWS - 1, 1 }))->HasCache());
+        std::ostringstream values;
+        sheet.PrintValues(values);
+        std::ostringstream expected_values;
+        expected.PrintValues(expected_values);
+        ASSERT_EQUAL(values.str(), expected_values.str());
+
+        //        
+        sheet.SetCell("A1"_pos, std::to_string(round + 10));
+        expected.SetCell("A1"_pos, std::to_string(round + 10));
+        expected.Recalculate();
+    }
+}
+
+void TestPrintableArea()
+{
+    //         
+    //      
+    Sheet sheet;
+    std::set<std::pair<int, int>> cells;
+    std::mt19937 random(22);
+    const auto check = [&] {
+        Size expected;
+        for (const auto& [row, col] : cells)
+        {
+            expected.rows = std::max(expected.rows, row + 1);
+            expected.cols = std::max(expected.cols, col + 1);
+        }
+        ASSERT_EQUAL(sheet.GetPrintableSize(), expected);
+    };
+    for (int i = 0; i < 3000; ++i)
+    {
+        //     ,     
+        const int row = static_cast<int>(random() % 16) * 1000 + static_cast<int>(random() % 4);
+        const int col = static_cast<int>(random() % 8) * (Position::MAX_COLS / 8) + static_cast<int>(random() % 4);
+        if (random() % 2 == 0)
+        {
+            sheet.SetCell(Position{ row, col }, random() % 3 == 0 ? "=A1+1" : "x");
+            cells.insert({ row, col });
+        }
+        else
+        {
+            sheet.ClearCell(Position{ row, col });
+            cells.erase({ row, col });
+        }
+        check();
+    }
+    for (const auto& [row, col] : std::vector<std::pair<int, int>>(cells.rbegin(), cells.rend()))
+    {
+        sheet.ClearCell(Position{ row, col });
+        cells.erase({ row, col });
+        check();
+    }
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{ 0, 0 }));
+
+    //     :    
+    const int ROWS = Position::MAX_ROWS;
+    std::vector<CellEdit> edits;
+    for (int row = 0; row < ROWS; ++row)
+    {
+        edits.push_back({ Position{ row, 0 }, std::to_string(row) });
+        edits.push_back({ Position{ row, 1 }, "text" });
+    }
+    for (int col = 2; col < Position::MAX_COLS; ++col)
+    {
+        edits.push_back({ Position{ ROWS - 1, col }, "text" });
+    }
+    Sheet edges;
+    edges.SetCells(std::move(edits));
+    {
+        LOG_DURATION("Clearing a trailing row of 16382 cells"s);
+        for (int col = Position::MAX_COLS - 1; col >= 2; --col)
+        {
+            edges.ClearCell(Position{ ROWS - 1, col });
+        }
+    }
+    ASSERT_EQUAL(edges.GetPrintableSize(), (Size{ ROWS, 2 }));
+    {
+        LOG_DURATION("Clearing a trailing column of 16384 cells"s);
+        for (int row = ROWS - 1; row >= 0; --row)
+        {
+            edges.ClearCell(Position{ row, 1 });
+        }
+    }
+    ASSERT_EQUAL(edges.GetPrintableSize(), (Size{ ROWS, 1 }));
+    {
+        LOG_DURATION("Clearing the last column bottom-up, 16384 cells"s);
+        for (int row = ROWS - 1; row >= 0; --row)
+        {
+            edges.ClearCell(Position{ row, 0 });
+        }
+    }
+    ASSERT_EQUAL(edges.GetPrintableSize(), (Size{ 0, 0 }));
+}
+
+void TestVirtualCells()
+{
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "=C1+D1");
+    ASSERT_EQUAL(sheet.GetVirtualCellCount(), 2u);
+    ASSERT(sheet.GetCell("D1"_pos) != nullptr);
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetText(), "");
+    sheet.SetCell("C1"_pos, "5");
+    ASSERT_EQUAL(sheet.GetVirtualCellCount(), 1u);
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(5.0));
+    //   ,        
+    sheet.SetCells({ { "A2"_pos, "=E1" }, { "A3"_pos, "=E1*2" } });
+    ASSERT_EQUAL(sheet.GetVirtualCellCount(), 2u);
+    sheet.SetCell("A1"_pos, "=C1");
+    ASSERT_EQUAL(sheet.GetVirtualCellCount(), 1u);
+    ASSERT(sheet.GetCell("D1"_pos) == nullptr);
+    sheet.SetCell("A3"_pos, "1");
+    ASSERT(sheet.GetCell("E1"_pos) != nullptr);
+    sheet.ClearCell("A2"_pos);
+    ASSERT_EQUAL(sheet.GetVirtualCellCount(), 0u);
+    ASSERT(sheet.GetCell("E1"_pos) == nullptr);
+
+    //  ,         
+    const int ROWS = 16000;
+    std::vector<CellEdit> edits;
+    for (int row = 0; row < ROWS; ++row)
+    {
+        const std::string number = std::to_string(row + 1);
+        edits.push_back({ Position{ row, 0 }, "=B" + number + "+C" + number });
+    }
+    Sheet forward;
+    forward.SetCells(std::move(edits));
+    ASSERT_EQUAL(forward.GetVirtualCellCount(), static_cast<size_t>(2 * ROWS));
+    {
+        LOG_DURATION("Editing 16000 cells next to 32000 virtual cells"s);
+        for (int row = 0; row < ROWS; ++row)
+        {
+            forward.SetCell(Position{ row, 3 }, std::to_string(row));
+        }
+        for (int row = 0; row < ROWS; ++row)
+        {
+            forward.ClearCell(Position{ row, 3 });
+        }
+    }
+    {
+        LOG_DURATION("Filling 16000 virtual cells"s);
+        for (int row = 0; row < ROWS; ++row)
+        {
+            forward.SetCell(Position{ row, 1 }, std::to_string(row));
+        }
+    }
+    ASSERT_EQUAL(forward.GetVirtualCellCount(), static_cast<size_t>(ROWS));
+    ASSERT_EQUAL(forward.GetCell(Position{ ROWS - 1, 0 })->GetValue(), CellInterface::Value(ROWS - 1.0));
+}
+
+void TestTextCells()
+{
+    //       std::stod
+    const auto parse = [](const std::string& text) -> CellInterface::Value {
+        const std::string value = text.at(0) == ESCAPE_SIGN ? text.substr(1) : text;
+        try
+        {
+            size_t processed = 0;
+            const double result = std::stod(value, &processed);
+            if (processed == value.size())
+            {
+                return result;
+            }
+        }
+        catch (const std::exception&)
+        {
+        }
+        return value;
+    };
+    Sheet sheet;
+    int row = 0;
+    for (const std::string text : { "1", "-2.5", "1e3", " 7", "7 ", "+.5", "0x1A", "inf", "nan", "1e400", "1e-400",
+        "12abc", "abc", "'", "'42", "'text", "''1", " ", "-", ".", "1,5", "=", "1e", "--1" })
+    {
+        const Position pos{ row++, 0 };
+        sheet.SetCell(pos, text);
+        const CellInterface::Value value = sheet.GetCell(pos)->GetValue();
+        const CellInterface::Value expected = parse(text);
+        if (const double* number = std::get_if<double>(&expected); number && std::isnan(*number))
+        {
+            ASSERT(std::holds_alternative<double>(value) && std::isnan(std::get<double>(value)));
+        }
+        else
+        {
+            ASSERT_EQUAL(value, expected);
+        }
+        ASSERT_EQUAL(sheet.GetCell(pos)->GetText(), text);
+    }
+
+    // ,  ,     
+    sheet.SetCells({ { "B1"_pos, "1" }, { "B2"_pos, "'2" }, { "B3"_pos, "x" }, { "B4"_pos, "=SUM(B1:B3)" },
+        { "B5"_pos, "=B1+B2" }, { "B6"_pos, "=B3+1" } });
+    ASSERT_EQUAL(sheet.GetCell("B4"_pos)->GetValue(), CellInterface::Value(3.0));
+    ASSERT_EQUAL(sheet.GetCell("B5"_pos)->GetValue(), CellInterface::Value(3.0));
+    ASSERT_EQUAL(sheet.GetCell("B6"_pos)->GetValue(), CellInterface::Value(FormulaError::Category::Value));
+    sheet.SetCell("B1"_pos, "5");
+    ASSERT_EQUAL(sheet.GetCell("B4"_pos)->GetValue(), CellInterface::Value(7.0));
+    sheet.SetCell("B1"_pos, "five");
+    ASSERT_EQUAL(sheet.GetCell("B5"_pos)->GetValue(), CellInterface::Value(FormulaError::Category::Value));
+
+    //    :   ,  
+    const int ROWS = 16000;
+    std::vector<CellEdit> edits;
+    for (int row = 0; row < ROWS; ++row)
+    {
+        const std::string number = std::to_string(row + 1);
+        edits.push_back({ Position{ row, 0 }, std::to_string(row * 0.25) });
+        edits.push_back({ Position{ row, 1 }, "item " + number });
+        edits.push_back({ Position{ row, 2 }, "=A" + number + "*2+E1" });
+        edits.push_back({ Position{ row, 3 }, "=B" + number + "*2+E1" });
+    }
+    Sheet imported;
+    imported.SetCells(std::move(edits));
+    {
+        LOG_DURATION("Evaluating 32000 formulas over text cells, 10 times"s);
+        for (int round = 0; round < 10; ++round)
+        {
+            imported.SetCell("E1"_pos, std::to_string(round));
+            imported.Recalculate();
+        }
+    }
+    ASSERT_EQUAL(imported.GetCell(Position{ ROWS - 1, 2 })->GetValue(), CellInterface::Value((ROWS - 1) * 0.5 + 9));
+    ASSERT_EQUAL(imported.GetCell(Position{ ROWS - 1, 3 })->GetValue(), CellInterface::Value(FormulaError::Category::Value));
+}
+
+void TestErrorPropagation()
+{
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "2");
+    sheet.SetCell("A2"_pos, "text");
+    sheet.SetCell("A3"_pos, "=1/0");
+    // "nan"  ,   ,  
+    sheet.SetCell("A4"_pos, "nan(0xfe000000)");
+    const auto evaluate = [&sheet](std::string expression, Position offset = { 0, 0 }) {
+        const auto formula = MakeFormula(ParseFormula(std::move(expression))->GetAST(), offset);
+        return std::visit([](const auto& value) { return CellInterface::Value(value); }, formula->Evaluate(sheet));
+    };
+    const CellInterface::Value ref_error(FormulaError::Category::Ref);
+    const CellInterface::Value value_error(FormulaError::Category::Value);
+    const CellInterface::Value arithmetic_error(FormulaError::Category::Arithmetic);
+    //   ,      
+    ASSERT_EQUAL(evaluate("-A3"), arithmetic_error);
+    ASSERT_EQUAL(evaluate("-(A2)*0"), value_error);
+    ASSERT_EQUAL(evaluate("A1*2+A2/A3"), value_error);
+    ASSERT_EQUAL(evaluate("A1/0-A2"), arithmetic_error);
+    ASSERT_EQUAL(evaluate("SUM(A2*1,A3)"), value_error);
+    //   -  ,   
+    ASSERT_EQUAL(evaluate("SUM(A2,A3)"), arithmetic_error);
+    ASSERT_EQUAL(evaluate("SUM(A2,A1)"), CellInterface::Value(2.0));
+    ASSERT_EQUAL(evaluate("SUM(A3,A2)"), arithmetic_error);
+    ASSERT_EQUAL(evaluate("SUM(A1:A3)+A2"), arithmetic_error);
+    ASSERT_EQUAL(evaluate("A2+SUM(A1:A3)"), value_error);
+    ASSERT_EQUAL(evaluate("MAX(A1,A3,A1:A2)"), arithmetic_error);
+    ASSERT_EQUAL(evaluate("MIN(A1:A2)"), CellInterface::Value(2.0));
+    ASSERT_EQUAL(evaluate("AVERAGE(A2:A2)"), arithmetic_error);
+    ASSERT_EQUAL(evaluate("COUNT(A1:A3)"), arithmetic_error);
+    // ,    
+    ASSERT_EQUAL(evaluate("A1+B2/0", { -1, 0 }), ref_error);
+    ASSERT_EQUAL(evaluate("B2/0+A1", { -1, 0 }), arithmetic_error);
+    ASSERT_EQUAL(evaluate("-A1", { -1, 0 }), ref_error);
+    ASSERT_EQUAL(evaluate("SUM(B2:B3,A1:A2)", { -1, 0 }), ref_error);
+    ASSERT_EQUAL(evaluate("SUM(A4:A5)+A1", { -1, 0 }), arithmetic_error);
+    // NaN   - ,   
+    const CellInterface::Value nan = evaluate("A4");
+    ASSERT(std::holds_alternative<double>(nan) && std::isnan(std::get<double>(nan)));
+    ASSERT_EQUAL(evaluate("A4+1"), arithmetic_error);
+
+    //         
+    const int ROWS = 16000;
+    std::vector<CellEdit> edits{ { "A1"_pos, "=1/0" } };
+    for (int row = 0; row < ROWS; ++row)
+    {
+        const std::string number = std::to_string(row + 1);
+        const std::string next = std::to_string(std::min(row + 2, ROWS));
+        edits.push_back({ Position{ row, 1 }, "=A1*2+" + number });
+        edits.push_back({ Position{ row, 2 }, "=B" + number + "-B" + next });
+        edits.push_back({ Position{ row, 3 }, "=SUM(C" + number + ":C" + next + ")/2" });
+    }
+    Sheet errors;
+    errors.SetCells(std::move(edits));
+    {
+        LOG_DURATION("Recalculating 48000 erroneous formulas, 10 times"s);
+        for (int round = 0; round < 10; ++round)
+        {
+            errors.SetCell("A1"_pos, "=" + std::to_string(round) + "/0");
+            errors.Recalculate();
+        }
+    }
+    ASSERT_EQUAL(errors.GetCell(Position{ ROWS - 1, 3 })->GetValue(), arithmetic_error);
+    errors.SetCell("A1"_pos, "1");
+    ASSERT_EQUAL(errors.GetCell(Position{ ROWS - 1, 3 })->GetValue(), CellInterface::Value(0.0));
+}
+
 int main() {
     TestRunner tr;
     {
@@ -555,5 +2720,31 @@ int main() {
         RUN_TEST(tr, TestExample);
         RUN_TEST(tr, TestRewritingCells);
         RUN_TEST(tr, TestClearPrint);
+        RUN_TEST(tr, TestCacheInvalidation);
+        RUN_TEST(tr, TestRecalculate);
+        RUN_TEST(tr, TestParallelRecalculate);
+        RUN_TEST(tr, TestIncrementalCycleCheck);
+        RUN_TEST(tr, TestDenseRegion);
+        RUN_TEST(tr, TestValueCache);
+        RUN_TEST(tr, TestPositionCodec);
+        RUN_TEST(tr, BenchmarkPositionCodec);
+        RUN_TEST(tr, TestFormulaParser);
+        RUN_TEST(tr, TestFormulaEvaluation);
+        RUN_TEST(tr, TestFormulaArena);
+        RUN_TEST(tr, TestSharedFormulas);
+        RUN_TEST(tr, TestRangeFunctions);
+        RUN_TEST(tr, TestRangeDependencies);
+        RUN_TEST(tr, TestBatchEdit);
+        RUN_TEST(tr, TestImport);
+        RUN_TEST(tr, TestPrintFormatting);
+        RUN_TEST(tr, TestSnapshot);
+        RUN_TEST(tr, TestJournal);
+        RUN_TEST(tr, TestCheckpoint);
+        RUN_TEST(tr, TestSheetVersions);
+        RUN_TEST(tr, TestConcurrentReads);
+        RUN_TEST(tr, TestPrintableArea);
+        RUN_TEST(tr, TestVirtualCells);
+        RUN_TEST(tr, TestTextCells);
+        RUN_TEST(tr, TestErrorPropagation);
     }
 }
\ No newline at end of file
@@ -0,0 +1,51 @@
+#include "occupancy.h"
+
+#include <algorithm>
+#include <cassert>
+
+OccupancyCounter::OccupancyCounter() = default;
+
+OccupancyCounter::~OccupancyCounter() = default;
+
+void OccupancyCounter::Add(int index)
+{
+    assert(index >= 0 && index < LEAF_COUNT);
+    if (!nodes_)
+    {
+        nodes_ = std::make_unique<std::uint32_t[]>(2 * LEAF_COUNT);
+    }
+    for (int node = LEAF_COUNT + index; node > 0; node /= 2)
+    {
+        ++nodes_[node];
+    }
+    end_ = std::max(end_, index + 1);
+}
+
+void OccupancyCounter::Remove(int index)
+{
+    assert(index >= 0 && index < LEAF_COUNT && nodes_ && nodes_[LEAF_COUNT + index] > 0);
+    for (int node = LEAF_COUNT + index; node > 0; node /= 2)
+    {
+        --nodes_[node];
+    }
+    if (index + 1 != end_ || nodes_[LEAF_COUNT + index] > 0)
+    {
+        return;
+    }
+    if (nodes_[1] == 0)
+    {
+        end_ = 0;
+        return;
+    }
+    int node = 1;
+    while (node < LEAF_COUNT)
+    {
+        node = nodes_[2 * node + 1] > 0 ? 2 * node + 1 : 2 * node;
+    }
+    end_ = node - LEAF_COUNT + 1;
+}
+
+int OccupancyCounter::GetEnd() const
+{
+    return end_;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstdint>
+#include <memory>
+
+// Число непустых ячеек в каждой строке (или каждом столбце) таблицы.
+// Отвечает, где кончается последняя непустая строка, за O(1); добавление и
+// удаление ячейки стоят O(log MAX_ROWS).
+// Счётчики хранятся в дереве отрезков: узел содержит число ячеек в своём
+// отрезке строк, и последняя непустая строка находится спуском от корня,
+// на каждом уровне - в правого ребёнка, если он не пуст.
+class OccupancyCounter
+{
+public:
+    OccupancyCounter();
+    ~OccupancyCounter();
+
+    // Индекс должен быть корректным: проверка выполняется таблицей
+    void Add(int index);
+    // Ячейка с индексом index должна быть добавлена раньше
+    void Remove(int index);
+
+    // Последний непустой индекс + 1; 0, если ячеек нет
+    int GetEnd() const;
+
+private:
+    // Степень двойки, не меньшая Position::MAX_ROWS и Position::MAX_COLS
+    static const int LEAF_COUNT = 1 << 14;
+    static_assert(LEAF_COUNT >= Position::MAX_ROWS && LEAF_COUNT >= Position::MAX_COLS);
+
+    // узлы дерева, корень - 1, дети узла i - 2i и 2i + 1, листья начинаются
+    // с LEAF_COUNT. Выделяются при добавлении первой ячейки
+    std::unique_ptr<std::uint32_t[]> nodes_;
+    int end_ = 0;
+};
@@ -0,0 +1,86 @@
+#include "output_buffer.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <locale>
+
+OutputBuffer::OutputBuffer(std::ostream& output, size_t capacity)
+    : output_(output), buffer_(capacity)
+{
+    const std::ios_base::fmtflags format_flags = std::ios_base::floatfield | std::ios_base::showpos
+        | std::ios_base::showpoint | std::ios_base::uppercase;
+    format_numbers_ = (output.flags() & format_flags) == 0 && output.width() == 0
+        && output.getloc() == std::locale::classic();
+    precision_ = static_cast<int>(output.precision());
+}
+
+void OutputBuffer::Write(std::string_view text)
+{
+    if (text.size() > buffer_.size() - size_)
+    {
+        Flush();
+        if (text.size() > buffer_.size())
+        {
+            output_.write(text.data(), text.size());
+            return;
+        }
+    }
+    std::memcpy(buffer_.data() + size_, text.data(), text.size());
+    size_ += text.size();
+}
+
+void OutputBuffer::Write(char c)
+{
+    if (size_ == buffer_.size())
+    {
+        Flush();
+    }
+    buffer_[size_++] = c;
+}
+
+void OutputBuffer::WriteRepeated(char c, size_t count)
+{
+    while (count > 0)
+    {
+        if (size_ == buffer_.size())
+        {
+            Flush();
+        }
+        const size_t part = std::min(count, buffer_.size() - size_);
+        std::memset(buffer_.data() + size_, c, part);
+        size_ += part;
+        count -= part;
+    }
+}
+
+void OutputBuffer::WriteNumber(double value)
+{
+    if (!format_numbers_)
+    {
+        Flush();
+        output_ << value;
+        return;
+    }
+    // формат %g занимает не больше precision цифр, знака, точки и порядка
+    const size_t MAX_NUMBER_SIZE = 32;
+    if (precision_ + MAX_NUMBER_SIZE > buffer_.size() - size_)
+    {
+        Flush();
+    }
+    if (precision_ + MAX_NUMBER_SIZE > buffer_.size())
+    {
+        output_ << value;
+        return;
+    }
+    char* const begin = buffer_.data() + size_;
+    const std::to_chars_result result = std::to_chars(begin, buffer_.data() + buffer_.size(), value,
+        std::chars_format::general, precision_);
+    size_ += result.ptr - begin;
+}
+
+void OutputBuffer::Flush()
+{
+    output_.write(buffer_.data(), size_);
+    size_ = 0;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+// Буфер для вывода большого объёма текста в поток. Данные копятся в буфере и
+// передаются потоку крупными блоками. Числа форматируются std::to_chars так же,
+// как их вывел бы сам поток с его точностью; если у потока заданы другие флаги
+// формата, ширина или локаль, число выводится через operator<< потока.
+// Остаток буфера передаётся потоку вызовом Flush()
+class OutputBuffer
+{
+public:
+    static const size_t DEFAULT_CAPACITY = 1 << 16;
+
+    explicit OutputBuffer(std::ostream& output, size_t capacity = DEFAULT_CAPACITY);
+
+    void Write(std::string_view text);
+    void Write(char c);
+    // Записывает символ c count раз
+    void WriteRepeated(char c, size_t count);
+    void WriteNumber(double value);
+
+    void Flush();
+
+private:
+    std::ostream& output_;
+    std::vector<char> buffer_;
+    size_t size_ = 0;
+    bool format_numbers_;
+    int precision_;
+};
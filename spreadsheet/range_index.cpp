@@ -0,0 +1,107 @@
+#include "range_index.h"
+
+#include <algorithm>
+#include <cassert>
+
+RangeIndex::RangeIndex() = default;
+
+RangeIndex::~RangeIndex() = default;
+
+RangeIndex::EntryId RangeIndex::Insert(CellRange range, Position dependent)
+{
+    assert(range.IsValid());
+    EntryId id;
+    if (free_ids_.empty())
+    {
+        id = static_cast<EntryId>(entries_.size());
+        entries_.push_back({ range, dependent, {} });
+    }
+    else
+    {
+        id = free_ids_.back();
+        free_ids_.pop_back();
+        entries_[id].range = range;
+        entries_[id].dependent = dependent;
+    }
+    std::vector<Slot>& slots = entries_[id].slots;
+    ForEachCoveringNode(range.first.row, range.last.row, [&](int row_node) {
+        ColumnNodes& col_nodes = nodes_[row_node];
+        ForEachCoveringNode(range.first.col, range.last.col, [&](int col_node) {
+            std::vector<EntryId>& ids = col_nodes[col_node];
+            slots.push_back({ row_node, col_node, static_cast<std::uint32_t>(ids.size()) });
+            ids.push_back(id);
+        });
+    });
+    std::sort(slots.begin(), slots.end());
+    ++size_;
+    return id;
+}
+
+void RangeIndex::Erase(EntryId id)
+{
+    for (const Slot& slot : entries_[id].slots)
+    {
+        const auto row_it = nodes_.find(slot.row_node);
+        assert(row_it != nodes_.end());
+        ColumnNodes& col_nodes = row_it->second;
+        const auto it = col_nodes.find(slot.col_node);
+        assert(it != col_nodes.end() && it->second[slot.index] == id);
+        std::vector<EntryId>& ids = it->second;
+        // на место удалённого встаёт последний диапазон списка, его слот
+        // для этой пары узлов переписывается
+        const EntryId moved = ids.back();
+        ids[slot.index] = moved;
+        ids.pop_back();
+        if (moved != id)
+        {
+            std::vector<Slot>& moved_slots = entries_[moved].slots;
+            const auto moved_slot = std::lower_bound(moved_slots.begin(), moved_slots.end(), slot);
+            assert(moved_slot != moved_slots.end() && !(slot < *moved_slot));
+            moved_slot->index = slot.index;
+        }
+        if (ids.empty())
+        {
+            col_nodes.erase(it);
+            if (col_nodes.empty())
+            {
+                nodes_.erase(row_it);
+            }
+        }
+    }
+    entries_[id].slots.clear();
+    free_ids_.push_back(id);
+    --size_;
+}
+
+bool RangeIndex::IsEmpty() const
+{
+    return size_ == 0;
+}
+
+size_t RangeIndex::GetSize() const
+{
+    return size_;
+}
+
+// Отрезок [first, last] раскладывается снизу вверх: узел берётся целиком,
+// если его отрезок не выходит за границы, иначе подъём продолжается с его
+// родителя
+template <typename Func>
+void RangeIndex::ForEachCoveringNode(int first, int last, Func&& func)
+{
+    int left = LEAF_COUNT + first;
+    int right = LEAF_COUNT + last + 1;
+    while (left < right)
+    {
+        if (left % 2 == 1)
+        {
+            func(left++);
+        }
+        if (right % 2 == 1)
+        {
+            func(--right);
+        }
+        left /= 2;
+        right /= 2;
+    }
+}
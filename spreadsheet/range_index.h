@@ -0,0 +1,140 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Индекс диапазонов, на которые ссылаются формулы. По позиции ячейки находит
+// все диапазоны, которые её содержат (запрос протыкания).
+// Диапазоны хранятся в двумерном дереве отрезков: строки диапазона
+// раскладываются на O(log MAX_ROWS) узлов дерева строк, столбцы - на
+// O(log MAX_COLS) узлов дерева столбцов, и диапазон записывается в каждую
+// пару таких узлов. Пары на пути от листа позиции к корню в обоих деревьях
+// содержат ровно те диапазоны, которые включают позицию, поэтому запрос
+// стоит O(log^2 + ответ), а не перебирает диапазоны чужих столбцов. Память
+// пропорциональна числу диапазонов, а не их площади: хранятся только узлы
+// строк, в которых есть диапазоны.
+class RangeIndex
+{
+public:
+    using EntryId = std::uint32_t;
+
+    RangeIndex();
+    ~RangeIndex();
+
+    // Добавляет диапазон формулы dependent. Диапазон должен быть корректным
+    EntryId Insert(CellRange range, Position dependent);
+    // Удаление стоит O(k log k), где k = O(log^2) - число пар узлов
+    // диапазона, и не зависит от числа диапазонов в узлах
+    void Erase(EntryId id);
+
+    bool IsEmpty() const;
+    size_t GetSize() const;
+
+    // Вызывает func(const CellRange&, Position dependent) для каждого диапазона,
+    // содержащего pos
+    template <typename Func>
+    void ForEachContaining(Position pos, Func&& func) const;
+
+private:
+    // Степень двойки, не меньшая Position::MAX_ROWS и Position::MAX_COLS
+    static const int LEAF_COUNT = 1 << 14;
+    static const int LEAF_DEPTH = 14;
+    static_assert(LEAF_COUNT >= Position::MAX_ROWS && LEAF_COUNT >= Position::MAX_COLS);
+
+    // место диапазона в списке узла: узел строк, узел столбцов, индекс в списке
+    struct Slot
+    {
+        int row_node;
+        int col_node;
+        std::uint32_t index;
+
+        bool operator<(const Slot& other) const
+        {
+            return row_node < other.row_node || (row_node == other.row_node && col_node < other.col_node);
+        }
+    };
+
+    struct Entry
+    {
+        CellRange range;
+        Position dependent;
+        // упорядочены по паре узлов, чтобы место находилось двоичным поиском
+        std::vector<Slot> slots;
+    };
+
+    // узел дерева строк: списки диапазонов по узлам дерева столбцов
+    using ColumnNodes = std::unordered_map<int, std::vector<EntryId>>;
+
+    std::vector<Entry> entries_;
+    std::vector<EntryId> free_ids_;
+    // непустые узлы дерева строк, корень - 1, дети узла i - 2i и 2i + 1,
+    // листья начинаются с LEAF_COUNT. Узлы дерева столбцов нумеруются так же
+    std::unordered_map<int, ColumnNodes> nodes_;
+    size_t size_ = 0;
+
+    // Вызывает func(int node) для узлов, отрезки которых вместе составляют [first, last]
+    template <typename Func>
+    static void ForEachCoveringNode(int first, int last, Func&& func);
+
+    // Узел node лежит на пути от листа index к корню
+    static bool IsAncestor(int node, int index);
+};
+
+template <typename Func>
+void RangeIndex::ForEachContaining(Position pos, Func&& func) const
+{
+    if (size_ == 0)
+    {
+        return;
+    }
+    const auto visit = [this, &func](const std::vector<EntryId>& ids) {
+        for (const EntryId id : ids)
+        {
+            const Entry& entry = entries_[id];
+            func(entry.range, entry.dependent);
+        }
+    };
+    for (int row_node = LEAF_COUNT + pos.row; row_node > 0; row_node /= 2)
+    {
+        const auto row_it = nodes_.find(row_node);
+        if (row_it == nodes_.end())
+        {
+            continue;
+        }
+        const ColumnNodes& col_nodes = row_it->second;
+        // в узле обычно мало узлов столбцов: перебрать их дешевле, чем
+        // искать все LEAF_DEPTH + 1 предков листа столбца
+        if (col_nodes.size() <= LEAF_DEPTH + 1)
+        {
+            for (const auto& [col_node, ids] : col_nodes)
+            {
+                if (IsAncestor(col_node, pos.col))
+                {
+                    visit(ids);
+                }
+            }
+            continue;
+        }
+        for (int col_node = LEAF_COUNT + pos.col; col_node > 0; col_node /= 2)
+        {
+            const auto it = col_nodes.find(col_node);
+            if (it != col_nodes.end())
+            {
+                visit(it->second);
+            }
+        }
+    }
+}
+
+inline bool RangeIndex::IsAncestor(int node, int index)
+{
+    int depth = 0;
+    while ((node >> (depth + 1)) > 0)
+    {
+        ++depth;
+    }
+    return ((LEAF_COUNT + index) >> (LEAF_DEPTH - depth)) == node;
+}
@@ -2,65 +2,222 @@
 
 #include "cell.h"
 #include "common.h"
+#include "journal.h"
+#include "output_buffer.h"
 
 #include <algorithm>
 #include <iostream>
-#include <list>
+#include <utility>
 
 using namespace std::literals;
 
+namespace
+{
+    //    ,  .  
+    //       
+    void PrintCells(const CellStorage& cells, Size print_size, std::ostream& output, bool text)
+    {
+        OutputBuffer buffer(output);
+        if (print_size.cols == 0)
+        {
+            return;
+        }
+        const size_t last_col = static_cast<size_t>(print_size.cols - 1);
+        int row = 0;
+        int col = 0;
+        const auto move_to = [&](int next_row, int next_col) {
+            if (next_row > row)
+            {
+                buffer.WriteRepeated('\t', last_col - col);
+                buffer.Write('\n');
+                for (++row; row < next_row; ++row)
+                {
+                    buffer.WriteRepeated('\t', last_col);
+                    buffer.Write('\n');
+                }
+                col = 0;
+            }
+            buffer.WriteRepeated('\t', next_col - col);
+            col = next_col;
+        };
+        cells.ForEach([&](Position pos, const Cell& cell) {
+            if (pos.row >= print_size.rows || pos.col >= print_size.cols)
+            {
+                return;
+            }
+            move_to(pos.row, pos.col);
+            if (text)
+            {
+                buffer.Write(cell.GetText());
+                return;
+            }
+            const CellInterface::Value value = cell.GetValue();
+            if (const double* number = std::get_if<double>(&value))
+            {
+                buffer.WriteNumber(*number);
+            }
+            else if (const std::string* str = std::get_if<std::string>(&value))
+            {
+                buffer.Write(*str);
+            }
+            else
+            {
+                buffer.Write(std::get<FormulaError>(value).ToString());
+            }
+        });
+        move_to(print_size.rows, 0);
+        buffer.Flush();
+    }
+}
+
 void Sheet::SetCell(Position pos, std::string text)
 {
     if (!pos.IsValid())
     {
         throw InvalidPositionException("Wrong position"s);
     }
-    CellInterface* temp = sheet_[pos].release();
-    try
+    //          
+    // ,      
+    //    ,     
+    std::string journal_text;
+    if (journal_)
+    {
+        journal_text = text;
+    }
+    Cell cell(*this);
+    cell.Set(std::move(text), pos, formula_pool_);
+    std::vector<Position> ref_cells = cell.GetReferencedCells();
+    if (!graph_.TrySetReferences(pos, ref_cells, cell.GetReferencedRanges()))
+    {
+        throw CircularDependencyException("Circular dependency detecting"s);
+    }
+    virtual_cells_.RemoveDependent(pos);
+    for (Position rpos : ref_cells)
     {
-        sheet_[pos].reset(new Cell(*this, text));
-        std::vector<Position> ref_cells = sheet_[pos]->GetReferencedCells();
-        if (std::binary_search(ref_cells.begin(), ref_cells.end(), pos))
+        if (!GetCell(rpos))
         {
-            sheet_[pos].reset(temp);
-            throw CircularDependencyException("Reference to itself"s);
+            SetVCell(rpos, pos);
         }
-        DeleteVirtualCells(pos);
-        for (Position rpos : ref_cells)
+    }
+    const bool added = !std::as_const(sheet_).Find(pos);
+    const Cell& new_cell = sheet_.Emplace(pos, std::move(cell));
+    if (!new_cell.HasCache())
+    {
+        dirty_cells_.insert(pos);
+    }
+    else
+    {
+        dirty_cells_.erase(pos);
+    }
+    InvalidateDependents(pos);
+    virtual_cells_.Remove(pos);
+    if (added)
+    {
+        AddToPrintableArea(pos);
+    }
+    if (journal_)
+    {
+        journal_->AppendSet(pos, journal_text);
+    }
+    OnChanged();
+}
+
+void Sheet::SetCells(std::vector<CellEdit> edits)
+{
+    std::unordered_map<Position, size_t, PositionHasher> last_edit;
+    for (size_t i = 0; i < edits.size(); ++i)
+    {
+        if (!edits[i].pos.IsValid())
         {
-            if (!GetCell(rpos))
-            {
-                SetVCell(rpos, pos);
-            }
+            throw InvalidPositionException("Wrong position"s);
         }
+        last_edit[edits[i].pos] = i;
     }
-    catch (const std::bad_alloc&)
+    std::vector<size_t> edit_indices;
+    edit_indices.reserve(last_edit.size());
+    for (size_t i = 0; i < edits.size(); ++i)
     {
-        throw;
+        if (last_edit.at(edits[i].pos) == i)
+        {
+            edit_indices.push_back(i);
+        }
     }
-    catch (const FormulaException&)
+    std::vector<CellEdit> journal_edits;
+    if (journal_)
     {
-        sheet_[pos].reset(temp);
-        throw;
+        journal_edits.reserve(edit_indices.size());
+        for (const size_t i : edit_indices)
+        {
+            journal_edits.push_back(edits[i]);
+        }
     }
-    catch (const InvalidPositionException&)
+    //    SetCell,       , 
+    // -   .     
+    std::vector<Cell> cells;
+    cells.reserve(edit_indices.size());
+    for (size_t i = 0; i < edit_indices.size(); ++i)
     {
-        sheet_[pos].reset(temp);
-        throw;
+        cells.emplace_back(*this);
     }
-    catch (const CircularDependencyException&)
+    std::vector<DependencyGraph::ReferenceUpdate> updates(edit_indices.size());
+    const auto prepare_cell = [&](size_t i) {
+        CellEdit& edit = edits[edit_indices[i]];
+        cells[i].Set(std::move(edit.text), edit.pos, formula_pool_);
+        updates[i] = { edit.pos, cells[i].GetReferencedCells(), cells[i].GetReferencedRanges() };
+    };
+    if (recalc_pool_ && cells.size() >= PARALLEL_PARSE_MIN_CELLS)
     {
-        sheet_[pos].reset(temp);
-        throw;
+        recalc_pool_->ParallelFor(cells.size(), prepare_cell);
     }
-    if (virtual_cells_.count(pos))
+    else
     {
-        virtual_cells_.erase(pos);
+        for (size_t i = 0; i < cells.size(); ++i)
+        {
+            prepare_cell(i);
+        }
     }
-    if (!IsInPrintableArea(pos))
+    if (!graph_.TrySetReferences(std::move(updates)))
     {
-        SetNewPrintableArea(pos);
+        throw CircularDependencyException("Circular dependency detecting"s);
     }
+
+    std::vector<Position> changed;
+    changed.reserve(cells.size());
+    for (size_t i = 0; i < cells.size(); ++i)
+    {
+        const Position pos = edits[edit_indices[i]].pos;
+        Cell& cell = cells[i];
+        virtual_cells_.RemoveDependent(pos);
+        for (Position rpos : cell.GetReferencedCells())
+        {
+            if (!GetCell(rpos))
+            {
+                SetVCell(rpos, pos);
+            }
+        }
+        const bool added = !std::as_const(sheet_).Find(pos);
+        const Cell& new_cell = sheet_.Emplace(pos, std::move(cell));
+        if (!new_cell.HasCache())
+        {
+            dirty_cells_.insert(pos);
+        }
+        else
+        {
+            dirty_cells_.erase(pos);
+        }
+        virtual_cells_.Remove(pos);
+        if (added)
+        {
+            AddToPrintableArea(pos);
+        }
+        changed.push_back(pos);
+    }
+    InvalidateDependents(changed);
+    if (journal_)
+    {
+        journal_->AppendSet(journal_edits);
+    }
+    OnChanged();
 }
 
 void Sheet::SetVCell(Position pos, Position depending_pos)
@@ -70,12 +227,7 @@ void Sheet::SetVCell(Position pos, Position depending_pos)
         throw InvalidPositionException("Wrong position"s);
     }
     
-    virtual_cells_[pos].insert(depending_pos);
-   
-    if (sheet_.count(pos))
-    {
-        sheet_.erase(pos);
-    }
+    virtual_cells_.Add(pos, depending_pos);
 }
 
 const CellInterface* Sheet::GetCell(Position pos) const 
@@ -89,37 +241,114 @@ CellInterface* Sheet::GetCell(Position pos)
     { 
         throw InvalidPositionException("Wrong position"s);
     }
-    if (virtual_cells_.count(pos))
+    if (virtual_cells_.Contains(pos))
     {
         return EMPTY_CELL.get();
     }
-    if (!IsInPrintableArea(pos) || !sheet_.count(pos))
+    if (!IsInPrintableArea(pos))
     {
         return nullptr;
     }
-    return sheet_.at(pos).get();
+    //  CellInterface    ,    
+    //    
+    return const_cast<Cell*>(std::as_const(sheet_).Find(pos));
 }
 
-void Sheet::ClearCell(Position pos) 
+double Sheet::GetCellNumber(Position pos) const
 {
     if (!pos.IsValid())
     {
         throw InvalidPositionException("Wrong position"s);
     }
-    if (!sheet_.count(pos))
+    const Cell* cell = sheet_.Find(pos);
+    if (!cell)
     {
-        return;
+        return 0;
     }
-    sheet_.erase(pos);
-    DeleteVirtualCells(pos);
-    if (sheet_.empty() )
+    if (const std::optional<double> number = cell->GetCachedNumber())
     {
-        print_size_ = { 0, 0 };
+        return *number;
     }
-    else if ((pos.row == (print_size_.rows - 1)) || (pos.col == (print_size_.cols - 1)))
+    return SheetInterface::GetCellNumber(pos);
+}
+
+//      .    
+//  ,  -  .   
+//   
+RangeSummary Sheet::SummarizeRange(CellRange range) const
+{
+    if (!range.IsValid())
     {
-        print_size_ = GetPrintSize();
+        throw InvalidPositionException("Wrong position"s);
     }
+    RangeSummary summary;
+    for (int col = range.first.col; col <= range.last.col && !summary.error; ++col)
+    {
+        sheet_.ForEachValueBlock(col, range.first.row, range.last.row,
+            [this, col, &summary](int first_row, const double* values, const std::atomic<ValueTag>* tags,
+                size_t count)
+            {
+                if (summary.error || SummarizeNumbers(values, tags, count, summary))
+                {
+                    return;
+                }
+                for (size_t i = 0; i < count; ++i)
+                {
+                    const ValueTag tag = tags[i].load(std::memory_order_acquire);
+                    switch (tag)
+                    {
+                    case ValueTag::Empty:
+                        break;
+                    case ValueTag::Number:
+                        summary.Add(values[i]);
+                        break;
+                    case ValueTag::Text:
+                    case ValueTag::Dirty:
+                    case ValueTag::Computing:
+                    {
+                        const Cell* cell = sheet_.Find(Position{ first_row + static_cast<int>(i), col });
+                        const CellInterface::Value value = cell->GetValue();
+                        if (std::holds_alternative<FormulaError>(value))
+                        {
+                            summary.error = std::get<FormulaError>(value);
+                            return;
+                        }
+                        if (std::holds_alternative<double>(value))
+                        {
+                            summary.Add(std::get<double>(value));
+                        }
+                        break;
+                    }
+                    default:
+                        summary.error = FormulaError(ToErrorCategory(tag));
+                        return;
+                    }
+                }
+            });
+    }
+    return summary;
+}
+
+void Sheet::ClearCell(Position pos) 
+{
+    if (!pos.IsValid())
+    {
+        throw InvalidPositionException("Wrong position"s);
+    }
+    if (!sheet_.Erase(pos))
+    {
+        return;
+    }
+    virtual_cells_.RemoveDependent(pos);
+    graph_.RemoveReferences(pos);
+    dirty_cells_.erase(pos);
+    InvalidateDependents(pos);
+    RemoveFromPrintableArea(pos);
+    if (journal_)
+    {
+        journal_->AppendClear(pos);
+    }
+    OnChanged();
 }
 
 Size Sheet::GetPrintableSize() const 
@@ -129,117 +358,205 @@ Size Sheet::GetPrintableSize() const
 
 void Sheet::PrintValues(std::ostream& output) const 
 {
-    Print(output);
+    PrintCells(sheet_, print_size_, output, false);
 }
 
 void Sheet::PrintTexts(std::ostream& output) const
 {
-    Print(output, true);
+    PrintCells(sheet_, print_size_, output, true);
+}
+
+bool Sheet::IsInPrintableArea(Position pos) const
+{
+    return pos.IsValid() && pos.col < print_size_.cols && pos.row < print_size_.rows;
 }
 
-namespace service_spreadsheet
+//   .     pos.IsValid()
+void Sheet::AddToPrintableArea(Position pos)
 {
-    std::ostream& operator<<(std::ostream &output, const CellInterface::Value& value) {
-        std::visit(
-            [&output](const auto& x) {
-                output << x;
-            },
-            value);
-        return output;
+    occupied_rows_.Add(pos.row);
+    occupied_cols_.Add(pos.col);
+    print_size_ = { occupied_rows_.GetEnd(), occupied_cols_.GetEnd() };
+}
+
+void Sheet::RemoveFromPrintableArea(Position pos)
+{
+    occupied_rows_.Remove(pos.row);
+    occupied_cols_.Remove(pos.col);
+    print_size_ = { occupied_rows_.GetEnd(), occupied_cols_.GetEnd() };
+}
+
+void Sheet::InvalidateDependents(Position pos)
+{
+    InvalidateDependents(std::vector<Position>{ pos });
+}
+
+void Sheet::InvalidateDependents(const std::vector<Position>& positions)
+{
+    for (const Position dependent : graph_.CollectDependents(positions))
+    {
+        if (Cell* cell = sheet_.Find(dependent))
+        {
+            cell->InvalidateCache();
+            dirty_cells_.insert(dependent);
+        }
     }
-}// service_spreadsheet
+}
 
-void Sheet::Print(std::ostream& output, bool text) const
+void Sheet::Recalculate()
 {
-    using namespace service_spreadsheet;
-    for (int row = 0; row < print_size_.rows; ++row)
+    if (dirty_cells_.empty())
     {
-        bool first = true;
-        for (int col = 0; col < print_size_.cols; ++col)
+        return;
+    }
+    if (recalc_pool_ && dirty_cells_.size() >= PARALLEL_RECALC_MIN_CELLS)
+    {
+        RecalculateParallel();
+    }
+    else
+    {
+        for (const Position pos : graph_.SortTopologically(dirty_cells_))
         {
-            if (first)
+            const Cell* cell = sheet_.Find(pos);
+            if (!cell->HasCache())
             {
-                first = false;
+                cell->GetValue();
             }
-            else
+        }
+    }
+    dirty_cells_.clear();
+}
+
+void Sheet::RecalculateParallel()
+{
+    DependencyGraph::PositionSet cells = dirty_cells_;
+    AddUncachedReferences(cells);
+    std::vector<const Cell*> level_cells;
+    for (const std::vector<Position>& level : graph_.SplitIntoLevels(cells))
+    {
+        level_cells.clear();
+        for (const Position pos : level)
+        {
+            const Cell* cell = sheet_.Find(pos);
+            if (!cell->HasCache())
             {
-                output << '\t';
+                level_cells.push_back(cell);
             }
-            Position pos = { row, col };
-            if (GetCell(pos))
+        }
+        //  ,    ,  , 
+        //           .
+        //  ParallelFor     
+        if (level_cells.size() < PARALLEL_LEVEL_MIN_CELLS)
+        {
+            for (const Cell* cell : level_cells)
             {
-                output << (text ? GetCell(pos)->GetText() : GetCell(pos)->GetValue());
+                cell->GetValue();
             }
         }
-        output << '\n';
+        else
+        {
+            recalc_pool_->ParallelFor(level_cells.size(), [&level_cells](size_t i) {
+                level_cells[i]->GetValue();
+            });
+        }
     }
 }
 
-bool Sheet::IsInPrintableArea(Position pos) const
+void Sheet::AddUncachedReferences(DependencyGraph::PositionSet& cells) const
 {
-    return pos.IsValid() && pos.col < print_size_.cols && pos.row < print_size_.rows;
+    std::vector<Position> stack(cells.begin(), cells.end());
+    while (!stack.empty())
+    {
+        const Position pos = stack.back();
+        stack.pop_back();
+        graph_.ForEachReference(pos, [&](Position ref) {
+            const Cell* cell = sheet_.Find(ref);
+            if (cell && !cell->HasCache() && cells.insert(ref).second)
+            {
+                stack.push_back(ref);
+            }
+        });
+    }
 }
 
-Size Sheet::GetPrintSize()
+void Sheet::SetRecalcPolicy(RecalcPolicy policy)
 {
-    auto row_it = std::max_element(sheet_.begin(), sheet_.end(), 
-        [](const auto& lhs, const auto& rhs) {
-                return lhs.first.row < rhs.first.row;
-        });
-    auto col_it = std::max_element(sheet_.begin(), sheet_.end(),
-        [](const auto& lhs, const auto& rhs) {
-                return lhs.first.col < rhs.first.col;
-        });
-    return { row_it->first.row + 1, col_it->first.col + 1 };
+    recalc_policy_ = policy;
+    OnChanged();
 }
 
-//   .     pos.IsValid()
-void Sheet::SetNewPrintableArea(Position pos)
+RecalcPolicy Sheet::GetRecalcPolicy() const
 {
-    if (pos.col > print_size_.cols - 1)
-    {
-        print_size_.cols = pos.col + 1;
-    }
-    if (pos.row > print_size_.rows - 1)
-    {
-        print_size_.rows = pos.row + 1;
-    }
+    return recalc_policy_;
 }
 
-std::optional<std::vector<Position>>  Sheet::IsEmptyReference(const Position pos) const
+void Sheet::SetRecalcThreads(size_t thread_count)
 {
-    std::list<Position> cells;
-    for (auto& [vpos, ref] : virtual_cells_)
+    if (thread_count > 1)
     {
-        if (ref.count(pos))
-        {
-            cells.push_back(vpos);
-        }
+        recalc_pool_ = std::make_unique<ThreadPool>(thread_count);
     }
-    if (cells.empty())
+    else
     {
-         return {};
+        recalc_pool_.reset();
     }
-    return { { cells.begin(), cells.end() } };
 }
 
-void Sheet::DeleteVirtualCells(const Position pos)
+size_t Sheet::GetSharedFormulaCount() const
+{
+    return formula_pool_.GetSharedCount();
+}
+
+size_t Sheet::GetRangeReferenceCount() const
+{
+    return graph_.GetRangeCount();
+}
+
+size_t Sheet::GetVirtualCellCount() const
+{
+    return virtual_cells_.GetSize();
+}
+
+void Sheet::SetJournal(EditJournal* journal)
+{
+    journal_ = journal;
+}
+
+EditJournal* Sheet::GetJournal() const
+{
+    return journal_;
+}
+
+std::shared_ptr<const SheetVersion> Sheet::PublishVersion()
+{
+    //          
+    Recalculate();
+    std::shared_ptr<const SheetVersion> version(new SheetVersion(sheet_, print_size_, ++version_count_));
+    std::atomic_store(&published_version_, version);
+    return version;
+}
+
+std::shared_ptr<const SheetVersion> Sheet::CaptureVersion()
 {
-    if (auto v_pos = IsEmptyReference(pos))
+    Recalculate();
+    return std::shared_ptr<const SheetVersion>(new SheetVersion(sheet_, print_size_, 0));
+}
+
+std::shared_ptr<const SheetVersion> Sheet::GetPublishedVersion() const
+{
+    return std::atomic_load(&published_version_);
+}
+
+size_t Sheet::GetRecalcThreads() const
+{
+    return recalc_pool_ ? recalc_pool_->GetThreadCount() : 1;
+}
+
+void Sheet::OnChanged()
+{
+    if (recalc_policy_ == RecalcPolicy::Eager)
     {
-        std::list<Position> empty;
-        for (const Position ref_pos : *v_pos)
-        {
-            virtual_cells_[ref_pos].erase(pos);
-            if (virtual_cells_[ref_pos].empty())
-            {
-                empty.push_back(ref_pos);
-            }
-        }
-        for (const Position empty_pos : empty)
-        {
-            virtual_cells_.erase(empty_pos);
-        }
+        Recalculate();
     }
 }
 
@@ -247,3 +564,35 @@ std::unique_ptr<SheetInterface> CreateSheet()
 {
     return std::make_unique<Sheet>();
 }
+
+SheetVersion::SheetVersion(const CellStorage& cells, Size print_size, uint64_t number)
+    : cells_(cells), print_size_(print_size), number_(number) {}
+
+const CellInterface* SheetVersion::GetCell(Position pos) const
+{
+    if (!pos.IsValid())
+    {
+        throw InvalidPositionException("Wrong position"s);
+    }
+    return cells_.Find(pos);
+}
+
+Size SheetVersion::GetPrintableSize() const
+{
+    return print_size_;
+}
+
+void SheetVersion::PrintValues(std::ostream& output) const
+{
+    PrintCells(cells_, print_size_, output, false);
+}
+
+void SheetVersion::PrintTexts(std::ostream& output) const
+{
+    PrintCells(cells_, print_size_, output, true);
+}
+
+uint64_t SheetVersion::GetNumber() const
+{
+    return number_;
+}
@@ -2,12 +2,61 @@
 
 #include "cell.h"
 #include "common.h"
+#include "graph.h"
+#include "occupancy.h"
+#include "storage.h"
+#include "thread_pool.h"
+#include "virtual_cells.h"
 
 #include <unordered_set>
 #include <functional>
+#include <memory>
+#include <string_view>
+
+//      :
+// Lazy -        Recalculate(),
+// Eager - Recalculate()    SetCell  ClearCell
+enum class RecalcPolicy
+{
+    Lazy,
+    Eager,
+};
+
+class EditJournal;
+
+//       Sheet::SetCells
+struct CellEdit
+{
+    Position pos;
+    std::string text;
+};
+
+//      Sheet::PublishVersion(). 
+//      ,    :
+//      ,    
+//  .    ,     
+class SheetVersion
+{
+public:
+    // nullptr,     
+    const CellInterface* GetCell(Position pos) const;
+    Size GetPrintableSize() const;
+    void PrintValues(std::ostream& output) const;
+    void PrintTexts(std::ostream& output) const;
+    //     1   ;  ,
+    //  Sheet::CaptureVersion(),  0
+    uint64_t GetNumber() const;
+
+private:
+    friend class Sheet;
+    friend void SaveSnapshot(const SheetVersion& version, std::ostream& output, uint64_t journal_sequence);
 
-using CellStorage = std::unordered_map<Position, std::unique_ptr<CellInterface>, PositionHasher>;
-using VirtualCellIndex = std::unordered_map<Position, std::unordered_set<Position, PositionHasher>, PositionHasher>;
+    SheetVersion(const CellStorage& cells, Size print_size, uint64_t number);
+
+    const CellStorage cells_;
+    const Size print_size_;
+    const uint64_t number_;
+};
 
 class Sheet : public SheetInterface {
 public:
@@ -15,12 +64,31 @@ public:
 
     void SetCell(Position pos, std::string text) override;
 
+    //      :   
+    //      ,     
+    //  (  Eager)  .   
+    //   ,     .   
+    //   ,   .  
+    //    
+    void SetCells(std::vector<CellEdit> edits);
+
     //  ,    ,     
     void SetVCell(Position pos, Position depending_pos);
 
+    //          
+    //   ,     .  
+    //       , 
+    //    ,     
+    //  .     -   (PublishVersion)
     const CellInterface* GetCell(Position pos) const override;
           CellInterface* GetCell(Position pos) override;
 
+    //       
+    double GetCellNumber(Position pos) const override;
+
+    //        
+    RangeSummary SummarizeRange(CellRange range) const override;
+
     void ClearCell(Position pos) override;
 
     Size GetPrintableSize() const override;
@@ -29,24 +97,99 @@ public:
 
     void PrintTexts(std::ostream& output) const override;
 
+    //  ,     
+    // .     ,  -  
+    void Recalculate();
+
+    void SetRecalcPolicy(RecalcPolicy policy);
+    RecalcPolicy GetRecalcPolicy() const;
+
+    //     .    1 
+    //      ,  
+    //   SetCells  .  
+    //      
+    void SetRecalcThreads(size_t thread_count);
+    size_t GetRecalcThreads() const;
+
+    //    : ,   ,
+    //   
+    size_t GetSharedFormulaCount() const;
+
+    //       
+    size_t GetRangeReferenceCount() const;
+
+    //   ,    
+    size_t GetVirtualCellCount() const;
+
+    //  ,      
+    //  (. journal.h); nullptr  .  
+    // ,  
+    void SetJournal(EditJournal* journal);
+    EditJournal* GetJournal() const;
+
+    //         
+    //      .  O(  );
+    //    ,   
+    std::shared_ptr<const SheetVersion> PublishVersion();
+    //  PublishVersion(),     : 
+    //   ,       
+    std::shared_ptr<const SheetVersion> CaptureVersion();
+    //     nullptr.    
+    //     
+    std::shared_ptr<const SheetVersion> GetPublishedVersion() const;
+
 private:
+    //     ,  SetCell (. snapshot.h)
+    friend void SaveSnapshot(const Sheet& sheet, std::ostream& output, uint64_t journal_sequence);
+    friend std::unique_ptr<Sheet> LoadSnapshot(std::string_view data, uint64_t* journal_sequence);
+
     CellStorage sheet_;
+    FormulaPool formula_pool_;
     VirtualCellIndex virtual_cells_;
+    DependencyGraph graph_;
+    DependencyGraph::PositionSet dirty_cells_;
+    RecalcPolicy recalc_policy_ = RecalcPolicy::Lazy;
+    std::unique_ptr<ThreadPool> recalc_pool_;
+    EditJournal* journal_ = nullptr;
+    //      std::atomic_load  std::atomic_store
+    std::shared_ptr<const SheetVersion> published_version_;
+    uint64_t version_count_ = 0;
+    //      :   print_size_ 
+    //      
+    OccupancyCounter occupied_rows_;
+    OccupancyCounter occupied_cols_;
     Size print_size_;
 
-    const  std::unique_ptr<CellInterface> EMPTY_CELL = std::unique_ptr<Cell>(new Cell(*this));
+    const  std::unique_ptr<Cell> EMPTY_CELL = std::unique_ptr<Cell>(new Cell(*this));
 
     bool IsInPrintableArea(Position pos) const;
 
-    Size GetPrintSize();
+    //         print_size_
+    void AddToPrintableArea(Position pos);
+    void RemoveFromPrintableArea(Position pos);
+
+    //    ,     pos, 
+    //    
+    void InvalidateDependents(Position pos);
+    void InvalidateDependents(const std::vector<Position>& positions);
 
-    void Print(std::ostream& output, bool text = false) const;
+    //  ,    Eager
+    void OnChanged();
 
-    void SetNewPrintableArea(const Position pos);
+    void RecalculateParallel();
 
-    std::optional<std::vector<Position>> IsEmptyReference(const Position pos) const;
+    //   cells    ,    
+    //   cells.     cells   
+    //  .        ,
+    //     ,     dirty_cells_
+    void AddUncachedReferences(DependencyGraph::PositionSet& cells) const;
 
-    void DeleteVirtualCells(const Position pos);
+    //       
+    static const size_t PARALLEL_RECALC_MIN_CELLS = 512;
+    //   ,      
+    static const size_t PARALLEL_LEVEL_MIN_CELLS = 64;
+    //    SetCells   
+    static const size_t PARALLEL_PARSE_MIN_CELLS = 256;
 };
 
 
@@ -0,0 +1,563 @@
+#include "snapshot.h"
+
+#include "FormulaAST.h"
+#include "checksum.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std::literals;
+
+// Снимок - заголовок и за ним разделы в таком порядке: записи ячеек по
+// строкам, записи формул, пул текстов ячеек, пул разобранных формул.
+// Контрольная сумма считается по заголовку с нулевым полем суммы и всем
+// разделам
+namespace
+{
+    const char MAGIC[8] = { 'S', 'H', 'E', 'E', 'T', 'S', 'N', 'P' };
+    const std::uint32_t FORMAT_VERSION = 3;
+    // записывается в порядке байтов машины, которая сохранила снимок
+    const std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+    enum class CellKind : std::uint8_t
+    {
+        Empty,
+        Text,
+        Formula,
+    };
+
+    struct Header
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byte_order;
+        std::int32_t print_rows;
+        std::int32_t print_cols;
+        std::uint32_t cell_count;
+        std::uint32_t formula_count;
+        std::uint64_t text_size;
+        std::uint64_t code_size;
+        // номер последней записи журнала, вошедшей в снимок
+        std::uint64_t journal_sequence;
+        std::uint64_t checksum;
+    };
+    static_assert(sizeof(Header) == 64);
+
+    // Для текста offset и size - место текста в пуле текстов, tag и value -
+    // его значение: Number и число или Text, чтобы текст не разбирался заново.
+    // Для формулы offset - номер записи формулы, size - место формулы в
+    // топологическом порядке, по которому граф зависимостей восстанавливается
+    // без поиска циклов. tag и value - значение формулы из кэша, Dirty, если
+    // оно не было вычислено
+    struct CellRecord
+    {
+        std::int32_t row;
+        std::int32_t col;
+        CellKind kind;
+        ValueTag tag;
+        std::uint16_t reserved;
+        std::uint32_t size;
+        std::uint64_t offset;
+        double value;
+    };
+    static_assert(sizeof(CellRecord) == 32);
+
+    // Формула, общая для ячеек, которые получены её протягиванием из ячейки
+    // origin. Её узлы лежат в пуле формул
+    struct FormulaRecord
+    {
+        std::uint64_t code_offset;
+        std::uint32_t code_size;
+        std::int32_t origin_row;
+        std::int32_t origin_col;
+        std::uint32_t reserved;
+    };
+    static_assert(sizeof(FormulaRecord) == 24);
+
+    template <typename T>
+    std::string_view AsBytes(const std::vector<T>& records)
+    {
+        return { reinterpret_cast<const char*>(records.data()), records.size() * sizeof(T) };
+    }
+
+    template <typename T>
+    T ReadRecord(std::string_view section, size_t index)
+    {
+        T record;
+        std::memcpy(&record, section.data() + index * sizeof(T), sizeof(T));
+        return record;
+    }
+
+    // Файл, отображённый в память только для чтения
+    class MappedFile
+    {
+    public:
+        explicit MappedFile(const std::string& path);
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        ~MappedFile();
+
+        std::string_view GetData() const
+        {
+            return { data_, size_ };
+        }
+
+    private:
+        const char* data_ = nullptr;
+        size_t size_ = 0;
+#ifdef _WIN32
+        HANDLE file_ = INVALID_HANDLE_VALUE;
+        HANDLE mapping_ = nullptr;
+#endif
+
+        void Release();
+    };
+
+#ifdef _WIN32
+    MappedFile::MappedFile(const std::string& path)
+    {
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL, nullptr);
+        LARGE_INTEGER size;
+        if (file_ == INVALID_HANDLE_VALUE || !GetFileSizeEx(file_, &size))
+        {
+            Release();
+            throw SnapshotError("Cannot open snapshot file "s + path);
+        }
+        size_ = static_cast<size_t>(size.QuadPart);
+        if (size_ == 0)
+        {
+            return;
+        }
+        mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping_)
+        {
+            data_ = static_cast<const char*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+        }
+        if (!data_)
+        {
+            Release();
+            throw SnapshotError("Cannot map snapshot file "s + path);
+        }
+    }
+
+    MappedFile::~MappedFile()
+    {
+        Release();
+    }
+
+    void MappedFile::Release()
+    {
+        if (data_)
+        {
+            UnmapViewOfFile(data_);
+        }
+        if (mapping_)
+        {
+            CloseHandle(mapping_);
+        }
+        if (file_ != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(file_);
+        }
+    }
+#else
+    MappedFile::MappedFile(const std::string& path)
+    {
+        const int fd = open(path.c_str(), O_RDONLY);
+        struct stat file_stat;
+        if (fd < 0 || fstat(fd, &file_stat) != 0)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            throw SnapshotError("Cannot open snapshot file "s + path);
+        }
+        size_ = static_cast<size_t>(file_stat.st_size);
+        if (size_ > 0)
+        {
+            void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED)
+            {
+                close(fd);
+                throw SnapshotError("Cannot map snapshot file "s + path);
+            }
+            data_ = static_cast<const char*>(data);
+        }
+        // отображение остаётся действительным и после закрытия файла
+        close(fd);
+    }
+
+    MappedFile::~MappedFile()
+    {
+        Release();
+    }
+
+    void MappedFile::Release()
+    {
+        if (data_)
+        {
+            munmap(const_cast<char*>(data_), size_);
+        }
+    }
+#endif
+
+    // Места формул хранилища в топологическом порядке графа graph, по
+    // порядку обхода хранилища. Формулы вне графа ни от кого не зависят и идут
+    // первыми
+    std::vector<std::uint32_t> RankFormulas(const CellStorage& storage, const DependencyGraph& graph)
+    {
+        std::vector<std::pair<size_t, std::uint32_t>> ordered;
+        storage.ForEach([&](Position pos, const Cell& cell) {
+            if (cell.GetFormula())
+            {
+                const std::optional<size_t> order = graph.GetOrder(pos);
+                ordered.emplace_back(order ? *order + 1 : 0, static_cast<std::uint32_t>(ordered.size()));
+            }
+        });
+        std::sort(ordered.begin(), ordered.end());
+        std::vector<std::uint32_t> ranks(ordered.size());
+        for (size_t rank = 0; rank < ordered.size(); ++rank)
+        {
+            ranks[ordered[rank].second] = static_cast<std::uint32_t>(rank);
+        }
+        return ranks;
+    }
+
+    // Записывает ячейки таблицы или её версии. У версии нет графа
+    // зависимостей, и он строится здесь же - в потоке, который пишет снимок
+    void SaveCells(const CellStorage& storage, Size print_size, const DependencyGraph* graph,
+        std::ostream& output, uint64_t journal_sequence)
+    {
+        DependencyGraph version_graph;
+        if (!graph)
+        {
+            std::vector<DependencyGraph::ReferenceUpdate> updates;
+            storage.ForEach([&](Position pos, const Cell& cell) {
+                if (cell.GetFormula())
+                {
+                    updates.push_back({ pos, cell.GetReferencedCells(), cell.GetReferencedRanges() });
+                }
+            });
+            [[maybe_unused]] const bool acyclic = version_graph.TrySetReferences(std::move(updates));
+            assert(acyclic);
+            graph = &version_graph;
+        }
+        const std::vector<std::uint32_t> ranks = RankFormulas(storage, *graph);
+        size_t formula_index = 0;
+
+        std::vector<CellRecord> cells;
+        cells.reserve(storage.GetCellCount());
+        std::vector<FormulaRecord> formulas;
+        std::string texts;
+        std::string code;
+        std::unordered_map<const FormulaAST*, std::uint32_t> formula_indices;
+        storage.ForEach([&](Position pos, const Cell& cell) {
+            CellRecord record{};
+            record.row = pos.row;
+            record.col = pos.col;
+            if (const FormulaInterface* formula = cell.GetFormula())
+            {
+                const auto [it, inserted] = formula_indices.emplace(formula->GetAST().get(),
+                    static_cast<std::uint32_t>(formulas.size()));
+                if (inserted)
+                {
+                    FormulaRecord& formula_record = formulas.emplace_back();
+                    formula_record.code_offset = code.size();
+                    formula->GetAST()->Serialize(code);
+                    formula_record.code_size = static_cast<std::uint32_t>(code.size() - formula_record.code_offset);
+                    formula_record.origin_row = pos.row - formula->GetOffset().row;
+                    formula_record.origin_col = pos.col - formula->GetOffset().col;
+                }
+                record.kind = CellKind::Formula;
+                record.offset = it->second;
+                record.size = ranks[formula_index++];
+                record.tag = ValueTag::Dirty;
+                if (const std::optional<FormulaInterface::Value> value = cell.GetCachedValue())
+                {
+                    if (const double* number = std::get_if<double>(&*value))
+                    {
+                        record.tag = ValueTag::Number;
+                        record.value = *number;
+                    }
+                    else
+                    {
+                        record.tag = ToValueTag(std::get<FormulaError>(*value).GetCategory());
+                    }
+                }
+            }
+            else
+            {
+                const std::string text = cell.GetText();
+                record.kind = text.empty() ? CellKind::Empty : CellKind::Text;
+                record.offset = texts.size();
+                record.size = static_cast<std::uint32_t>(text.size());
+                texts += text;
+                if (!text.empty())
+                {
+                    const CellInterface::Value value = cell.GetValue();
+                    const double* number = std::get_if<double>(&value);
+                    record.tag = number ? ValueTag::Number : ValueTag::Text;
+                    record.value = number ? *number : 0.0;
+                }
+            }
+            cells.push_back(record);
+        });
+
+        Header header{};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = FORMAT_VERSION;
+        header.byte_order = BYTE_ORDER_MARK;
+        header.print_rows = print_size.rows;
+        header.print_cols = print_size.cols;
+        header.cell_count = static_cast<std::uint32_t>(cells.size());
+        header.formula_count = static_cast<std::uint32_t>(formulas.size());
+        header.text_size = texts.size();
+        header.code_size = code.size();
+        header.journal_sequence = journal_sequence;
+        const std::string_view sections[] = { AsBytes(cells), AsBytes(formulas), texts, code };
+        Checksum checksum;
+        checksum.Add({ reinterpret_cast<const char*>(&header), sizeof(header) });
+        for (const std::string_view section : sections)
+        {
+            checksum.Add(section);
+        }
+        header.checksum = checksum.Get();
+
+        output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (const std::string_view section : sections)
+        {
+            output.write(section.data(), section.size());
+        }
+    }
+}
+
+void SaveSnapshot(const Sheet& sheet, std::ostream& output, uint64_t journal_sequence)
+{
+    SaveCells(sheet.sheet_, sheet.print_size_, &sheet.graph_, output, journal_sequence);
+}
+
+void SaveSnapshot(const SheetVersion& version, std::ostream& output, uint64_t journal_sequence)
+{
+    SaveCells(version.cells_, version.print_size_, nullptr, output, journal_sequence);
+}
+
+std::unique_ptr<Sheet> LoadSnapshot(std::string_view data, uint64_t* journal_sequence)
+{
+    Header header;
+    if (data.size() < sizeof(header))
+    {
+        throw SnapshotError("Snapshot is truncated"s);
+    }
+    std::memcpy(&header, data.data(), sizeof(header));
+    data.remove_prefix(sizeof(header));
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+    {
+        throw SnapshotError("Not a snapshot"s);
+    }
+    if (header.version != FORMAT_VERSION)
+    {
+        throw SnapshotError("Unsupported snapshot version "s + std::to_string(header.version));
+    }
+    if (header.byte_order != BYTE_ORDER_MARK)
+    {
+        throw SnapshotError("Snapshot was written with a different byte order"s);
+    }
+    const std::uint64_t cells_size = std::uint64_t{ header.cell_count } * sizeof(CellRecord);
+    const std::uint64_t formulas_size = std::uint64_t{ header.formula_count } * sizeof(FormulaRecord);
+    if (header.text_size > data.size() || header.code_size > data.size()
+        || cells_size + formulas_size + header.text_size + header.code_size != data.size())
+    {
+        throw SnapshotError("Snapshot is truncated"s);
+    }
+    Header unsigned_header = header;
+    unsigned_header.checksum = 0;
+    Checksum checksum;
+    checksum.Add({ reinterpret_cast<const char*>(&unsigned_header), sizeof(unsigned_header) });
+    checksum.Add(data);
+    if (checksum.Get() != header.checksum)
+    {
+        throw SnapshotError("Snapshot checksum mismatch"s);
+    }
+    const std::string_view cell_section = data.substr(0, cells_size);
+    const std::string_view formula_section = data.substr(cells_size, formulas_size);
+    const std::string_view texts = data.substr(cells_size + formulas_size, header.text_size);
+    const std::string_view code = data.substr(cells_size + formulas_size + header.text_size);
+
+    struct SharedFormula
+    {
+        std::shared_ptr<const FormulaAST> ast;
+        Position origin;
+    };
+    std::vector<SharedFormula> formulas;
+    formulas.reserve(header.formula_count);
+    for (size_t i = 0; i < header.formula_count; ++i)
+    {
+        const auto record = ReadRecord<FormulaRecord>(formula_section, i);
+        if (record.code_offset > code.size() || record.code_size > code.size() - record.code_offset)
+        {
+            throw SnapshotError("Corrupted snapshot formula"s);
+        }
+        try
+        {
+            formulas.push_back({ std::make_shared<const FormulaAST>(
+                DeserializeFormulaAST(code.substr(record.code_offset, record.code_size))),
+                Position{ record.origin_row, record.origin_col } });
+        }
+        catch (const ParsingError& error)
+        {
+            throw SnapshotError(error.what());
+        }
+    }
+
+    auto sheet = std::make_unique<Sheet>();
+    std::vector<Cell> cells;
+    cells.reserve(header.cell_count);
+    std::vector<CellRecord> records;
+    records.reserve(header.cell_count);
+    // формулы по местам в топологическом порядке
+    std::vector<std::pair<std::uint32_t, DependencyGraph::ReferenceUpdate>> ranked;
+    for (size_t i = 0; i < header.cell_count; ++i)
+    {
+        const auto record = ReadRecord<CellRecord>(cell_section, i);
+        const Position pos{ record.row, record.col };
+        // ячейки записаны по строкам, поэтому повтор позиции виден сразу
+        if (!pos.IsValid() || (!records.empty() && !(Position{ records.back().row, records.back().col } < pos)))
+        {
+            throw SnapshotError("Corrupted snapshot cell"s);
+        }
+        Cell& cell = cells.emplace_back(*sheet);
+        switch (record.kind)
+        {
+        case CellKind::Empty:
+            break;
+        case CellKind::Text:
+        {
+            if (record.offset > texts.size() || record.size > texts.size() - record.offset)
+            {
+                throw SnapshotError("Corrupted snapshot cell"s);
+            }
+            std::string text(texts.substr(record.offset, record.size));
+            if (text.empty() || (text.size() > 1 && text.front() == FORMULA_SIGN)
+                || (record.tag != ValueTag::Number && record.tag != ValueTag::Text))
+            {
+                throw SnapshotError("Corrupted snapshot cell"s);
+            }
+            cell.Set(std::move(text), record.tag == ValueTag::Number ? std::optional<double>(record.value) : std::nullopt);
+            break;
+        }
+        case CellKind::Formula:
+        {
+            if (record.offset >= formulas.size()
+                || (record.tag != ValueTag::Dirty && record.tag != ValueTag::Number && !IsErrorTag(record.tag)))
+            {
+                throw SnapshotError("Corrupted snapshot cell"s);
+            }
+            const SharedFormula& formula = formulas[record.offset];
+            cell.Set(MakeFormula(formula.ast, { pos.row - formula.origin.row, pos.col - formula.origin.col }));
+            DependencyGraph::ReferenceUpdate update{ pos, cell.GetReferencedCells(), cell.GetReferencedRanges() };
+            // сдвинутая на место ячейки формула может ссылаться за пределы таблицы
+            if (!std::all_of(update.refs.begin(), update.refs.end(), [](Position ref) { return ref.IsValid(); })
+                || !std::all_of(update.ranges.begin(), update.ranges.end(), [](const CellRange& range) { return range.IsValid(); }))
+            {
+                throw SnapshotError("Corrupted snapshot formula"s);
+            }
+            ranked.push_back({ record.size, std::move(update) });
+            break;
+        }
+        default:
+            throw SnapshotError("Corrupted snapshot cell"s);
+        }
+        records.push_back(record);
+    }
+    // места формул - перестановка их номеров; формула, которая встретилась
+    // раньше своих зависимостей, значит, что порядок испорчен
+    std::vector<DependencyGraph::ReferenceUpdate> updates(ranked.size());
+    std::vector<bool> placed(ranked.size());
+    for (auto& [rank, update] : ranked)
+    {
+        if (rank >= updates.size() || placed[rank])
+        {
+            throw SnapshotError("Corrupted snapshot order"s);
+        }
+        placed[rank] = true;
+        updates[rank] = std::move(update);
+    }
+    if (!sheet->graph_.RestoreReferences(std::move(updates)))
+    {
+        throw SnapshotError("Corrupted snapshot order"s);
+    }
+
+    for (size_t i = 0; i < cells.size(); ++i)
+    {
+        const CellRecord& record = records[i];
+        const Position pos{ record.row, record.col };
+        Cell& cell = sheet->sheet_.Emplace(pos, std::move(cells[i]));
+        sheet->AddToPrintableArea(pos);
+        if (record.kind != CellKind::Formula)
+        {
+            continue;
+        }
+        if (record.tag == ValueTag::Number)
+        {
+            cell.RestoreCachedValue(record.value);
+        }
+        else if (IsErrorTag(record.tag))
+        {
+            cell.RestoreCachedValue(FormulaError(ToErrorCategory(record.tag)));
+        }
+        else
+        {
+            sheet->dirty_cells_.insert(pos);
+        }
+    }
+    // ссылки на пустые ячейки становятся виртуальными ячейками, как в SetCell
+    for (const CellRecord& record : records)
+    {
+        if (record.kind != CellKind::Formula)
+        {
+            continue;
+        }
+        const Position pos{ record.row, record.col };
+        for (const Position ref : sheet->sheet_.Find(pos)->GetReferencedCells())
+        {
+            if (!sheet->sheet_.Find(ref))
+            {
+                sheet->SetVCell(ref, pos);
+            }
+        }
+    }
+    // размер печатной области следует из самих ячеек; заголовок с ним сверяется
+    if (header.print_rows != sheet->print_size_.rows || header.print_cols != sheet->print_size_.cols)
+    {
+        throw SnapshotError("Corrupted snapshot size"s);
+    }
+    if (journal_sequence)
+    {
+        *journal_sequence = header.journal_sequence;
+    }
+    return sheet;
+}
+
+std::unique_ptr<Sheet> LoadSnapshotFile(const std::string& path, uint64_t* journal_sequence)
+{
+    const MappedFile file(path);
+    return LoadSnapshot(file.GetData(), journal_sequence);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "sheet.h"
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// Бинарный снимок таблицы. Снимок хранит ячейки вместе с вычисленными
+// значениями формул, тексты ячеек и формулы в разобранном виде (см.
+// FormulaAST::Serialize): формула, общая для нескольких ячеек, записывается
+// один раз. При загрузке ничего не разбирается как текст и не пересчитывается:
+// тексты хранятся вместе со своими значениями, а граф зависимостей
+// восстанавливается в сохранённом топологическом порядке, без поиска циклов.
+// Формат версионирован и защищён контрольной суммой; числа записываются в
+// порядке байтов машины, и снимок с другим порядком не загружается.
+class SnapshotError : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// journal_sequence - номер последней записи журнала изменений (см. journal.h),
+// которая уже отражена в таблице
+void SaveSnapshot(const Sheet& sheet, std::ostream& output, uint64_t journal_sequence = 0);
+// Записывает версию таблицы; её можно записывать в любом потоке, пока
+// таблица продолжает меняться. Порядок формул для версии вычисляется
+// заново, поэтому её запись дороже записи самой таблицы
+void SaveSnapshot(const SheetVersion& version, std::ostream& output, uint64_t journal_sequence = 0);
+
+// Загружает снимок из памяти и, если journal_sequence не nullptr, записывает
+// туда номер записи журнала, сохранённый со снимком. Бросает SnapshotError,
+// если данные не являются снимком, повреждены или записаны другой версией формата
+std::unique_ptr<Sheet> LoadSnapshot(std::string_view data, uint64_t* journal_sequence = nullptr);
+
+// Отображает файл снимка в память и загружает его
+std::unique_ptr<Sheet> LoadSnapshotFile(const std::string& path, uint64_t* journal_sequence = nullptr);
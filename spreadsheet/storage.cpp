@@ -0,0 +1,165 @@
+#include "storage.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace
+{
+    // Счётчик ссылок читается без синхронизации. Если других владельцев нет,
+    // барьер упорядочивает последующую запись после чтений потока, который
+    // отпустил последнюю общую ссылку
+    template <typename T>
+    bool IsShared(const std::shared_ptr<T>& ptr)
+    {
+        if (ptr.use_count() > 1)
+        {
+            return true;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return false;
+    }
+}
+
+CellStorage::CellStorage()
+    : bands_(BAND_COUNT) {}
+
+Cell* CellStorage::Find(Position pos)
+{
+    if (!static_cast<const CellStorage&>(*this).Find(pos))
+    {
+        return nullptr;
+    }
+    return &*GetUniqueTile(pos).cells[GetIndexInTile(pos)];
+}
+
+const Cell* CellStorage::Find(Position pos) const
+{
+    const Tile* tile = FindTile(pos);
+    if (!tile)
+    {
+        return nullptr;
+    }
+    const std::optional<Cell>& cell = tile->cells[GetIndexInTile(pos)];
+    return cell ? &*cell : nullptr;
+}
+
+Cell& CellStorage::Emplace(Position pos, Cell&& cell)
+{
+    Tile& tile = GetUniqueTile(pos);
+    std::optional<Cell>& slot = tile.cells[GetIndexInTile(pos)];
+    if (!slot)
+    {
+        ++tile.cell_count;
+        ++cell_count_;
+    }
+    slot.reset();
+    slot.emplace(std::move(cell));
+    const int value_index = GetValueIndexInTile(pos);
+    slot->BindValue(ValueSlot(&tile.values[value_index], &tile.tags[value_index]));
+    return *slot;
+}
+
+bool CellStorage::Erase(Position pos)
+{
+    if (!static_cast<const CellStorage&>(*this).Find(pos))
+    {
+        return false;
+    }
+    GetUniqueTile(pos);
+    std::shared_ptr<Band>& band = bands_[pos.row / TILE_ROWS];
+    const int tile_index = pos.col / TILE_COLS;
+    std::shared_ptr<Tile>& tile = band->tiles[tile_index];
+    tile->cells[GetIndexInTile(pos)].reset();
+    tile->tags[GetValueIndexInTile(pos)].store(ValueTag::Empty, std::memory_order_relaxed);
+    --cell_count_;
+    if (--tile->cell_count == 0)
+    {
+        tile.reset();
+        band->used_tiles.erase(
+            std::lower_bound(band->used_tiles.begin(), band->used_tiles.end(), tile_index));
+        if (band->used_tiles.empty())
+        {
+            band.reset();
+        }
+    }
+    return true;
+}
+
+bool CellStorage::IsEmpty() const
+{
+    return cell_count_ == 0;
+}
+
+size_t CellStorage::GetCellCount() const
+{
+    return cell_count_;
+}
+
+int CellStorage::GetIndexInTile(Position pos)
+{
+    return (pos.row % TILE_ROWS) * TILE_COLS + pos.col % TILE_COLS;
+}
+
+int CellStorage::GetValueIndexInTile(Position pos)
+{
+    return (pos.col % TILE_COLS) * TILE_ROWS + pos.row % TILE_ROWS;
+}
+
+const CellStorage::Tile* CellStorage::FindTile(Position pos) const
+{
+    const Band* band = bands_[pos.row / TILE_ROWS].get();
+    if (!band)
+    {
+        return nullptr;
+    }
+    return band->tiles[pos.col / TILE_COLS].get();
+}
+
+CellStorage::Tile& CellStorage::GetUniqueTile(Position pos)
+{
+    std::shared_ptr<Band>& band = bands_[pos.row / TILE_ROWS];
+    if (!band)
+    {
+        band = std::make_shared<Band>();
+    }
+    else if (IsShared(band))
+    {
+        // копия полосы разделяет плитки с оригиналом
+        band = std::make_shared<Band>(*band);
+    }
+    const int tile_index = pos.col / TILE_COLS;
+    std::shared_ptr<Tile>& tile = band->tiles[tile_index];
+    if (!tile)
+    {
+        tile = std::make_shared<Tile>();
+        band->used_tiles.insert(
+            std::upper_bound(band->used_tiles.begin(), band->used_tiles.end(), tile_index),
+            tile_index);
+    }
+    else if (IsShared(tile))
+    {
+        tile = CloneTile(*tile);
+    }
+    return *tile;
+}
+
+std::shared_ptr<CellStorage::Tile> CellStorage::CloneTile(const Tile& tile)
+{
+    auto clone = std::make_shared<Tile>();
+    clone->values = tile.values;
+    for (int index = 0; index < TILE_SIZE; ++index)
+    {
+        clone->tags[index].store(tile.tags[index].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    clone->cell_count = tile.cell_count;
+    for (int index = 0; index < TILE_SIZE; ++index)
+    {
+        if (const std::optional<Cell>& cell = tile.cells[index])
+        {
+            const int value_index = (index % TILE_COLS) * TILE_ROWS + index / TILE_COLS;
+            clone->cells[index].emplace(*cell);
+            clone->cells[index]->RebindValue(ValueSlot(&clone->values[value_index], &clone->tags[value_index]));
+        }
+    }
+    return clone;
+}
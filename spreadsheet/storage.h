@@ -0,0 +1,142 @@
+#pragma once
+
+#include "cell.h"
+#include "common.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <vector>
+
+// Хранилище ячеек таблицы, разбитое на плитки фиксированного размера.
+// Плитка хранит свои ячейки подряд, по строкам, и создаётся при записи первой
+// ячейки в неё. Вычисленные значения и их теги лежат в плитке отдельно от
+// ячеек, в массивах по столбцам (см. ValueSlot). Каталог плиток двухуровневый:
+// полосы по TILE_ROWS строк, внутри полосы - плитки по TILE_COLS столбцов.
+// Поиск ячейки сводится к вычислению индексов, без хэширования.
+// Полосы и плитки разделяются копиями хранилища и копируются при записи:
+// копия хранилища стоит O(числа полос), а изменение ячейки копирует только
+// её полосу и плитку, если они ещё общие. Копию, которую не меняют, можно
+// читать из других потоков, пока меняется оригинал. Для этого в общих
+// плитках не должно быть невычисленных формул: вычисление пишет в кэш плитки
+class CellStorage
+{
+public:
+    static const int TILE_ROWS = 64;
+    static const int TILE_COLS = 16;
+
+    CellStorage();
+    CellStorage(const CellStorage& other) = default;
+    CellStorage& operator=(const CellStorage& other) = default;
+
+    // Позиции должны быть корректными: проверка выполняется таблицей.
+    // Неконстантный поиск готовит ячейку к изменению и копирует её плитку,
+    // если та общая с другой копией хранилища
+    Cell* Find(Position pos);
+    const Cell* Find(Position pos) const;
+
+    // Записывает ячейку в позицию pos, уничтожая прежнюю
+    Cell& Emplace(Position pos, Cell&& cell);
+
+    // Возвращает false, если ячейки не было
+    bool Erase(Position pos);
+
+    bool IsEmpty() const;
+    size_t GetCellCount() const;
+
+    // Обходит непустые ячейки построчно: по возрастанию строки, внутри строки -
+    // по возрастанию столбца. func вызывается как func(Position, const Cell&)
+    template <typename Func>
+    void ForEach(Func&& func) const;
+
+    // Обходит кэш значений столбца col в строках [first_row, last_row] блоками,
+    // которые лежат в памяти подряд. func вызывается как
+    // func(int first_row, const double* values, const std::atomic<ValueTag>* tags, size_t count),
+    // где first_row - строка первого значения блока. Плитки без ячеек пропускаются
+    template <typename Func>
+    void ForEachValueBlock(int col, int first_row, int last_row, Func&& func) const;
+
+private:
+    static const int TILE_SIZE = TILE_ROWS * TILE_COLS;
+    static const int BAND_COUNT = (Position::MAX_ROWS + TILE_ROWS - 1) / TILE_ROWS;
+    static const int TILES_PER_BAND = (Position::MAX_COLS + TILE_COLS - 1) / TILE_COLS;
+
+    struct Tile
+    {
+        std::array<std::optional<Cell>, TILE_SIZE> cells;
+        // столбец плитки занимает TILE_ROWS элементов подряд
+        std::array<double, TILE_SIZE> values{};
+        std::array<std::atomic<ValueTag>, TILE_SIZE> tags{};
+        int cell_count = 0;
+    };
+
+    struct Band
+    {
+        std::array<std::shared_ptr<Tile>, TILES_PER_BAND> tiles;
+        // номера созданных плиток по возрастанию, чтобы не просматривать
+        // весь массив при обходе разреженной полосы
+        std::vector<int> used_tiles;
+    };
+
+    std::vector<std::shared_ptr<Band>> bands_;
+    size_t cell_count_ = 0;
+
+    static int GetIndexInTile(Position pos);
+    static int GetValueIndexInTile(Position pos);
+    const Tile* FindTile(Position pos) const;
+    // Плитка позиции pos, которой владеет только это хранилище. Полоса и
+    // плитка создаются или копируются при необходимости
+    Tile& GetUniqueTile(Position pos);
+    static std::shared_ptr<Tile> CloneTile(const Tile& tile);
+};
+
+template <typename Func>
+void CellStorage::ForEach(Func&& func) const
+{
+    for (int band_index = 0; band_index < BAND_COUNT; ++band_index)
+    {
+        const Band* band = bands_[band_index].get();
+        if (!band)
+        {
+            continue;
+        }
+        const int first_row = band_index * TILE_ROWS;
+        for (int row_in_tile = 0; row_in_tile < TILE_ROWS; ++row_in_tile)
+        {
+            for (const int tile_index : band->used_tiles)
+            {
+                const Tile& tile = *band->tiles[tile_index];
+                const auto* row_cells = tile.cells.data() + row_in_tile * TILE_COLS;
+                for (int col_in_tile = 0; col_in_tile < TILE_COLS; ++col_in_tile)
+                {
+                    if (row_cells[col_in_tile])
+                    {
+                        func(Position{ first_row + row_in_tile, tile_index * TILE_COLS + col_in_tile },
+                            *row_cells[col_in_tile]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <typename Func>
+void CellStorage::ForEachValueBlock(int col, int first_row, int last_row, Func&& func) const
+{
+    const int tile_index = col / TILE_COLS;
+    for (int row = first_row; row <= last_row;)
+    {
+        const int band_index = row / TILE_ROWS;
+        const int block_end = std::min(last_row + 1, (band_index + 1) * TILE_ROWS);
+        const Band* band = bands_[band_index].get();
+        if (const Tile* tile = band ? band->tiles[tile_index].get() : nullptr)
+        {
+            const int value_index = GetValueIndexInTile(Position{ row, col });
+            func(row, tile->values.data() + value_index, tile->tags.data() + value_index,
+                static_cast<size_t>(block_end - row));
+        }
+        row = block_end;
+    }
+}
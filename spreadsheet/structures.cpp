@@ -4,16 +4,9 @@
 #include <sstream>
 #include <algorithm>
 #include <cassert>
-#include <regex>
-#include <deque>
-#include <cmath>
 
 // -------  Position from common.h  ------
 
-const int LETTERS = 26;
-const int MAX_POSITION_LENGTH = 17;
-const int MAX_POS_LETTER_COUNT = 3;
-
 const Position Position::NONE = {-1, -1};
 
 bool Position::operator==(const Position rhs) const
@@ -26,97 +19,113 @@ bool Position::operator<(const Position rhs) const
     return std::pair(row, col) < std::pair(rhs.row, rhs.col);
 }
 
-bool Position::IsValid() const
+std::string Position::ToString() const
 {
-    return !(row < 0 || col < 0 || row >= MAX_ROWS || col >= MAX_COLS);
+    char buffer[MAX_STRING_LENGTH];
+    const auto [end, error] = ToChars(buffer, buffer + MAX_STRING_LENGTH);
+    if (error != std::errc())
+    {
+        return {};
+    }
+    return std::string(buffer, end);
+}
+
+bool Size::operator==(Size rhs) const {
+    return cols == rhs.cols && rows == rhs.rows;
 }
 
-char GetCharDigit(int digit, int MAX_DIGIT = LETTERS)
+// -------  CellRange from common.h  -------
+
+bool CellRange::operator==(const CellRange& rhs) const
 {
-    assert(digit >= 0 && digit < MAX_DIGIT);
+    return first == rhs.first && last == rhs.last;
+}
 
-    return digit + 65;
+bool CellRange::IsValid() const
+{
+    return first.IsValid() && last.IsValid() && first.row <= last.row && first.col <= last.col;
 }
 
-std::string GetStringNumber(int number, const int MAX_DIGIT = LETTERS)
+bool CellRange::Contains(Position pos) const
 {
-    assert(number >= 0);
-    assert(MAX_DIGIT > 0 && MAX_DIGIT <= LETTERS);
-    int remainder = (number) % (MAX_DIGIT);
-    number = (number) / (MAX_DIGIT);
-    std::deque<int> d_result;
-    while (number != 0)
-    {
-        d_result.push_front(remainder);
-        remainder = (number - 1) % (MAX_DIGIT);
-        number = (number - 1) / (MAX_DIGIT);
-    }
-    d_result.push_front(remainder);
-    std::string result;
-    for (const int digit : d_result)
-    {
-        result.push_back(GetCharDigit(digit, MAX_DIGIT));
-    }
-    return result;
+    return pos.row >= first.row && pos.row <= last.row && pos.col >= first.col && pos.col <= last.col;
 }
 
-std::string Position::ToString() const
+// -------  RangeSummary from common.h  -------
+
+void RangeSummary::Add(double value)
 {
-    if (!IsValid())
+    sum += value;
+    min = std::min(min, value);
+    max = std::max(max, value);
+    ++count;
+}
+
+void RangeSummary::Merge(const RangeSummary& other)
+{
+    sum += other.sum;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+    count += other.count;
+    if (!error)
     {
-        return {};
+        error = other.error;
     }
-    return GetStringNumber(col) + (std::to_string(row + 1));
 }
 
-int GetDigitFromChar(char ch)
+size_t PositionHasher::operator()(const Position key) const
 {
-    assert(ch > 64 && ch < 92);
-    return ch - 65;
+    return std::hash<int>()(key.row) + std::hash<int>()(key.col) * 71;
 }
 
-int ConvertStringToInt(std::string_view str)
+// -------  SheetInterface from common.h  -------
+
+double SheetInterface::GetCellNumber(Position pos) const
 {
-    int result = 0;
-    int index = 0;
-    for (const char* ch = str.data() + str.size() - 1; ch > str.data(); --ch)
+    const CellInterface* cell = GetCell(pos);
+    if (!cell)
     {
-        result += GetDigitFromChar(*ch) * pow(LETTERS, index) + (index > 0 ? LETTERS : 0);
-        ++index;
+        return 0;
     }
-    if (str.size() > 1)
+    const CellInterface::Value result = cell->GetValue();
+    if (std::holds_alternative<FormulaError>(result))
     {
-        result += (GetDigitFromChar(*str.data()) + 1) * pow(LETTERS, index);
+        return ToErrorNumber(std::get<FormulaError>(result).GetCategory());
     }
-    else
+    else if (std::holds_alternative<std::string>(result))
     {
-        result = GetDigitFromChar(*str.data());
+        return ToErrorNumber(FormulaError::Category::Value);
     }
-    return result;
+    return std::get<double>(result);
 }
 
-Position Position::FromString(std::string_view str)
+RangeSummary SheetInterface::SummarizeRange(CellRange range) const
 {
-    using namespace std::literals;
-    std::regex adress("[A-Z]+\\d+"s);
-    std::string s = std::string(str.data(), str.size());
-    if (!std::regex_match(s, adress) || str.size() > MAX_POSITION_LENGTH)
+    RangeSummary summary;
+    for (int row = range.first.row; row <= range.last.row; ++row)
     {
-        return Position::NONE;
+        for (int col = range.first.col; col <= range.last.col; ++col)
+        {
+            const CellInterface* cell = GetCell(Position{ row, col });
+            if (!cell)
+            {
+                continue;
+            }
+            const CellInterface::Value value = cell->GetValue();
+            if (std::holds_alternative<FormulaError>(value))
+            {
+                summary.error = std::get<FormulaError>(value);
+                return summary;
+            }
+            // пустая ячейка тоже даёт ноль, но в итог не входит
+            if (std::holds_alternative<double>(value)
+                && (std::get<double>(value) != 0 || !cell->GetText().empty()))
+            {
+                summary.Add(std::get<double>(value));
+            }
+        }
     }
-
-    static const std::string_view DEC_DIGITS = "0123456789"sv;
-    size_t delim = str.find_first_of(DEC_DIGITS);
-    return { std::stoi(str.substr(delim).data()) - 1, ConvertStringToInt(str.substr(0, delim)) };
-}
-
-bool Size::operator==(Size rhs) const {
-    return cols == rhs.cols && rows == rhs.rows;
-}
-
-size_t PositionHasher::operator()(const Position key) const
-{
-    return std::hash<int>()(key.row) + std::hash<int>()(key.col) * 71;
+    return summary;
 }
 
 // -------  FormulaError from common.h  -------
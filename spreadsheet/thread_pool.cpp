@@ -0,0 +1,112 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t thread_count)
+{
+    const size_t workers = thread_count > 1 ? thread_count - 1 : 0;
+    workers_.reserve(workers);
+    for (size_t i = 0; i < workers; ++i)
+    {
+        workers_.emplace_back([this]() { WorkerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    work_ready_.notify_all();
+    for (std::thread& worker : workers_)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& task)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    std::unique_lock lock(mutex_);
+    task_ = &task;
+    task_count_ = count;
+    next_index_ = 0;
+    finished_ = 0;
+    error_ = nullptr;
+    ++generation_;
+    work_ready_.notify_all();
+
+    RunTasks(lock);
+    work_done_.wait(lock, [this]() { return finished_ == task_count_; });
+
+    task_ = nullptr;
+    std::exception_ptr error = std::move(error_);
+    error_ = nullptr;
+    lock.unlock();
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+size_t ThreadPool::GetThreadCount() const
+{
+    return workers_.size() + 1;
+}
+
+void ThreadPool::WorkerLoop()
+{
+    std::unique_lock lock(mutex_);
+    size_t seen_generation = generation_;
+    while (true)
+    {
+        work_ready_.wait(lock, [&]() { return stop_ || generation_ != seen_generation; });
+        if (stop_)
+        {
+            return;
+        }
+        seen_generation = generation_;
+        RunTasks(lock);
+    }
+}
+
+// Задачи раздаются порциями, чтобы потоки реже брали мьютекс.
+// Вызывается и возвращает управление с захваченным мьютексом
+void ThreadPool::RunTasks(std::unique_lock<std::mutex>& lock)
+{
+    const size_t chunk = std::max<size_t>(1, task_count_ / (GetThreadCount() * 8));
+    while (next_index_ < task_count_)
+    {
+        const std::function<void(size_t)>& task = *task_;
+        const size_t begin = next_index_;
+        const size_t end = std::min(task_count_, begin + chunk);
+        next_index_ = end;
+        lock.unlock();
+        std::exception_ptr error;
+        try
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                task(i);
+            }
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        lock.lock();
+        if (error && !error_)
+        {
+            error_ = error;
+        }
+        finished_ += end - begin;
+        if (finished_ == task_count_)
+        {
+            work_done_.notify_all();
+        }
+    }
+}
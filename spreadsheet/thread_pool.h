@@ -0,0 +1,45 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Пул рабочих потоков для параллельной обработки независимых задач.
+// Потоки создаются один раз и ждут работы между вызовами ParallelFor.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(size_t thread_count);
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ~ThreadPool();
+
+    // Вызывает task(i) для всех i из [0, count) и дожидается завершения.
+    // Вызывающий поток тоже участвует в работе. Если задача бросила
+    // исключение, оно пробрасывается наружу после завершения остальных задач
+    void ParallelFor(size_t count, const std::function<void(size_t)>& task);
+
+    // Число потоков, включая вызывающий
+    size_t GetThreadCount() const;
+
+private:
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable work_ready_;
+    std::condition_variable work_done_;
+
+    const std::function<void(size_t)>* task_ = nullptr;
+    size_t task_count_ = 0;
+    size_t next_index_ = 0;
+    size_t finished_ = 0;
+    size_t generation_ = 0;
+    bool stop_ = false;
+    std::exception_ptr error_;
+
+    void WorkerLoop();
+    void RunTasks(std::unique_lock<std::mutex>& lock);
+};
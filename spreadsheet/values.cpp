@@ -0,0 +1,131 @@
+#include "values.h"
+
+#include <algorithm>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SPREADSHEET_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    bool IsSummable(const std::atomic<ValueTag>& tag)
+    {
+        const ValueTag value = tag.load(std::memory_order_acquire);
+        return value == ValueTag::Number || value == ValueTag::Empty;
+    }
+
+    // Добавляет числа блока по одному; не меняет summary, если в блоке есть
+    // теги, кроме Number и Empty
+    bool SummarizeNumbersScalar(const double* values, const std::atomic<ValueTag>* tags, size_t count,
+        RangeSummary& summary)
+    {
+        if (!std::all_of(tags, tags + count, IsSummable))
+        {
+            return false;
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (tags[i].load(std::memory_order_relaxed) == ValueTag::Number)
+            {
+                summary.Add(values[i]);
+            }
+        }
+        return true;
+    }
+}
+
+#ifdef SPREADSHEET_SSE2
+
+// Значения обрабатываются по четыре, в двух регистрах по два double. Пустые
+// ячейки заменяются масками на нейтральные значения (0 для суммы, +-inf для
+// минимума и максимума), поэтому в цикле нет ветвлений. Проверка тегов идёт
+// в том же проходе: итог копится отдельно и добавляется в summary только для
+// блока без текста, ошибок и невычисленных формул
+bool SummarizeNumbers(const double* values, const std::atomic<ValueTag>* tags, size_t count,
+    RangeSummary& summary)
+{
+    const size_t STEP = 4;
+    const size_t vector_count = count / STEP * STEP;
+    if (vector_count == 0)
+    {
+        return SummarizeNumbersScalar(values, tags, count, summary);
+    }
+
+    const double INF = std::numeric_limits<double>::infinity();
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d one = _mm_set1_pd(1);
+    const __m128d plus_inf = _mm_set1_pd(INF);
+    const __m128d minus_inf = _mm_set1_pd(-INF);
+    const __m128i number_tag = _mm_set1_epi8(static_cast<char>(ValueTag::Number));
+    const __m128i empty_tag = _mm_set1_epi8(static_cast<char>(ValueTag::Empty));
+
+    // две независимые цепочки сложений на каждый итог
+    __m128d sum_low = zero, sum_high = zero;
+    __m128d min_low = plus_inf, min_high = plus_inf;
+    __m128d max_low = minus_inf, max_high = minus_inf;
+    __m128d count_low = zero, count_high = zero;
+    const auto accumulate = [&](__m128d mask, const double* block_values, __m128d& sum, __m128d& min,
+        __m128d& max, __m128d& number_count) {
+        const __m128d numbers = _mm_and_pd(mask, _mm_loadu_pd(block_values));
+        sum = _mm_add_pd(sum, numbers);
+        min = _mm_min_pd(min, _mm_or_pd(numbers, _mm_andnot_pd(mask, plus_inf)));
+        max = _mm_max_pd(max, _mm_or_pd(numbers, _mm_andnot_pd(mask, minus_inf)));
+        number_count = _mm_add_pd(number_count, _mm_and_pd(mask, one));
+    };
+    __m128i summable = _mm_set1_epi8(-1);
+    for (size_t i = 0; i < vector_count; i += STEP)
+    {
+        // теги читаются по одному с acquire: на x86 это обычные загрузки байтов
+        int packed_tags = 0;
+        for (size_t j = 0; j < STEP; ++j)
+        {
+            packed_tags |= static_cast<int>(tags[i + j].load(std::memory_order_acquire)) << (8 * j);
+        }
+        const __m128i tag_bytes = _mm_cvtsi32_si128(packed_tags);
+        __m128i is_number = _mm_cmpeq_epi8(tag_bytes, number_tag);
+        summable = _mm_and_si128(summable, _mm_or_si128(is_number, _mm_cmpeq_epi8(tag_bytes, empty_tag)));
+
+        // байт признака каждого тега растягивается на 64 бита своего значения
+        is_number = _mm_unpacklo_epi8(is_number, is_number);
+        is_number = _mm_unpacklo_epi16(is_number, is_number);
+        accumulate(_mm_castsi128_pd(_mm_unpacklo_epi32(is_number, is_number)), values + i,
+            sum_low, min_low, max_low, count_low);
+        accumulate(_mm_castsi128_pd(_mm_unpackhi_epi32(is_number, is_number)), values + i + 2,
+            sum_high, min_high, max_high, count_high);
+    }
+    // проверяются только байты тегов, остальные байты регистра нулевые и
+    // совпадают с тегом Empty
+    if (_mm_movemask_epi8(summable) != 0xFFFF)
+    {
+        return false;
+    }
+    RangeSummary tail;
+    if (!SummarizeNumbersScalar(values + vector_count, tags + vector_count, count - vector_count, tail))
+    {
+        return false;
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(sum_low, sum_high));
+    summary.sum += lanes[0] + lanes[1];
+    _mm_storeu_pd(lanes, _mm_min_pd(min_low, min_high));
+    summary.min = std::min({ summary.min, lanes[0], lanes[1] });
+    _mm_storeu_pd(lanes, _mm_max_pd(max_low, max_high));
+    summary.max = std::max({ summary.max, lanes[0], lanes[1] });
+    _mm_storeu_pd(lanes, _mm_add_pd(count_low, count_high));
+    summary.count += static_cast<size_t>(lanes[0] + lanes[1]);
+    summary.Merge(tail);
+    return true;
+}
+
+#else
+
+bool SummarizeNumbers(const double* values, const std::atomic<ValueTag>* tags, size_t count,
+    RangeSummary& summary)
+{
+    return SummarizeNumbersScalar(values, tags, count, summary);
+}
+
+#endif
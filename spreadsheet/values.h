@@ -0,0 +1,146 @@
+#pragma once
+
+#include "common.h"
+#include "formula.h"
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+// Признак значения ячейки в столбцовом кэше значений. Числовые значения
+// тегов записываются в снимки (см. snapshot.h), поэтому новые теги
+// добавляются в конец
+enum class ValueTag : std::uint8_t
+{
+    Empty,            // пустая ячейка
+    Text,             // значение нужно брать из самой ячейки
+    Dirty,            // формула, значение которой ещё не вычислено
+    Number,           // значение формулы или текста, записанного числом
+    RefError,
+    ValueError,
+    ArithmeticError,
+    Computing,        // формулу вычисляет один из читающих потоков
+};
+
+// Теги читаются и пишутся атомарно: значения формул вычисляются при чтении,
+// и читать таблицу могут несколько потоков сразу
+static_assert(sizeof(std::atomic<ValueTag>) == 1 && std::atomic<ValueTag>::is_always_lock_free);
+
+inline bool IsErrorTag(ValueTag tag)
+{
+    return tag >= ValueTag::RefError && tag <= ValueTag::ArithmeticError;
+}
+
+inline ValueTag ToValueTag(FormulaError::Category category)
+{
+    switch (category)
+    {
+    case FormulaError::Category::Ref:
+        return ValueTag::RefError;
+    case FormulaError::Category::Value:
+        return ValueTag::ValueError;
+    default:
+        return ValueTag::ArithmeticError;
+    }
+}
+
+// Вызывать только для тегов ошибок
+inline FormulaError::Category ToErrorCategory(ValueTag tag)
+{
+    switch (tag)
+    {
+    case ValueTag::RefError:
+        return FormulaError::Category::Ref;
+    case ValueTag::ValueError:
+        return FormulaError::Category::Value;
+    default:
+        return FormulaError::Category::Arithmetic;
+    }
+}
+
+// Добавляет в summary числа из блока кэша значений. Если в блоке есть что-то
+// кроме чисел и пустых ячеек, ничего не добавляет и возвращает false: такой
+// блок нужно разбирать по ячейкам
+bool SummarizeNumbers(const double* values, const std::atomic<ValueTag>* tags, size_t count,
+    RangeSummary& summary);
+
+// Место ячейки в столбцовом кэше значений. Сами числа и теги лежат в плитке
+// хранилища отдельными массивами, по столбцам, а не внутри ячеек, поэтому
+// пересчёт и чтение диапазонов идут по непрерывной памяти.
+// Ячейка, ещё не помещённая в хранилище, к кэшу не привязана.
+// Число записывается до тега, а тег публикуется с release, поэтому поток,
+// который прочитал тег Number, видит и само число
+class ValueSlot
+{
+public:
+    ValueSlot() = default;
+    ValueSlot(double* value, std::atomic<ValueTag>* tag)
+        : value_(value), tag_(tag) {}
+
+    bool IsBound() const
+    {
+        return tag_ != nullptr;
+    }
+
+    ValueTag GetTag() const
+    {
+        return tag_->load(std::memory_order_acquire);
+    }
+
+    void SetTag(ValueTag tag) const
+    {
+        tag_->store(tag, std::memory_order_release);
+    }
+
+    double GetNumber() const
+    {
+        return *value_;
+    }
+
+    void Set(const FormulaInterface::Value& value) const
+    {
+        if (std::holds_alternative<double>(value))
+        {
+            *value_ = std::get<double>(value);
+            SetTag(ValueTag::Number);
+        }
+        else
+        {
+            SetTag(ToValueTag(std::get<FormulaError>(value).GetCategory()));
+        }
+    }
+
+    // Переводит Dirty в Computing. Возвращает true только одному из потоков,
+    // которые пытаются вычислить формулу одновременно
+    bool TryStartComputing() const
+    {
+        ValueTag expected = ValueTag::Dirty;
+        return tag_->compare_exchange_strong(expected, ValueTag::Computing, std::memory_order_acquire);
+    }
+
+    // Ждёт, пока другой поток закончит вычисление, и возвращает новый тег
+    ValueTag WaitComputed() const
+    {
+        ValueTag tag;
+        while ((tag = GetTag()) == ValueTag::Computing)
+        {
+            std::this_thread::yield();
+        }
+        return tag;
+    }
+
+    // Значение вычисленной формулы: тег должен быть числом или ошибкой
+    FormulaInterface::Value Get() const
+    {
+        const ValueTag tag = GetTag();
+        if (tag == ValueTag::Number)
+        {
+            return *value_;
+        }
+        return FormulaError(ToErrorCategory(tag));
+    }
+
+private:
+    double* value_ = nullptr;
+    std::atomic<ValueTag>* tag_ = nullptr;
+};
@@ -0,0 +1,71 @@
+#include "virtual_cells.h"
+
+#include <algorithm>
+#include <cassert>
+
+void VirtualCellIndex::Add(Position pos, Position dependent)
+{
+    if (dependents_[pos].insert(dependent).second)
+    {
+        cells_[dependent].push_back(pos);
+    }
+}
+
+bool VirtualCellIndex::Contains(Position pos) const
+{
+    return dependents_.count(pos) > 0;
+}
+
+void VirtualCellIndex::RemoveDependent(Position dependent)
+{
+    const auto cells = cells_.find(dependent);
+    if (cells == cells_.end())
+    {
+        return;
+    }
+    for (const Position pos : cells->second)
+    {
+        const auto dependents = dependents_.find(pos);
+        assert(dependents != dependents_.end());
+        dependents->second.erase(dependent);
+        if (dependents->second.empty())
+        {
+            dependents_.erase(dependents);
+        }
+    }
+    cells_.erase(cells);
+}
+
+void VirtualCellIndex::Remove(Position pos)
+{
+    const auto dependents = dependents_.find(pos);
+    if (dependents == dependents_.end())
+    {
+        return;
+    }
+    for (const Position dependent : dependents->second)
+    {
+        const auto cells = cells_.find(dependent);
+        assert(cells != cells_.end());
+        std::vector<Position>& list = cells->second;
+        const auto it = std::find(list.begin(), list.end(), pos);
+        assert(it != list.end());
+        *it = list.back();
+        list.pop_back();
+        if (list.empty())
+        {
+            cells_.erase(cells);
+        }
+    }
+    dependents_.erase(dependents);
+}
+
+bool VirtualCellIndex::IsEmpty() const
+{
+    return dependents_.empty();
+}
+
+size_t VirtualCellIndex::GetSize() const
+{
+    return dependents_.size();
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "common.h"
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Виртуальные ячейки - пустые ячейки, на которые ссылаются формулы.
+// Индекс хранит связь в обе стороны: для виртуальной ячейки - формулы,
+// которые на неё ссылаются, для формулы - её виртуальные ячейки. Поэтому
+// изменение ячейки стоит пропорционально числу её собственных ссылок, а не
+// числу всех виртуальных ячеек таблицы
+class VirtualCellIndex
+{
+public:
+    // Отмечает, что формула dependent ссылается на пустую ячейку pos
+    void Add(Position pos, Position dependent);
+
+    bool Contains(Position pos) const;
+
+    // Удаляет ссылки формулы dependent. Ячейки, на которые больше никто не
+    // ссылается, перестают быть виртуальными
+    void RemoveDependent(Position dependent);
+
+    // Ячейка pos получила значение и больше не виртуальная
+    void Remove(Position pos);
+
+    bool IsEmpty() const;
+    // Число виртуальных ячеек
+    size_t GetSize() const;
+
+private:
+    using PositionSet = std::unordered_set<Position, PositionHasher>;
+
+    std::unordered_map<Position, PositionSet, PositionHasher> dependents_;
+    // у формулы немного ссылок, поэтому они хранятся списком
+    std::unordered_map<Position, std::vector<Position>, PositionHasher> cells_;
+};